@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
 #include <signal.h>
 #include <time.h>
@@ -11,6 +12,10 @@
 #include <sys/select.h>
 #include <sys/signalfd.h>
 #include <sys/sysinfo.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -551,6 +556,356 @@ static int terminal_destroy(terminal* this)
 
 
 
+/*
+	A gateway is a listening Unix-domain socket of the host. Its io_device
+	is ready (for IODIR_RX) when there are pending connections.
+
+	Each accepted connection is a channel, whose socket is handled by a
+	pair of io_devices. The channel table is shared between the cores and
+	the PIC thread, by the channel state:
+	- cores take a CHANNEL_FREE channel in bios_gateway_accept(), 
+	  making it CHANNEL_OPEN,
+	- cores make a channel CHANNEL_CLOSING in bios_close_channel(),
+	- the PIC thread closes the socket of a CHANNEL_CLOSING channel and 
+	  makes it CHANNEL_FREE, when it is not in select().
+	Therefore, the PIC thread never selects on a closed fd.
+ */
+typedef struct gateway
+{
+	io_device conn;				/* the listening socket */
+	uint port;					/* the port of the gateway */
+} gateway;
+
+typedef enum channel_state
+{
+	CHANNEL_FREE = 0,
+	CHANNEL_OPEN,
+	CHANNEL_CLOSING
+} channel_state;
+
+typedef struct gateway_channel
+{
+	io_device rx, tx;			/* the two directions of the socket */
+	volatile channel_state state;
+} gateway_channel;
+
+/* The gateway table */
+static gateway GATEWAY[MAX_GATEWAYS];
+
+/* Current number of gateways */
+static uint ngateway = 0;
+
+/* The channel table */
+static gateway_channel CHANNEL[MAX_GATEWAY_CHANNELS];
+
+
+/*
+	Destroy a gateway, removing its socket file
+ */
+static int gateway_destroy(gateway* this)
+{
+	struct sockaddr_un addr;
+	socklen_t len = sizeof(addr);
+	if(getsockname(this->conn.fd, (struct sockaddr*)&addr, &len)==0 && addr.sun_path[0]!='\0')
+		unlink(addr.sun_path);
+	return io_device_destroy(& this->conn);
+}
+
+
+/*
+	Receive up to size bytes. Return the number of bytes, 0 if
+	the device is not ready or -1 at the end of data.
+ */
+static int io_device_recv(io_device* this, char* buf, uint size)
+{
+	assert(this->iodir == IODIR_RX);
+	int rc;
+	while((rc=recv(this->fd, buf, size, 0))==-1 && errno == EINTR);
+
+	if(rc==-1 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+		if(this->ready) {
+			this->ready = 0;
+			interrupt_pic_thread();
+		}
+		return 0;
+	}
+	return (rc > 0) ? rc : -1;
+}
+
+
+/*
+	Send up to size bytes. Return the number of bytes, 0 if
+	the device is not ready or -1 if the peer has closed.
+ */
+static int io_device_send(io_device* this, const char* buf, uint size)
+{
+	assert(this->iodir == IODIR_TX);
+	int rc;
+	while((rc=send(this->fd, buf, size, MSG_NOSIGNAL))==-1 && errno == EINTR);
+
+	if(rc==-1 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+		if(this->ready) {
+			this->ready = 0;
+			interrupt_pic_thread();
+		}
+		return 0;
+	}
+	return (rc > 0) ? rc : -1;
+}
+
+
+/*
+	Close the sockets of the channels that the cores have released.
+	This is called only by the PIC thread.
+ */
+static void gateway_reap_channels()
+{
+	for(uint i=0; i<MAX_GATEWAY_CHANNELS; i++) {
+		gateway_channel* ch = & CHANNEL[i];
+		if(__atomic_load_n(&ch->state, __ATOMIC_ACQUIRE) == CHANNEL_CLOSING) {
+			io_device_destroy(& ch->rx);
+			__atomic_store_n(&ch->state, CHANNEL_FREE, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+
+
+/*
+	Host files are served by the host file daemon, a thread that performs
+	all the I/O on the files of the host directory, so that the cores 
+	never block on the host file system.
+
+	Each host file has a ring buffer of HOSTFILE_BUFFER bytes. For a file
+	open for reading, the daemon fills it ahead of the cores (read-ahead);
+	for a file open for writing, the cores fill it and the daemon writes
+	it out behind them (write-behind). The head and tail of the ring are
+	free-running counters, and each is advanced by one side only, so the 
+	cores never take a lock.
+
+	As with gateway channels, the file table is shared by the file state:
+	- cores take a HOSTFILE_FREE file in bios_open_hostfile(), making it 
+	  HOSTFILE_OPEN,
+	- cores make a file HOSTFILE_CLOSING in bios_close_hostfile(),
+	- the daemon writes out the buffer of a HOSTFILE_CLOSING file, closes
+	  it and makes it HOSTFILE_FREE.
+
+	The cores wake the daemon through the kick eventfd. A core that finds
+	a file not ready sets its 'waiting' flag; the next time the daemon 
+	moves data of the file, it posts to the done eventfd, which the PIC
+	thread turns into a HOSTFILE_READY interrupt.
+ */
+typedef enum hostfile_state
+{
+	HOSTFILE_FREE = 0,
+	HOSTFILE_OPEN,
+	HOSTFILE_CLOSING
+} hostfile_state;
+
+typedef struct hostfile
+{
+	int fd;						/* the host file, used by the daemon */
+	int writing;				/* set if open for writing */
+	volatile hostfile_state state;
+	volatile uint head, tail;	/* the data of the ring is in [head, tail) */
+	volatile int done;			/* set at the end of a file open for reading,
+								   or on an I/O error */
+	volatile int error;			/* set on an I/O error */
+	volatile int waiting;		/* set when a core found the file not ready */
+	char buffer[HOSTFILE_BUFFER];
+} hostfile;
+
+/* The host file table */
+static hostfile HOSTFILE[MAX_HOSTFILES];
+
+/* The host directory, or -1 */
+static int hostdir_fd = -1;
+
+/* The eventfds of the daemon */
+static int hostfile_kick_fd, hostfile_done_fd;
+
+/* Set when the daemon has been kicked since it last scanned the files */
+static volatile int hostfile_kicked;
+
+/* Flag that signals that the daemon should be active */
+static volatile int hostfile_active;
+
+static pthread_t hostfile_thread;
+
+/* Used by PIC for timeouts */
+static TimerDuration hostfile_last_int;
+
+
+static void eventfd_post(int fd)
+{
+	uint64_t one = 1;
+	while(write(fd, &one, sizeof(one))==-1 && errno==EINTR);
+}
+
+static void eventfd_drain(int fd)
+{
+	uint64_t value;
+	while(read(fd, &value, sizeof(value))==-1 && errno==EINTR);
+}
+
+
+/* Wake up the daemon; only the first kick since it last scanned is posted */
+static inline void hostfile_kick()
+{
+	if(! __atomic_exchange_n(&hostfile_kicked, 1, __ATOMIC_ACQ_REL))
+		eventfd_post(hostfile_kick_fd);
+}
+
+
+/* The number of bytes in the ring */
+static inline uint hostfile_used(hostfile* f)
+{
+	return __atomic_load_n(&f->tail, __ATOMIC_SEQ_CST) - __atomic_load_n(&f->head, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+	Read ahead into the free space of the ring, if at least a quarter 
+	of it is free. Return 1 if the file has changed.
+ */
+static int hostfile_fill(hostfile* f)
+{
+	uint tail = f->tail;
+	uint space = HOSTFILE_BUFFER - hostfile_used(f);
+	if(f->done || space < HOSTFILE_BUFFER/4) return 0;
+
+	uint off = tail % HOSTFILE_BUFFER;
+	uint first = (space < HOSTFILE_BUFFER - off) ? space : HOSTFILE_BUFFER - off;
+	struct iovec iov[2] = {
+		{ .iov_base = f->buffer + off, .iov_len = first },
+		{ .iov_base = f->buffer, .iov_len = space - first }
+	};
+
+	ssize_t rc;
+	while((rc = readv(f->fd, iov, 2))==-1 && errno==EINTR);
+
+	if(rc > 0)
+		__atomic_store_n(&f->tail, tail + rc, __ATOMIC_SEQ_CST);
+	else {
+		if(rc == -1) {
+			perror("hostfile_fill: ");
+			__atomic_store_n(&f->error, 1, __ATOMIC_SEQ_CST);
+		}
+		__atomic_store_n(&f->done, 1, __ATOMIC_SEQ_CST);
+	}
+	return 1;
+}
+
+
+/*
+	Write out the data of the ring. Return 1 if the file has changed.
+ */
+static int hostfile_drain(hostfile* f)
+{
+	uint head = f->head;
+	uint count = hostfile_used(f);
+	if(f->done || count == 0) return 0;
+
+	uint off = head % HOSTFILE_BUFFER;
+	uint first = (count < HOSTFILE_BUFFER - off) ? count : HOSTFILE_BUFFER - off;
+	struct iovec iov[2] = {
+		{ .iov_base = f->buffer + off, .iov_len = first },
+		{ .iov_base = f->buffer, .iov_len = count - first }
+	};
+
+	ssize_t rc;
+	while((rc = writev(f->fd, iov, 2))==-1 && errno==EINTR);
+
+	if(rc > 0)
+		__atomic_store_n(&f->head, head + rc, __ATOMIC_SEQ_CST);
+	else {
+		perror("hostfile_drain: ");
+		__atomic_store_n(&f->error, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&f->done, 1, __ATOMIC_SEQ_CST);
+	}
+	return 1;
+}
+
+
+/*
+	Move the data of a file, and post a completion if a core waits for it.
+	When 'halting', the file is closed. Return 1 if the file has changed.
+ */
+static int hostfile_serve(hostfile* f, int halting)
+{
+	hostfile_state state = __atomic_load_n(&f->state, __ATOMIC_ACQUIRE);
+	if(state == HOSTFILE_FREE) return 0;
+
+	if(state == HOSTFILE_CLOSING || halting) {
+		if(f->writing)
+			while(hostfile_drain(f));
+		close(f->fd);
+		__atomic_store_n(&f->state, HOSTFILE_FREE, __ATOMIC_RELEASE);
+		return 1;
+	}
+
+	int moved = f->writing ? hostfile_drain(f) : hostfile_fill(f);
+	if(moved && __atomic_exchange_n(&f->waiting, 0, __ATOMIC_SEQ_CST))
+		eventfd_post(hostfile_done_fd);
+	return moved;
+}
+
+
+static void* hostfile_daemon(void* arg)
+{
+	while(__atomic_load_n(&hostfile_active, __ATOMIC_ACQUIRE)) {
+
+		/* Kicks from now on are posted */
+		__atomic_exchange_n(&hostfile_kicked, 0, __ATOMIC_ACQ_REL);
+		eventfd_drain(hostfile_kick_fd);
+
+		int progress = 0;
+		for(uint i=0; i<MAX_HOSTFILES; i++)
+			progress |= hostfile_serve(& HOSTFILE[i], 0);
+
+		if(! progress) {
+			struct pollfd pfd = { .fd = hostfile_kick_fd, .events = POLLIN };
+			while(poll(&pfd, 1, -1)==-1 && errno==EINTR);
+		}
+	}
+
+	/* The VM has halted; write out and close the files left open */
+	for(uint i=0; i<MAX_HOSTFILES; i++)
+		hostfile_serve(& HOSTFILE[i], 1);
+
+	return NULL;
+}
+
+
+static void hostfile_start()
+{
+	CHECK(hostfile_kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	CHECK(hostfile_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+	hostfile_kicked = 0;
+	hostfile_active = 1;
+	hostfile_last_int = get_coarse_time();
+
+	/* The daemon is created with all signals blocked */
+	sigset_t all, saved_mask;
+	CHECK(sigfillset(&all));
+	CHECKRC(pthread_sigmask(SIG_BLOCK, &all, &saved_mask));
+	CHECKRC(pthread_create(&hostfile_thread, NULL, hostfile_daemon, NULL));
+	CHECKRC(pthread_sigmask(SIG_SETMASK, &saved_mask, NULL));
+	CHECKRC(pthread_setname_np(hostfile_thread, "tinyos_io"));
+}
+
+
+static void hostfile_stop()
+{
+	__atomic_store_n(&hostfile_active, 0, __ATOMIC_RELEASE);
+	eventfd_post(hostfile_kick_fd);
+	CHECKRC(pthread_join(hostfile_thread, NULL));
+
+	CHECK(close(hostfile_kick_fd));
+	CHECK(close(hostfile_done_fd));
+}
+
+
 /*
 	The PIC daemon dispatches interrupts to core threads,
 	by calling raise_interrupt().
@@ -559,6 +914,8 @@ static int terminal_destroy(terminal* this)
 	(a) ALARM, when the core timer expires
 	(b) SERIAL_RX_READY  &  SERIAL_TX_READY, when some 
 		io_device becomes ready.
+	(c) GATEWAY_READY, when some gateway or channel becomes ready.
+	(d) HOSTFILE_READY, when the host file daemon posts a completion.
 
 	Implementation:
 	- Use Linux signal file descriptors to receive signals. Currently,
@@ -712,6 +1069,85 @@ static void term_dev_raise_if_ready(io_device* dev, pic_selector* ps)
 
 
 
+/*
+	Mark a gateway device ready, if select() returned it or it timed out.
+	Return 1 if an interrupt is due.
+ */
+static int gateway_dev_mark_if_ready(io_device* dev, pic_selector* ps)
+{
+	if(    pic_is_ready(ps, dev->iodir, dev->fd) 
+		|| (ps->system_clock - dev->last_int) > SERIAL_TIMEOUT 
+		)
+	{
+		dev->ready = 1;
+		dev->last_int = ps->system_clock;
+		return 1;
+	}
+	return 0;
+}
+
+
+static inline void pic_add_gateways(pic_selector* ps)
+{
+	for(uint i=0; i<ngateway; i++)
+		pic_add_io_device(ps, & GATEWAY[i].conn);
+
+	for(uint i=0; i<MAX_GATEWAY_CHANNELS; i++) {
+		gateway_channel* ch = & CHANNEL[i];
+		if(__atomic_load_n(&ch->state, __ATOMIC_ACQUIRE) == CHANNEL_OPEN) {
+			pic_add_io_device(ps, & ch->rx);
+			pic_add_io_device(ps, & ch->tx);
+		}
+	}
+}
+
+
+/*
+	All gateways and channels share one interrupt, sent at most once
+	per PIC loop.
+ */
+static void gateway_raise_if_ready(pic_selector* ps)
+{
+	int raise = 0;
+
+	for(uint i=0; i<ngateway; i++)
+		raise |= gateway_dev_mark_if_ready(& GATEWAY[i].conn, ps);
+
+	for(uint i=0; i<MAX_GATEWAY_CHANNELS; i++) {
+		gateway_channel* ch = & CHANNEL[i];
+		if(__atomic_load_n(&ch->state, __ATOMIC_ACQUIRE) == CHANNEL_OPEN) {
+			raise |= gateway_dev_mark_if_ready(& ch->rx, ps);
+			raise |= gateway_dev_mark_if_ready(& ch->tx, ps);
+		}
+	}
+
+	if(raise)
+		raise_interrupt(& CORE[0], GATEWAY_READY);
+}
+
+
+/*
+	Raise HOSTFILE_READY on a completion of the host file daemon. While
+	some host file is open, it is also raised on timeout.
+ */
+static void hostfile_raise_if_ready(pic_selector* ps)
+{
+	int raise = pic_is_ready(ps, IODIR_RX, hostfile_done_fd);
+	if(raise)
+		eventfd_drain(hostfile_done_fd);
+	else if((ps->system_clock - hostfile_last_int) > SERIAL_TIMEOUT) {
+		for(uint i=0; i<MAX_HOSTFILES; i++)
+			if(__atomic_load_n(&HOSTFILE[i].state, __ATOMIC_ACQUIRE) == HOSTFILE_OPEN)
+				raise = 1;
+	}
+
+	if(raise) {
+		hostfile_last_int = ps->system_clock;
+		raise_interrupt(& CORE[0], HOSTFILE_READY);
+	}
+}
+
+
 static void PIC_daemon(void)
 {
 
@@ -738,9 +1174,16 @@ static void PIC_daemon(void)
 
 		pic_selector_reset(&ps);
 
+		gateway_reap_channels();
+
 		for(uint i=0; i<nterm; i++)
 			pic_add_terminal(&ps, & TERM[i]);
 
+		pic_add_gateways(&ps);
+
+		if(hostdir_fd != -1)
+			pic_add_fd(&ps, IODIR_RX, hostfile_done_fd);
+
 		pic_add_fd(&ps, IODIR_RX, sigalrmfd);
 		pic_add_fd(&ps, IODIR_RX, sigusr1fd);
 
@@ -771,6 +1214,12 @@ static void PIC_daemon(void)
 			term_dev_raise_if_ready(& term->kbd, &ps);
 		}
 
+		if(ngateway > 0)
+			gateway_raise_if_ready(&ps);
+
+		if(hostdir_fd != -1)
+			hostfile_raise_if_ready(&ps);
+
 
 	}
 
@@ -850,10 +1299,49 @@ int vm_config_terminals(vm_config* vmc, uint serialno, int nowait)
 }
 
 
+int vm_config_gateway(vm_config* vmc, const char* path, uint port)
+{
+	if(vmc->gatewayno >= MAX_GATEWAYS) { errno = ENOSPC; return -1; }
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if(strlen(path) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd==-1) return -1;
+
+	/* A stale socket file would make bind() fail */
+	unlink(path);
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr))==-1 || listen(fd, SOMAXCONN)==-1) {
+		close(fd);
+		return -1;
+	}
+
+	vmc->gateway_fd[vmc->gatewayno] = fd;
+	vmc->gateway_port[vmc->gatewayno] = port;
+	vmc->gatewayno++;
+	return 0;
+}
+
+
+int vm_config_hostdir(vm_config* vmc, const char* path)
+{
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(fd==-1) return -1;
+
+	if(vmc->hostdir_fd != -1)
+		close(vmc->hostdir_fd);
+	vmc->hostdir_fd = fd;
+	return 0;
+}
+
+
 void vm_configure(vm_config* vmc, interrupt_handler bootfunc, uint cores, uint serialno)
 {
 	vmc->bootfunc = bootfunc;
 	vmc->cores = cores;
+	vmc->gatewayno = 0;
+	vmc->hostdir_fd = -1;
 	CHECK(vm_config_terminals(vmc, serialno, 0));
 }
 
@@ -874,6 +1362,7 @@ void vm_run(vm_config* vmc)
 	CHECK_CONDITION(vmc->cores > 0 && vmc->cores <= MAX_CORES);
 	CHECK_CONDITION(ncores==0);
 	CHECK_CONDITION(vmc->serialno <= MAX_TERMINALS);
+	CHECK_CONDITION(vmc->gatewayno <= MAX_GATEWAYS);
 
 	/* This is called only once in the life of the process. */
 	CHECKRC(pthread_once(&init_control, initialize));
@@ -890,6 +1379,18 @@ void vm_run(vm_config* vmc)
 	for(uint i=0; i<nterm; i++)
 		terminal_init(& TERM[i], vmc->serial_in[i], vmc->serial_out[i]);
 
+	/* Initialize gateways */
+	ngateway = vmc->gatewayno;
+	for(uint i=0; i<ngateway; i++) {
+		io_device_init(& GATEWAY[i].conn, vmc->gateway_fd[i], IODIR_RX);
+		GATEWAY[i].port = vmc->gateway_port[i];
+	}
+
+	/* Start the host file daemon */
+	hostdir_fd = vmc->hostdir_fd;
+	if(hostdir_fd != -1)
+		hostfile_start();
+
 	/* Init the cores */
 	ncores = vmc->cores;
 
@@ -954,6 +1455,23 @@ void vm_run(vm_config* vmc)
 		CHECK(terminal_destroy(& TERM[i]));
 	nterm = 0;
 
+	/* Finalize gateways and their channels */
+	for(uint i=0; i<MAX_GATEWAY_CHANNELS; i++)
+		if(CHANNEL[i].state != CHANNEL_FREE) {
+			io_device_destroy(& CHANNEL[i].rx);
+			CHANNEL[i].state = CHANNEL_FREE;
+		}
+	for(uint i=0; i<ngateway; i++)
+		CHECK(gateway_destroy(& GATEWAY[i]));
+	ngateway = 0;
+
+	/* Stop the host file daemon, closing the files left open */
+	if(hostdir_fd != -1) {
+		hostfile_stop();
+		CHECK(close(hostdir_fd));
+		hostdir_fd = -1;
+	}
+
 	/* Restore signal mask before VM execution */
 	CHECK(sigaction(SIGUSR1, &USR1_saved_sigaction, NULL));
 
@@ -1221,3 +1739,297 @@ int bios_write_serial(uint serial, char value)
 }
 
 
+
+uint bios_gateways()
+{
+	return ngateway;
+}
+
+
+uint bios_gateway_port(uint gw)
+{
+	assert(gw < ngateway);
+	return GATEWAY[gw].port;
+}
+
+
+/*
+	Accept a pending connection of gateway 'gw' into a free channel.
+	Return the channel, or -1 on failure.
+ */
+int bios_gateway_accept(uint gw)
+{
+	assert(gw < ngateway);
+	gateway* g = & GATEWAY[gw];
+
+	/* Find a free channel */
+	uint c;
+	for(c=0; c<MAX_GATEWAY_CHANNELS; c++)
+		if(__atomic_load_n(&CHANNEL[c].state, __ATOMIC_ACQUIRE) == CHANNEL_FREE) break;
+	if(c == MAX_GATEWAY_CHANNELS) return -1;
+
+	int fd;
+	while((fd = accept(g->conn.fd, NULL, NULL))==-1 && errno==EINTR);
+	if(fd==-1) {
+		if(g->conn.ready) {
+			g->conn.ready = 0;
+			interrupt_pic_thread();
+		}
+		return -1;
+	}
+
+	gateway_channel* ch = & CHANNEL[c];
+	io_device_init(& ch->rx, fd, IODIR_RX);
+	io_device_init(& ch->tx, fd, IODIR_TX);
+	__atomic_store_n(&ch->state, CHANNEL_OPEN, __ATOMIC_RELEASE);
+	return c;
+}
+
+
+int bios_read_channel(uint channel, char* buf, uint size)
+{
+	assert(channel < MAX_GATEWAY_CHANNELS && CHANNEL[channel].state == CHANNEL_OPEN);
+	return io_device_recv(& CHANNEL[channel].rx, buf, size);
+}
+
+
+int bios_write_channel(uint channel, const char* buf, uint size)
+{
+	assert(channel < MAX_GATEWAY_CHANNELS && CHANNEL[channel].state == CHANNEL_OPEN);
+	return io_device_send(& CHANNEL[channel].tx, buf, size);
+}
+
+
+void bios_shutdown_channel(uint channel)
+{
+	assert(channel < MAX_GATEWAY_CHANNELS && CHANNEL[channel].state == CHANNEL_OPEN);
+	shutdown(CHANNEL[channel].tx.fd, SHUT_WR);
+}
+
+
+/*
+	The socket is closed by the PIC thread, which may be selecting on it.
+ */
+void bios_close_channel(uint channel)
+{
+	assert(channel < MAX_GATEWAY_CHANNELS && CHANNEL[channel].state == CHANNEL_OPEN);
+	__atomic_store_n(&CHANNEL[channel].state, CHANNEL_CLOSING, __ATOMIC_RELEASE);
+	interrupt_pic_thread();
+}
+
+
+
+/*
+	A path is under the host directory if it is relative and has no ".."
+	component, and it is opened by hostfile_openat().
+ */
+static int hostfile_path_ok(const char* path)
+{
+	if(path==NULL || path[0]=='\0' || path[0]=='/') return 0;
+
+	const char* p = path;
+	while(1) {
+		const char* end = strchrnul(p, '/');
+		if(end - p == 2 && p[0]=='.' && p[1]=='.') return 0;
+		if(*end == '\0') return 1;
+		p = end + 1;
+	}
+}
+
+
+/*
+	Open a path under the host directory one component at a time, so
+	that a symbolic link is refused wherever it is in the path, and the
+	path cannot leave the host directory.
+ */
+static int hostfile_openat(const char* path, int oflags)
+{
+	char name[PATH_MAX];
+	if(strlen(path) >= sizeof(name)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(name, path);
+
+	int dirfd = hostdir_fd;
+	char* p = name;
+	while(1) {
+		char* end = strchrnul(p, '/');
+		int last = (*end == '\0');
+		*end = '\0';
+
+		/* empty components, as in "a//b", are skipped */
+		int fd = dirfd;
+		if(last)
+			while((fd = openat(dirfd, p, oflags | O_NOFOLLOW, 0666))==-1 && errno==EINTR);
+		else if(end != p)
+			fd = openat(dirfd, p, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+		if(dirfd != hostdir_fd && fd != dirfd)
+			close(dirfd);
+		if(last || fd == -1)
+			return fd;
+		dirfd = fd;
+		p = end + 1;
+	}
+}
+
+
+int bios_open_hostfile(const char* path, int flags)
+{
+	if(hostdir_fd == -1 || ! hostfile_path_ok(path)) return -1;
+
+	int mode = flags & (HOSTFILE_READ | HOSTFILE_WRITE);
+	if(mode != HOSTFILE_READ && mode != HOSTFILE_WRITE) return -1;
+
+	/* Find a free host file */
+	uint h;
+	for(h=0; h<MAX_HOSTFILES; h++)
+		if(__atomic_load_n(&HOSTFILE[h].state, __ATOMIC_ACQUIRE) == HOSTFILE_FREE) break;
+	if(h == MAX_HOSTFILES) return -1;
+
+	/* O_NONBLOCK keeps open() from blocking on a FIFO, which is then refused */
+	int oflags = O_NONBLOCK | O_CLOEXEC;
+	oflags |= (mode == HOSTFILE_READ) ? O_RDONLY : O_WRONLY;
+	if(flags & HOSTFILE_CREATE) oflags |= O_CREAT;
+	if(flags & HOSTFILE_EXCL) oflags |= O_EXCL;
+	if(flags & HOSTFILE_TRUNCATE) oflags |= O_TRUNC;
+	if(flags & HOSTFILE_APPEND) oflags |= O_APPEND;
+
+	int fd = hostfile_openat(path, oflags);
+	if(fd==-1) return -1;
+
+	struct stat st;
+	if(fstat(fd, &st)==-1 || ! S_ISREG(st.st_mode)) {
+		close(fd);
+		return -1;
+	}
+	CHECK(fcntl(fd, F_SETFL, oflags & O_APPEND));
+
+	hostfile* f = & HOSTFILE[h];
+	f->fd = fd;
+	f->writing = (mode == HOSTFILE_WRITE);
+	f->head = f->tail = 0;
+	f->done = 0;
+	f->error = 0;
+	f->waiting = 0;
+	__atomic_store_n(&f->state, HOSTFILE_OPEN, __ATOMIC_RELEASE);
+
+	/* Start reading ahead */
+	if(! f->writing)
+		hostfile_kick();
+	return h;
+}
+
+
+/*
+	Return 1 if data can be moved, or no more data will be moved.
+ */
+static inline int hostfile_can_move(hostfile* f)
+{
+	if(__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) return 1;
+	uint used = hostfile_used(f);
+	return f->writing ? (used < HOSTFILE_BUFFER) : (used > 0);
+}
+
+
+/*
+	Return 1 if the file is ready. Else, make it not-ready, so that the
+	daemon will post a completion when it next moves data of the file.
+ */
+static int hostfile_check_ready(hostfile* f)
+{
+	if(hostfile_can_move(f)) return 1;
+
+	__atomic_store_n(&f->waiting, 1, __ATOMIC_SEQ_CST);
+	hostfile_kick();
+	return hostfile_can_move(f);
+}
+
+
+int bios_read_hostfile(uint h, char* buf, uint size)
+{
+	assert(h < MAX_HOSTFILES && HOSTFILE[h].state == HOSTFILE_OPEN && ! HOSTFILE[h].writing);
+	hostfile* f = & HOSTFILE[h];
+
+	if(! hostfile_check_ready(f)) return 0;
+
+	/* Once 'done' is set, the tail does not move */
+	uint head = f->head;
+	uint used = hostfile_used(f);
+	if(used == 0)
+		return __atomic_load_n(&f->error, __ATOMIC_SEQ_CST) ? -1 : HOSTFILE_EOF;
+
+	uint count = (used < size) ? used : size;
+	uint off = head % HOSTFILE_BUFFER;
+	uint first = (count < HOSTFILE_BUFFER - off) ? count : HOSTFILE_BUFFER - off;
+	memcpy(buf, f->buffer + off, first);
+	memcpy(buf + first, f->buffer, count - first);
+	__atomic_store_n(&f->head, head + count, __ATOMIC_SEQ_CST);
+
+	/* The daemon waits for a quarter of the ring to become free */
+	uint space = HOSTFILE_BUFFER - used;
+	if(space < HOSTFILE_BUFFER/4 && space + count >= HOSTFILE_BUFFER/4)
+		hostfile_kick();
+
+	return count;
+}
+
+
+int bios_write_hostfile(uint h, const char* buf, uint size)
+{
+	assert(h < MAX_HOSTFILES && HOSTFILE[h].state == HOSTFILE_OPEN && HOSTFILE[h].writing);
+	hostfile* f = & HOSTFILE[h];
+
+	if(! hostfile_check_ready(f)) return 0;
+	if(__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) return -1;
+
+	uint tail = f->tail;
+	uint space = HOSTFILE_BUFFER - hostfile_used(f);
+	uint count = (space < size) ? space : size;
+	uint off = tail % HOSTFILE_BUFFER;
+	uint first = (count < HOSTFILE_BUFFER - off) ? count : HOSTFILE_BUFFER - off;
+	memcpy(f->buffer + off, buf, first);
+	memcpy(f->buffer, buf + first, count - first);
+	__atomic_store_n(&f->tail, tail + count, __ATOMIC_SEQ_CST);
+
+	hostfile_kick();
+	return count;
+}
+
+
+int bios_flush_hostfile(uint h)
+{
+	assert(h < MAX_HOSTFILES && HOSTFILE[h].state == HOSTFILE_OPEN && HOSTFILE[h].writing);
+	hostfile* f = & HOSTFILE[h];
+
+	for(int check=0; check<2; check++) {
+		if(__atomic_load_n(&f->done, __ATOMIC_SEQ_CST)) return -1;
+		if(hostfile_used(f) == 0) return 1;
+
+		/* Make the file not-ready and check again */
+		if(check == 0) {
+			__atomic_store_n(&f->waiting, 1, __ATOMIC_SEQ_CST);
+			hostfile_kick();
+		}
+	}
+	return 0;
+}
+
+
+int bios_hostfile_ready(uint h)
+{
+	assert(h < MAX_HOSTFILES && HOSTFILE[h].state == HOSTFILE_OPEN);
+	return hostfile_check_ready(& HOSTFILE[h]);
+}
+
+
+/*
+	The file is closed by the daemon, which may be writing it.
+ */
+void bios_close_hostfile(uint h)
+{
+	assert(h < MAX_HOSTFILES && HOSTFILE[h].state == HOSTFILE_OPEN);
+	__atomic_store_n(&HOSTFILE[h].state, HOSTFILE_CLOSING, __ATOMIC_RELEASE);
+	hostfile_kick();
+}
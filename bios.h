@@ -98,6 +98,34 @@
 	Also, each interrupt is sent if the serial device timeouts (is inactive for
 	about 300 msec).
 
+	Gateways
+	--------
+
+	A gateway connects a port number to a Unix-domain (@c AF_UNIX) listening
+	socket of the host, so that programs outside the VM can open connections
+	to it (e.g., load generators). Gateways are numbered from 0, up to 
+	@c MAX_GATEWAYS-1. The port number is not interpreted by the VM.
+
+	Each host connection accepted by a gateway becomes a _channel_, numbered
+	from 0 up to @c MAX_GATEWAY_CHANNELS-1. Channels transfer data in both
+	directions, many bytes at a time. As with serial ports, reads, writes
+	and accepts fail when the device is not ready, and a @c GATEWAY_READY
+	interrupt is raised when some gateway or channel becomes ready, or times out.
+
+	Host files
+	----------
+
+	A VM may be given a _host directory_, whose regular files can be opened
+	as host files, numbered from 0 up to @c MAX_HOSTFILES-1. A host file is
+	opened either for reading or for writing, and is transferred sequentially.
+
+	The cores never wait for the host file system: the data of a host file
+	passes through a buffer of @c HOSTFILE_BUFFER bytes, which a bios I/O
+	thread fills ahead of the reads (read-ahead), or empties into the file
+	behind the writes (write-behind). Reads and writes fail when the buffer
+	is empty, or full, and a @c HOSTFILE_READY interrupt is raised when the
+	I/O thread has moved data of such a host file, or times out.
+
  */
 
 
@@ -123,6 +151,10 @@ typedef enum Interrupt
 						   from a serial port */
 	SERIAL_TX_READY,	/**< Raised when a serial port is ready to accept 
 						   data */
+	GATEWAY_READY,		/**< Raised when a gateway has pending connections,
+						   or a gateway channel is ready */
+	HOSTFILE_READY,		/**< Raised when the I/O thread has moved data
+						   of a host file */
 
 	maximum_interrupt_no 
 } Interrupt;
@@ -134,6 +166,31 @@ typedef enum Interrupt
 /** @brief Maximum number of terminals for a virtual machine. */
 #define MAX_TERMINALS 4
 
+/** @brief Maximum number of gateways for a virtual machine. */
+#define MAX_GATEWAYS 4
+
+/** @brief Maximum number of open gateway channels for a virtual machine. */
+#define MAX_GATEWAY_CHANNELS 64
+
+/** @brief Maximum number of open host files for a virtual machine. */
+#define MAX_HOSTFILES 16
+
+/** @brief The size of the buffer of a host file. */
+#define HOSTFILE_BUFFER (1<<16)
+
+/** @brief Returned by @ref bios_read_hostfile at the end of the file. */
+#define HOSTFILE_EOF (-2)
+
+/** @brief Flags of @ref bios_open_hostfile. */
+enum hostfile_flags {
+	HOSTFILE_READ = 1,		/**< Open for reading */
+	HOSTFILE_WRITE = 2,		/**< Open for writing */
+	HOSTFILE_CREATE = 4,	/**< Create the file if it does not exist */
+	HOSTFILE_EXCL = 8,		/**< With @c HOSTFILE_CREATE, fail if the file exists */
+	HOSTFILE_TRUNCATE = 16,	/**< Empty the file */
+	HOSTFILE_APPEND = 32	/**< Write at the end of the file */
+};
+
 
 
 /**
@@ -154,6 +211,12 @@ typedef enum Interrupt
 	  (@c serial_out) file descriptor will be written to. These file descriptors
 	  should correspond to some pipe-like Linux stream (e.g., pipe, FIFO or socket).
 
+	- The number of gateways of this VM, stored in @c gatewayno, and for each
+	  gateway a listening socket (@c gateway_fd) and a port (@c gateway_port).
+
+	- The host directory of this VM, stored in @c hostdir_fd, or -1 if
+	  the VM has none.
+
  */
 typedef struct vm_config {
 
@@ -198,6 +261,21 @@ typedef struct vm_config {
 		must be valid in this structure.
 	*/
 	int serial_out[MAX_TERMINALS];
+
+	/** @brief The number of gateways of the computer.
+
+		The number of gateways should be between 0 and @c MAX_GATEWAYS.
+	 */
+	uint gatewayno;
+
+	/** @brief The listening sockets of the gateways. */
+	int gateway_fd[MAX_GATEWAYS];
+
+	/** @brief The ports of the gateways. */
+	uint gateway_port[MAX_GATEWAYS];
+
+	/** @brief A directory file descriptor for the host directory, or -1. */
+	int hostdir_fd;
 } vm_config;
 
 
@@ -222,6 +300,34 @@ typedef struct vm_config {
 int vm_config_terminals(vm_config* vmc, uint serialno, int nowait);
 
 
+/**
+	@brief Add a gateway to a VM configuration.
+
+	Create a Unix-domain stream socket listening at @c path, replacing
+	any file at @c path, and add it to the gateways of the configuration.
+	The socket file is removed when the VM shuts down.
+
+	@param vmc the configuration to add the gateway to
+	@param path the file name of the host socket
+	@param port the port served by the gateway
+	@return 0 on success, -1 on failure
+*/
+int vm_config_gateway(vm_config* vmc, const char* path, uint port);
+
+
+/**
+	@brief Set the host directory of a VM configuration.
+
+	Open the directory at @c path, replacing any host directory of the 
+	configuration. The directory is closed when the VM shuts down.
+
+	@param vmc the configuration
+	@param path the host directory
+	@return 0 on success, -1 on failure
+*/
+int vm_config_hostdir(vm_config* vmc, const char* path);
+
+
 /**
 	@brief Initialize a VM configuration with passed parameters.
 
@@ -546,4 +652,168 @@ int bios_read_serial(uint serial, char* ptr);
 int bios_write_serial(uint serial, char value);
 
 
+
+/**
+	@brief Return the number of gateways.
+
+	This is the number specified at the initialization of the
+	VM.
+ */
+uint bios_gateways();
+
+
+/**
+	@brief Return the port of a gateway.
+
+	@param gateway the gateway, less than @c bios_gateways()
+	@return the port given in the VM configuration
+ */
+uint bios_gateway_port(uint gateway);
+
+
+/**
+	@brief Accept a host connection of a gateway.
+
+	Try to accept a pending connection of the gateway, as a new channel.
+	This fails if there are no pending connections, in which case
+	the gateway becomes not-ready, or if all channels are in use.
+
+	@param gateway the gateway, less than @c bios_gateways()
+	@return the number of the new channel on success, or -1 on failure
+ */
+int bios_gateway_accept(uint gateway);
+
+
+/**
+	@brief Read data from a gateway channel.
+
+	Try to read up to @c size bytes. If no data is available,
+	the channel becomes not-ready.
+
+	@param channel an open channel
+	@param buf the buffer to store the data
+	@param size the size of @c buf, greater than 0
+	@return the number of bytes read, 0 if no data is available, or -1 if the 
+		host has closed the connection
+ */
+int bios_read_channel(uint channel, char* buf, uint size);
+
+
+/**
+	@brief Write data to a gateway channel.
+
+	Try to write up to @c size bytes. If no data can be written,
+	the channel becomes not-ready.
+
+	@param channel an open channel
+	@param buf the data to write
+	@param size the size of @c buf, greater than 0
+	@return the number of bytes written, 0 if no data can be written, or -1 if
+		the host has closed the connection
+ */
+int bios_write_channel(uint channel, const char* buf, uint size);
+
+
+/**
+	@brief Signal the end of data to the host side of a gateway channel.
+
+	@param channel an open channel
+ */
+void bios_shutdown_channel(uint channel);
+
+
+/**
+	@brief Close a gateway channel.
+
+	The host connection is closed and the channel number may be returned 
+	by a later @ref bios_gateway_accept.
+
+	@param channel an open channel
+ */
+void bios_close_channel(uint channel);
+
+
+/**
+	@brief Open a host file.
+
+	The file at @c path, relative to the host directory, is opened
+	for reading or writing, as given by @c flags. The path must not
+	be absolute, and must not contain a @c ".." component or a symbolic
+	link, so that it cannot leave the host directory.
+
+	@param path the path of a regular file in the host directory
+	@param flags a combination of @c hostfile_flags, with exactly one
+		of @c HOSTFILE_READ and @c HOSTFILE_WRITE
+	@return the number of the host file on success, or -1 on failure
+ */
+int bios_open_hostfile(const char* path, int flags);
+
+
+/**
+	@brief Read data from a host file.
+
+	Take up to @c size bytes from the read-ahead buffer. If it is
+	empty, the host file becomes not-ready.
+
+	@param hostfile a host file open for reading
+	@param buf the buffer to store the data
+	@param size the size of @c buf, greater than 0
+	@return the number of bytes read, 0 if no data is available,
+		@c HOSTFILE_EOF at the end of the file, or -1 after an I/O error
+ */
+int bios_read_hostfile(uint hostfile, char* buf, uint size);
+
+
+/**
+	@brief Write data to a host file.
+
+	Add up to @c size bytes to the write-behind buffer. If it is full, the
+	host file becomes not-ready.
+
+	@param hostfile a host file open for writing
+	@param buf the data to write
+	@param size the size of @c buf, greater than 0
+	@return the number of bytes written, 0 if the buffer is full, or -1
+		if writing to the file has failed
+ */
+int bios_write_hostfile(uint hostfile, const char* buf, uint size);
+
+
+/**
+	@brief Check that the data written to a host file has reached the file.
+
+	If there is buffered data, the host file becomes not-ready.
+
+	@param hostfile a host file open for writing
+	@return 1 if all the data has been written, 0 if not yet, or -1 if
+		writing to the file has failed
+ */
+int bios_flush_hostfile(uint hostfile);
+
+
+/**
+	@brief Check if a host file is ready.
+
+	A host file is ready if @ref bios_read_hostfile, or 
+	@ref bios_write_hostfile, would not return 0. If it is not ready,
+	it becomes not-ready.
+
+	@param hostfile an open host file
+	@return 1 if the host file is ready, else 0
+ */
+int bios_hostfile_ready(uint hostfile);
+
+
+/**
+	@brief Close a host file.
+
+	The data in the write-behind buffer is written before the file is
+	closed. The host file number may be returned by a later
+	@ref bios_open_hostfile.
+
+	@param hostfile an open host file
+ */
+void bios_close_hostfile(uint hostfile);
+
+
 #endif
@@ -5,6 +5,8 @@
 #include "kernel_sched.h"
 #include "kernel_streams.h"
 #include "kernel_proc.h"
+#include "kernel_ramfs.h"
+#include "kernel_hostfile.h"
 
 /*************************************
 
@@ -70,6 +72,9 @@ typedef struct serial_device_control_block {
   uint devno;
   Mutex spinlock;
   CondVar rx_ready;
+  int has_peek;       /* set if 'peek' holds a byte read by serial_poll */
+  char peek;
+  rlnode watchers;    /* the watch list, protected by spinlock */
 } serial_dcb_t;
 
 serial_dcb_t serial_dcb[MAX_TERMINALS];
@@ -91,6 +96,10 @@ void serial_rx_handler()
   for(int i=0;i<bios_serial_ports();i++) {
     serial_dcb_t* dcb = &serial_dcb[i];
     Cond_Broadcast(&dcb->rx_ready);
+
+    Mutex_Lock(&dcb->spinlock);
+    stream_notify(&dcb->watchers);
+    Mutex_Unlock(&dcb->spinlock);
   }
   if(pre) preempt_on;
 }
@@ -106,6 +115,12 @@ int serial_read(void* dev, char *buf, unsigned int size)
 
   uint count =  0;
 
+  /* First, return the byte kept by serial_poll */
+  if(dcb->has_peek && count<size) {
+    buf[count++] = dcb->peek;
+    dcb->has_peek = 0;
+  }
+
   while(count<size) {
     int valid = bios_read_serial(dcb->devno, &buf[count]);
     
@@ -168,6 +183,31 @@ int serial_close(void* dev)
 }
 
 
+/*
+  Check for input without consuming it. Since the bios cannot
+  peek, a byte that is read here is kept for the next serial_read.
+  Writes are polled by serial_write, so they are always ready.
+ */
+int serial_poll(void* dev, int events, stream_watch* watch)
+{
+  serial_dcb_t* dcb = (serial_dcb_t*)dev;
+
+  if(watch != NULL)
+    stream_watch_add(&dcb->watchers, watch, &dcb->spinlock);
+
+  int revents = POLL_WRITE;
+
+  int pre = preempt_off;
+  if(! dcb->has_peek)
+    dcb->has_peek = bios_read_serial(dcb->devno, &dcb->peek);
+  if(dcb->has_peek)
+    revents |= POLL_READ;
+  if(pre) preempt_on;
+
+  return revents & events;
+}
+
+
 void* serial_open(uint term)
 {
   assert(term<bios_serial_ports());
@@ -180,7 +220,8 @@ file_ops serial_fops = {
   .Open = serial_open,
   .Read = serial_read,
   .Write = serial_write,
-  .Close = serial_close
+  .Close = serial_close,
+  .Poll = serial_poll
 };
 
 
@@ -206,11 +247,22 @@ void initialize_devices()
   devtable[DEV_SERIAL].devnum = bios_serial_ports();
   devtable[DEV_SERIAL].dev_fops = serial_fops;
 
+  devtable[DEV_RAMFS].type = DEV_RAMFS;
+  devtable[DEV_RAMFS].devnum = 1;
+  devtable[DEV_RAMFS].dev_fops = ramfs_fops;
+
+  /* Host files are opened by path, see sys_OpenHostFile */
+  devtable[DEV_HOSTFILE].type = DEV_HOSTFILE;
+  devtable[DEV_HOSTFILE].devnum = 0;
+  devtable[DEV_HOSTFILE].dev_fops = hostfile_fops;
+
   /* Initialize the serial devices */
   for(int i=0; i<bios_serial_ports(); i++) {
     serial_dcb[i].devno = i;
     serial_dcb[i].rx_ready = COND_INIT;
     serial_dcb[i].spinlock = MUTEX_INIT;
+    serial_dcb[i].has_peek = 0;
+    rlnode_init(&serial_dcb[i].watchers, NULL);
   }
 
   cpu_interrupt_handler(SERIAL_RX_READY, serial_rx_handler);
@@ -233,4 +285,9 @@ uint device_no(Device_type major)
   return devtable[major].devnum;
 }
 
+int device_is(Device_type major, file_ops* ops)
+{
+  return ops == &devtable[major].dev_fops;
+}
+
 
@@ -9,6 +9,7 @@
 
 #include "util.h"
 #include "bios.h"
+#include "tinyos.h"
 
 /**
   @file kernel_dev.h
@@ -34,6 +35,26 @@
 */
 
 
+/**
+  @brief A registration for readiness notifications from a stream.
+
+  Objects of this type are registered with a stream by its @c Poll
+  method and are linked into a watch list kept by the stream. Whenever
+  the readiness of the stream may have changed, the stream calls
+  @c notify for each watch in its list.
+
+  @see stream_notify
+  @see stream_unwatch
+ */
+typedef struct stream_watch {
+  rlnode node;      /**< @brief Intrusive node in the watch list of the stream */
+  Mutex* lock;      /**< @brief The lock protecting the watch list, 
+                         or NULL if it is protected by the kernel lock */
+  void (*notify)(struct stream_watch* watch); /**< @brief The notification method */
+  void* owner;      /**< @brief The object that owns this watch */
+} stream_watch;
+
+
 /**
   @brief The device-specific file operations table.
 
@@ -92,6 +113,70 @@ typedef struct file_operations {
     - There was a I/O runtime problem.
      */
     int (*Close)(void* this);
+
+  /** @brief Vectored read operation (optional).
+
+    Read up to the total size of the @c iovcnt segments of @c iov from
+    stream 'this', filling the segments in order. The semantics are those
+    of @c Read applied to the concatenation of the segments; in particular,
+    the thread blocks only if no data at all is available.
+
+    This method may be NULL, in which case the kernel falls back to a
+    single call to @c Read through a bounce buffer.
+  */
+    int (*ReadV)(void* this, const iovec_t* iov, unsigned int iovcnt);
+
+  /** @brief Vectored write operation (optional).
+
+    Write the @c iovcnt segments of @c iov to stream 'this', in order.
+    The semantics are those of @c Write applied to the concatenation
+    of the segments.
+
+    This method may be NULL, in which case the kernel falls back to a
+    single call to @c Write through a bounce buffer.
+  */
+    int (*WriteV)(void* this, const iovec_t* iov, unsigned int iovcnt);
+
+  /** @brief Readiness check (optional).
+
+    Return the subset of @c events (a combination of @c poll_event bits)
+    that are ready on stream 'this', i.e., operations that would not block,
+    plus @c POLL_ERROR and @c POLL_HANGUP when they apply. This call never
+    blocks.
+
+    If @c watch is not NULL, it is also registered with the stream, so that
+    its @c notify method is called whenever the readiness of the stream
+    may have changed. The caller must remove it by @c stream_unwatch,
+    before the stream is closed.
+
+    This method may be NULL, in which case the stream is always considered
+    ready.
+  */
+    int (*Poll)(void* this, int events, struct stream_watch* watch);
+
+  /** @brief Lock-free read operation (optional).
+
+    Like @c Read, but called @e without the kernel lock. The method
+    must not block and must not take the kernel lock while it touches
+    shared state. It returns the number of bytes copied (at least 1), or
+    -1 if it cannot complete the call immediately, in which case the
+    kernel retries the call through @c Read under the kernel lock.
+  */
+    int (*FastRead)(void* this, char *buf, unsigned int size);
+
+  /** @brief Lock-free write operation (optional).
+
+    The counterpart of @c FastRead for @c Write.
+  */
+    int (*FastWrite)(void* this, const char* buf, unsigned int size);
+
+  /** @brief Return the pipe of the stream (optional).
+
+    Return the pipe that @c Read (if @c reading is set) or @c Write
+    moves data through, or NULL if there is none. @c CopyStream uses
+    it to move data from pipe to pipe, without a kernel buffer.
+  */
+    struct pipe_control_block* (*GetPipe)(void* this, int reading);
 } file_ops;
 
 
@@ -104,6 +189,8 @@ typedef struct file_operations {
 typedef enum { 
 	DEV_NULL,    /**< @brief Null device */
 	DEV_SERIAL,  /**< @brief Serial device */
+	DEV_RAMFS,   /**< @brief The file system, see @ref ramfs */
+	DEV_HOSTFILE, /**< @brief Host files, see @ref hostfile */
 	DEV_MAX      /**< @brief placeholder for maximum device number */
 }  Device_type;
 
@@ -156,6 +243,14 @@ int device_open(Device_type major, uint minor, void** obj, file_ops** ops);
   */
 uint device_no(Device_type major);
 
+/**
+  @brief Check whether a stream is a device of a particular major number.
+
+  This is true if @c ops is the @c file_ops record returned by
+  @c device_open for this major number.
+  */
+int device_is(Device_type major, file_ops* ops);
+
 /** @} */
 
 #endif
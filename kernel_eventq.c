@@ -0,0 +1,314 @@
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+#include "kernel_dev.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+
+/*
+	Event queues.
+
+	Each registered stream is represented by an evq_item, whose
+	stream_watch is linked into the watch list of the stream. When the
+	stream notifies its watches, the item is pushed to the ready list
+	of the queue. EventQueue_Wait only examines the ready list.
+
+	As with epoll, an item does not keep its stream open. The items of
+	a stream are also linked to its FCB, and are destroyed when the
+	last reference to the FCB is dropped, before the stream is closed.
+
+	Terminals notify from their interrupt handler, therefore the ready
+	list is protected by a spinlock, taken with preemption off.
+ */
+
+typedef struct event_queue_control_block evq_cb;
+
+typedef struct evq_item {
+	stream_watch watch;		/* registered with the stream; watch.owner is the item */
+	evq_cb *evq;			/* the queue this item belongs to */
+	FCB *fcb;				/* the registered stream */
+	Fid_t fd;				/* the fid given at registration */
+	int events;				/* the events of interest, including POLL_EDGE */
+	uintptr_t data;			/* the user data */
+
+	rlnode interest_node;	/* node in the interest list */
+	rlnode stream_node;		/* node in the evq_items list of the FCB */
+	rlnode ready_node;		/* node in the ready list */
+	int on_ready;			/* set if ready_node is in the ready list */
+} evq_item;
+
+typedef struct event_queue_control_block {
+	rlnode interest;		/* all items */
+	rlnode ready;			/* items that may be ready */
+	Mutex lock;				/* protects the ready list and on_ready */
+	CondVar has_events;		/* Wait sleeps here */
+} evq_cb;
+
+
+/* Push an item to the ready list, if it is not already there */
+static void evq_make_ready(evq_item* item)
+{
+	evq_cb* evq = item->evq;
+
+	int pre = preempt_off;
+	Mutex_Lock(&evq->lock);
+	int wake = ! item->on_ready;
+	if(wake){
+		item->on_ready = 1;
+		rlist_push_back(&evq->ready, &item->ready_node);
+	}
+	Mutex_Unlock(&evq->lock);
+	if(pre) preempt_on;
+
+	if(wake)
+		kernel_broadcast(&evq->has_events);
+}
+
+/* Take an item out of the ready list, if it is there */
+static void evq_make_unready(evq_item* item)
+{
+	evq_cb* evq = item->evq;
+
+	int pre = preempt_off;
+	Mutex_Lock(&evq->lock);
+	if(item->on_ready){
+		item->on_ready = 0;
+		rlist_remove(&item->ready_node);
+	}
+	Mutex_Unlock(&evq->lock);
+	if(pre) preempt_on;
+}
+
+/* The stream_watch notification method */
+static void evq_notify(stream_watch* watch)
+{
+	evq_make_ready(watch->owner);
+}
+
+
+/* Return the ready events of an item */
+static inline int evq_item_poll(evq_item* item, stream_watch* watch)
+{
+	return item->fcb->streamfunc->Poll(item->fcb->streamobj,
+		item->events & (POLL_READ|POLL_WRITE), watch);
+}
+
+
+/* Unregister and release an item */
+static void evq_item_destroy(evq_item* item)
+{
+	stream_unwatch(&item->watch);
+	evq_make_unready(item);
+	rlist_remove(&item->interest_node);
+	rlist_remove(&item->stream_node);
+	free(item);
+}
+
+
+void evq_release_stream(FCB* fcb)
+{
+	while(! is_rlist_empty(&fcb->evq_items))
+		evq_item_destroy(fcb->evq_items.next->obj);
+}
+
+
+int evq_close(void* this)
+{
+	evq_cb* evq = (evq_cb*) this;
+	if(evq == NULL) return -1;
+
+	while(! is_rlist_empty(&evq->interest))
+		evq_item_destroy(evq->interest.next->obj);
+
+	free(evq);
+	return 0;
+}
+
+
+file_ops evq_file_ops = {
+	.Open = null_open,
+	.Read = null_read,
+	.Write = null_write,
+	.Close = evq_close
+};
+
+
+/* Translate an fid to an event queue, or NULL */
+static evq_cb* get_evq(Fid_t fid)
+{
+	FCB* fcb = get_fcb(fid);
+	if(fcb == NULL || fcb->streamfunc != &evq_file_ops)
+		return NULL;
+	return fcb->streamobj;
+}
+
+/* Find the item of a stream, or NULL */
+static evq_item* evq_find(evq_cb* evq, FCB* fcb)
+{
+	for(rlnode* p = evq->interest.next; p != &evq->interest; p = p->next){
+		evq_item* item = p->obj;
+		if(item->fcb == fcb) return item;
+	}
+	return NULL;
+}
+
+
+Fid_t sys_EventQueue_Create()
+{
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) == 0)
+		return NOFILE;
+
+	evq_cb* evq = xmalloc(sizeof(evq_cb));
+	rlnode_init(&evq->interest, NULL);
+	rlnode_init(&evq->ready, NULL);
+	evq->lock = MUTEX_INIT;
+	evq->has_events = COND_INIT;
+
+	fcb->streamobj = evq;
+	fcb->streamfunc = &evq_file_ops;
+
+	return fid;
+}
+
+
+int sys_EventQueue_Ctl(Fid_t evqfd, evq_op op, Fid_t fd, int events, uintptr_t data)
+{
+	evq_cb* evq = get_evq(evqfd);
+	FCB* fcb = get_fcb(fd);
+
+	if(evq == NULL || fcb == NULL || fcb->streamfunc->Poll == NULL)
+		return -1;
+
+	evq_item* item = evq_find(evq, fcb);
+
+	switch(op){
+		case EVQ_ADD:
+			if(item != NULL) return -1;
+
+			item = xmalloc(sizeof(evq_item));
+			item->evq = evq;
+			item->fcb = fcb;
+			item->fd = fd;
+			item->events = events;
+			item->data = data;
+			item->on_ready = 0;
+			rlnode_init(&item->interest_node, item);
+			rlnode_init(&item->ready_node, item);
+			rlnode_init(&item->stream_node, item);
+			rlist_push_back(&evq->interest, &item->interest_node);
+			rlist_push_back(&fcb->evq_items, &item->stream_node);
+
+			item->watch.notify = evq_notify;
+			item->watch.owner = item;
+
+			if(evq_item_poll(item, &item->watch))
+				evq_make_ready(item);
+			return 0;
+
+		case EVQ_MOD:
+			if(item == NULL) return -1;
+
+			item->fd = fd;
+			item->events = events;
+			item->data = data;
+			if(evq_item_poll(item, NULL))
+				evq_make_ready(item);
+			return 0;
+
+		case EVQ_DEL:
+			if(item == NULL) return -1;
+
+			evq_item_destroy(item);
+			return 0;
+	}
+
+	return -1;
+}
+
+
+int sys_EventQueue_Wait(Fid_t evqfd, evq_event_t* events, unsigned int maxevents, timeout_t timeout)
+{
+	FCB* fcb = get_fcb(evqfd);
+	evq_cb* evq = get_evq(evqfd);
+
+	if(evq == NULL || events == NULL || maxevents == 0)
+		return -1;
+
+	/* The queue must not be closed while we wait */
+	FCB_incref(fcb);
+
+	TimerDuration deadline = bios_clock() + 1000ul*timeout;
+	unsigned int count = 0;
+
+	while(1){
+		/* Take the current ready list */
+		rlnode pending, rearm;
+		rlnode_init(&pending, NULL);
+		rlnode_init(&rearm, NULL);
+
+		int pre = preempt_off;
+		Mutex_Lock(&evq->lock);
+		rlist_append(&pending, &evq->ready);
+		Mutex_Unlock(&evq->lock);
+		if(pre) preempt_on;
+
+		while(count < maxevents && ! is_rlist_empty(&pending)){
+			evq_item* item = rlist_pop_front(&pending)->obj;
+
+			/* A notification only says that the state may have changed */
+			int revents = evq_item_poll(item, NULL);
+
+			pre = preempt_off;
+			Mutex_Lock(&evq->lock);
+			item->on_ready = 0;
+			if(revents && !(item->events & POLL_EDGE)){
+				/* Level-triggered items stay ready until polled not ready */
+				item->on_ready = 1;
+				rlist_push_back(&rearm, &item->ready_node);
+			}
+			Mutex_Unlock(&evq->lock);
+			if(pre) preempt_on;
+
+			if(revents){
+				events[count].fd = item->fd;
+				events[count].events = revents;
+				events[count].data = item->data;
+				count++;
+			}
+		}
+
+		/* Put back what we did not examine, and then the re-armed items */
+		pre = preempt_off;
+		Mutex_Lock(&evq->lock);
+		rlist_prepend(&evq->ready, &pending);
+		rlist_append(&evq->ready, &rearm);
+		Mutex_Unlock(&evq->lock);
+		if(pre) preempt_on;
+
+		if(count > 0 || timeout == 0) break;
+
+		/* Sleep until some item becomes ready */
+		TimerDuration t = NO_TIMEOUT;
+		if(timeout != (timeout_t)-1){
+			TimerDuration now = bios_clock();
+			if(now >= deadline) break;
+			t = deadline - now;
+		}
+
+		pre = preempt_off;
+		Mutex_Lock(&evq->lock);
+		int empty = is_rlist_empty(&evq->ready);
+		Mutex_Unlock(&evq->lock);
+		if(pre) preempt_on;
+
+		if(empty)
+			kernel_timedwait(&evq->has_events, SCHED_IO, t);
+	}
+
+	FCB_decref(fcb);
+	return count;
+}
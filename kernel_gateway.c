@@ -0,0 +1,235 @@
+
+#include "bios.h"
+#include "tinyos.h"
+#include "kernel_gateway.h"
+#include "kernel_sched.h"
+#include "kernel_cc.h"
+
+/*
+	Gateway channels.
+
+	The driver follows the serial driver: a channel is read and written
+	through the bios, a thread that finds it not ready sleeps on the
+	channel's condition variable, and the GATEWAY_READY interrupt
+	wakes up the threads of all the channels, since it does not tell
+	which one is ready. Poll reads one byte ahead, which is kept for
+	the next read.
+
+	The fields of a channel are protected by the kernel lock, except
+	for the watch list, which is also walked by the interrupt handler
+	and is protected by the spinlock of the channel.
+ */
+
+typedef struct gateway_channel_block {
+	int open;				/* set while a socket uses the channel */
+	CondVar ready;			/* readers and writers sleep here */
+	Mutex spinlock;			/* protects watchers */
+	rlnode watchers;		/* the watch list */
+	int has_peek;			/* set if peek holds a byte read by gateway_poll */
+	char peek;
+	int eof;				/* set when the host has closed */
+} gateway_dcb;
+
+static gateway_dcb channel_dcb[MAX_GATEWAY_CHANNELS];
+
+/* the watches notified by every gateway interrupt, e.g. listeners */
+static rlnode gateway_watchers;
+static Mutex gateway_spinlock = MUTEX_INIT;
+
+
+static void gateway_interrupt_handler()
+{
+	int pre = preempt_off;
+
+	Mutex_Lock(&gateway_spinlock);
+	stream_notify(&gateway_watchers);
+	Mutex_Unlock(&gateway_spinlock);
+
+	for(int i = 0; i < MAX_GATEWAY_CHANNELS; i++){
+		gateway_dcb* dcb = &channel_dcb[i];
+		if(! dcb->open) continue;
+		Cond_Broadcast(&dcb->ready);
+
+		Mutex_Lock(&dcb->spinlock);
+		stream_notify(&dcb->watchers);
+		Mutex_Unlock(&dcb->spinlock);
+	}
+
+	if(pre) preempt_on;
+}
+
+
+void initialize_gateways()
+{
+	rlnode_init(&gateway_watchers, NULL);
+
+	for(int i = 0; i < MAX_GATEWAY_CHANNELS; i++){
+		channel_dcb[i].open = 0;
+		channel_dcb[i].ready = COND_INIT;
+		channel_dcb[i].spinlock = MUTEX_INIT;
+		rlnode_init(&channel_dcb[i].watchers, NULL);
+	}
+
+	cpu_interrupt_handler(GATEWAY_READY, gateway_interrupt_handler);
+}
+
+
+int gateway_serves(port_t port)
+{
+	for(uint gw = 0; gw < bios_gateways(); gw++)
+		if(bios_gateway_port(gw) == port) return 1;
+	return 0;
+}
+
+
+int gateway_accept(port_t port)
+{
+	for(uint gw = 0; gw < bios_gateways(); gw++){
+		if(bios_gateway_port(gw) != port) continue;
+
+		int channel = bios_gateway_accept(gw);
+		if(channel == -1) continue;
+
+		gateway_dcb* dcb = &channel_dcb[channel];
+		dcb->has_peek = 0;
+		dcb->eof = 0;
+		dcb->open = 1;
+		return channel;
+	}
+	return -1;
+}
+
+
+void gateway_watch(stream_watch* watch)
+{
+	stream_watch_add(&gateway_watchers, watch, &gateway_spinlock);
+}
+
+
+/* Read what is available, up to size bytes. Return -1 at the end of data. */
+static int channel_recv(int channel, char* buf, unsigned int size)
+{
+	gateway_dcb* dcb = &channel_dcb[channel];
+
+	/* First, return the byte kept by gateway_poll */
+	if(dcb->has_peek){
+		buf[0] = dcb->peek;
+		dcb->has_peek = 0;
+		return 1;
+	}
+	if(dcb->eof)
+		return -1;
+
+	int rc = bios_read_channel(channel, buf, size);
+	if(rc == -1)
+		dcb->eof = 1;
+	return rc;
+}
+
+
+int gateway_readv(int channel, const iovec_t* iov, unsigned int iovcnt, int nonblocking)
+{
+	gateway_dcb* dcb = &channel_dcb[channel];
+	int count = 0;
+	unsigned int i = 0, offset = 0;
+
+	while(i < iovcnt){
+		if(offset == iov[i].size){
+			i++;
+			offset = 0;
+			continue;
+		}
+
+		int rc = channel_recv(channel, iov[i].buf + offset, iov[i].size - offset);
+		if(rc > 0){
+			count += rc;
+			offset += rc;
+			continue;
+		}
+
+		/* return what we have, or the end of data */
+		if(count > 0 || rc == -1)
+			break;
+		if(nonblocking)
+			return WOULDBLOCK;
+		kernel_wait(&dcb->ready, SCHED_IO);
+	}
+
+	return count;
+}
+
+
+int gateway_writev(int channel, const iovec_t* iov, unsigned int iovcnt, int nonblocking)
+{
+	gateway_dcb* dcb = &channel_dcb[channel];
+	int count = 0;
+	unsigned int i = 0, offset = 0;
+
+	while(i < iovcnt){
+		if(offset == iov[i].size){
+			i++;
+			offset = 0;
+			continue;
+		}
+
+		int rc = bios_write_channel(channel, iov[i].buf + offset, iov[i].size - offset);
+		if(rc > 0){
+			count += rc;
+			offset += rc;
+			continue;
+		}
+
+		/* the host has closed the connection */
+		if(rc == -1)
+			return (count > 0) ? count : -1;
+		if(count > 0)
+			break;
+		if(nonblocking)
+			return WOULDBLOCK;
+		kernel_wait(&dcb->ready, SCHED_IO);
+	}
+
+	return count;
+}
+
+
+/*
+	Writes are reported ready, as in the serial driver, since the
+	bios cannot tell without writing.
+ */
+int gateway_poll(int channel, int events, stream_watch* watch)
+{
+	gateway_dcb* dcb = &channel_dcb[channel];
+
+	if(watch != NULL)
+		stream_watch_add(&dcb->watchers, watch, &dcb->spinlock);
+
+	if(! dcb->has_peek && ! dcb->eof){
+		int rc = bios_read_channel(channel, &dcb->peek, 1);
+		if(rc == 1)
+			dcb->has_peek = 1;
+		else if(rc == -1)
+			dcb->eof = 1;
+	}
+
+	int revents = POLL_WRITE;
+	if(dcb->has_peek)
+		revents |= POLL_READ;
+	if(dcb->eof)
+		revents |= POLL_READ | POLL_HANGUP;
+
+	return revents & (events | POLL_HANGUP);
+}
+
+
+void gateway_shutdown(int channel)
+{
+	bios_shutdown_channel(channel);
+}
+
+
+void gateway_close(int channel)
+{
+	channel_dcb[channel].open = 0;
+	bios_close_channel(channel);
+}
@@ -0,0 +1,72 @@
+#ifndef __KERNEL_GATEWAY_H
+#define __KERNEL_GATEWAY_H
+
+/**
+  @file kernel_gateway.h
+  @brief Host socket gateways.
+
+  @defgroup gateway Gateways
+  @ingroup kernel
+  @brief Host socket gateways.
+
+  A gateway of the VM (see @ref bios_gateway_accept) maps a port to a
+  listening socket of the host. The connections of host programs to it
+  are queued to the listeners of the port, as if they were made by
+  @c Connect, and are served by sockets whose reads and writes go
+  directly to the host connection (a gateway channel).
+
+  The driver is interrupt-driven: the @c GATEWAY_READY interrupt wakes
+  the threads waiting on channels and notifies the listeners of gateway
+  ports.
+
+  @{
+*/
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+
+/**
+  @brief Initialization for gateways.
+
+  This function is called at kernel startup.
+ */
+void initialize_gateways();
+
+/**
+  @brief Return 1 if some gateway serves a port, else 0.
+ */
+int gateway_serves(port_t port);
+
+/**
+  @brief Accept a host connection of a port.
+
+  @returns the channel of the connection, or -1 if none is pending.
+ */
+int gateway_accept(port_t port);
+
+/**
+  @brief Add a watch that is notified by every gateway interrupt.
+
+  The notification is made from the interrupt handler, under a spinlock.
+  The watch is removed by @ref stream_unwatch.
+ */
+void gateway_watch(stream_watch* watch);
+
+/** @brief Read from a channel, as in @c ReadV. */
+int gateway_readv(int channel, const iovec_t* iov, unsigned int iovcnt, int nonblocking);
+
+/** @brief Write to a channel, as in @c WriteV. */
+int gateway_writev(int channel, const iovec_t* iov, unsigned int iovcnt, int nonblocking);
+
+/** @brief Poll a channel, as in the @c Poll stream method. */
+int gateway_poll(int channel, int events, stream_watch* watch);
+
+/** @brief Signal the end of data to the host. */
+void gateway_shutdown(int channel);
+
+/** @brief Close a channel. */
+void gateway_close(int channel);
+
+/** @} */
+
+#endif
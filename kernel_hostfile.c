@@ -0,0 +1,182 @@
+
+#include "bios.h"
+#include "tinyos.h"
+#include "kernel_hostfile.h"
+#include "kernel_sched.h"
+#include "kernel_cc.h"
+#include "kernel_sys.h"
+
+/*
+	Host files.
+
+	The driver follows the gateway driver: a host file is read and
+	written through the buffers of the bios, a thread that finds it not
+	ready sleeps on the file's condition variable, and the HOSTFILE_READY
+	interrupt wakes up the threads of all the host files, since it does
+	not tell which one is ready.
+
+	Writes return once their data is in the write-behind buffer. Close
+	waits until the buffer has been written out, so that a host program
+	sees the data when Close returns, and reports a failed write.
+
+	The fields of a host file are protected by the kernel lock, except
+	for the watch list, which is also walked by the interrupt handler
+	and is protected by the spinlock of the host file.
+ */
+
+typedef struct hostfile_control_block {
+	unsigned int hf;		/* the bios host file */
+	int open;				/* set while a stream uses the host file */
+	int writing;			/* set if open for writing */
+	CondVar ready;			/* readers and writers sleep here */
+	Mutex spinlock;			/* protects watchers */
+	rlnode watchers;		/* the watch list */
+} hostfile_dcb;
+
+static hostfile_dcb hostfile_table[MAX_HOSTFILES];
+
+
+static void hostfile_interrupt_handler()
+{
+	int pre = preempt_off;
+
+	for(int i = 0; i < MAX_HOSTFILES; i++){
+		hostfile_dcb* dcb = &hostfile_table[i];
+		if(! dcb->open) continue;
+		Cond_Broadcast(&dcb->ready);
+
+		Mutex_Lock(&dcb->spinlock);
+		stream_notify(&dcb->watchers);
+		Mutex_Unlock(&dcb->spinlock);
+	}
+
+	if(pre) preempt_on;
+}
+
+
+void initialize_hostfiles()
+{
+	for(int i = 0; i < MAX_HOSTFILES; i++){
+		hostfile_table[i].hf = i;
+		hostfile_table[i].open = 0;
+		hostfile_table[i].ready = COND_INIT;
+		hostfile_table[i].spinlock = MUTEX_INIT;
+		rlnode_init(&hostfile_table[i].watchers, NULL);
+	}
+
+	cpu_interrupt_handler(HOSTFILE_READY, hostfile_interrupt_handler);
+}
+
+
+static int hostfile_read(void* this, char* buf, unsigned int size)
+{
+	hostfile_dcb* dcb = (hostfile_dcb*) this;
+	if(dcb->writing) return -1;
+	if(size == 0) return 0;
+
+	int rc;
+	while((rc = bios_read_hostfile(dcb->hf, buf, size)) == 0)
+		kernel_wait(&dcb->ready, SCHED_IO);
+
+	/* the end of the file, or an I/O error */
+	return (rc == HOSTFILE_EOF) ? 0 : rc;
+}
+
+
+static int hostfile_write(void* this, const char* buf, unsigned int size)
+{
+	hostfile_dcb* dcb = (hostfile_dcb*) this;
+	if(! dcb->writing) return -1;
+
+	unsigned int count = 0;
+	while(count < size){
+		int rc = bios_write_hostfile(dcb->hf, buf + count, size - count);
+		if(rc > 0){
+			count += rc;
+			continue;
+		}
+
+		/* writing to the host file has failed */
+		if(rc == -1)
+			return (count > 0) ? count : -1;
+		if(count > 0)
+			break;
+		kernel_wait(&dcb->ready, SCHED_IO);
+	}
+
+	return count;
+}
+
+
+static int hostfile_poll(void* this, int events, stream_watch* watch)
+{
+	hostfile_dcb* dcb = (hostfile_dcb*) this;
+
+	if(watch != NULL)
+		stream_watch_add(&dcb->watchers, watch, &dcb->spinlock);
+
+	if(! bios_hostfile_ready(dcb->hf))
+		return 0;
+	return events & (dcb->writing ? POLL_WRITE : POLL_READ);
+}
+
+
+static int hostfile_close(void* this)
+{
+	hostfile_dcb* dcb = (hostfile_dcb*) this;
+
+	int rc = 1;
+	if(dcb->writing)
+		while((rc = bios_flush_hostfile(dcb->hf)) == 0)
+			kernel_wait(&dcb->ready, SCHED_IO);
+
+	dcb->open = 0;
+	bios_close_hostfile(dcb->hf);
+	return (rc == -1) ? -1 : 0;
+}
+
+
+file_ops hostfile_fops = {
+	.Read = hostfile_read,
+	.Write = hostfile_write,
+	.Close = hostfile_close,
+	.Poll = hostfile_poll
+};
+
+
+Fid_t sys_OpenHostFile(const char* path, int flags)
+{
+	int mode = flags & OPEN_RDWR;
+	if(path == NULL || (mode != OPEN_READ && mode != OPEN_WRITE)
+		|| (flags & ~(OPEN_RDWR|OPEN_CREATE|OPEN_EXCL|OPEN_TRUNCATE|OPEN_APPEND)) != 0)
+		return NOFILE;
+
+	/* only files open for writing are changed */
+	if(mode == OPEN_READ && (flags & (OPEN_TRUNCATE|OPEN_APPEND)))
+		return NOFILE;
+
+	int hflags = (mode == OPEN_READ) ? HOSTFILE_READ : HOSTFILE_WRITE;
+	if(flags & OPEN_CREATE) hflags |= HOSTFILE_CREATE;
+	if(flags & OPEN_EXCL) hflags |= HOSTFILE_EXCL;
+	if(flags & OPEN_TRUNCATE) hflags |= HOSTFILE_TRUNCATE;
+	if(flags & OPEN_APPEND) hflags |= HOSTFILE_APPEND;
+
+	Fid_t fid;
+	FCB* fcb;
+	if(FCB_reserve(1, &fid, &fcb) == 0)
+		return NOFILE;
+
+	int hf = bios_open_hostfile(path, hflags);
+	if(hf == -1){
+		FCB_unreserve(1, &fid, &fcb);
+		return NOFILE;
+	}
+
+	hostfile_dcb* dcb = &hostfile_table[hf];
+	dcb->writing = (mode == OPEN_WRITE);
+	dcb->open = 1;
+
+	fcb->streamobj = dcb;
+	fcb->streamfunc = &hostfile_fops;
+	return fid;
+}
@@ -0,0 +1,38 @@
+#ifndef __KERNEL_HOSTFILE_H
+#define __KERNEL_HOSTFILE_H
+
+/**
+  @file kernel_hostfile.h
+  @brief Host files.
+
+  @defgroup hostfile Host files
+  @ingroup kernel
+  @brief Host files.
+
+  A host file (see @ref bios_open_hostfile) is a regular file in the
+  host directory of the VM. Host files are opened by @c OpenHostFile, 
+  as streams of device @c DEV_HOSTFILE, which has no minor numbers.
+
+  The driver is interrupt-driven: reads and writes go through the 
+  read-ahead and write-behind buffers of the bios, and the 
+  @c HOSTFILE_READY interrupt wakes the threads waiting on host files.
+
+  @{
+*/
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+
+/** @brief The file operations of host files. */
+extern file_ops hostfile_fops;
+
+/**
+  @brief Initialization for host files.
+
+  This function is called at kernel startup.
+ */
+void initialize_hostfiles();
+
+/** @} */
+
+#endif
@@ -9,6 +9,10 @@
 #include "kernel_proc.h"
 #include "kernel_dev.h"
 #include "kernel_streams.h"
+#include "kernel_shm.h"
+#include "kernel_ramfs.h"
+#include "kernel_gateway.h"
+#include "kernel_hostfile.h"
 
 
 
@@ -26,6 +30,10 @@ static struct {
   Task init_task;
   int argl;
   void* args;
+  uint gatewayno;
+  port_t gateway_port[MAX_GATEWAYS];
+  const char* gateway_path[MAX_GATEWAYS];
+  const char* hostdir;
 } boot_rec;
 
 
@@ -37,7 +45,12 @@ void boot_tinyos_kernel()
     /* Initialize the kenrel data structures */
     initialize_processes();
     initialize_devices();
+    initialize_gateways();
+    initialize_hostfiles();
     initialize_files();
+    initialize_sockets();
+    initialize_shm();
+    initialize_ramfs();
     initialize_scheduler();
 
     /* The boot task is executed normally! */
@@ -55,6 +68,7 @@ void boot_tinyos_kernel()
 
   if(cpu_core_id==0) {
     /* Here, we could add cleanup after the scheduler has ended. */    
+    finalize_ramfs();
   }
 }
 
@@ -65,7 +79,41 @@ void boot(uint ncores, uint nterm, Task boot_task, int argl, void* args)
   boot_rec.argl = argl;
   boot_rec.args = args;
 
-  vm_boot(boot_tinyos_kernel, ncores, nterm);
+  vm_config VMC;
+  vm_configure(&VMC, boot_tinyos_kernel, ncores, nterm);
+
+  /* The gateways are added for this boot only */
+  for(uint i=0; i<boot_rec.gatewayno; i++)
+    CHECK(vm_config_gateway(&VMC, boot_rec.gateway_path[i], boot_rec.gateway_port[i]));
+  boot_rec.gatewayno = 0;
+
+  /* So is the host directory */
+  if(boot_rec.hostdir != NULL)
+    CHECK(vm_config_hostdir(&VMC, boot_rec.hostdir));
+  boot_rec.hostdir = NULL;
+
+  vm_run(&VMC);
+}
+
+
+int boot_gateway(port_t port, const char* path)
+{
+  if(port <= NOPORT || port > MAX_PORT || path == NULL) return -1;
+  if(boot_rec.gatewayno == MAX_GATEWAYS) return -1;
+
+  boot_rec.gateway_port[boot_rec.gatewayno] = port;
+  boot_rec.gateway_path[boot_rec.gatewayno] = path;
+  boot_rec.gatewayno++;
+  return 0;
+}
+
+
+int boot_hostdir(const char* path)
+{
+  if(path == NULL) return -1;
+
+  boot_rec.hostdir = path;
+  return 0;
 }
 
 
@@ -0,0 +1,449 @@
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+#include "kernel_dev.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+#include "kernel_sys.h"
+#include "kernel_ioring.h"
+
+/*
+	I/O rings.
+
+	The queues of a ring live in one block, allocated by the kernel and
+	shared with the process. IoRing_Enter takes the new submissions, and
+	performs at once those that poll ready. The rest are queued to the
+	worker threads of the ring, which perform them by the ordinary system
+	calls, blocking as needed, and post their completions.
+
+	Workers are detached threads of the owner process, so that the fids
+	of the operations are its own. A worker stays idle for
+	IORING_WORKER_LINGER before it exits. The ring is freed when it is
+	closed and no worker is left.
+
+	A ring is cancelled when it is closed, or when the threads left in
+	its process are only workers. Then, the queued operations complete
+	with -1 at once. A worker waits for its stream to poll ready, or for
+	a connection request to be admitted, on a condition variable that the
+	cancellation broadcasts; after each wait, it checks the cancel flag,
+	and completes its operation with -1 if it is set.
+
+	Once its stream polls ready, the worker performs the operation by its
+	blocking system call. If another thread takes the data (or the space)
+	in between, e.g. by a fast Read that does not hold the kernel lock,
+	the worker sleeps inside the stream, and the cancellation cannot wake
+	it; the operation completes only when the stream becomes ready again,
+	or is closed. Therefore, a stream should not be read (written) by
+	other threads while a ring operation on it is in flight.
+
+	A submission is only taken if its completion will fit in the
+	completion queue, i.e. if the operations in flight and the queued
+	completions are fewer than cq_entries.
+ */
+
+#define IORING_MAX_WORKERS 256
+#define IORING_WORKER_LINGER 200000	/* usec */
+
+typedef struct ioring_op {
+	io_sqe_t sqe;			/* a copy of the submission */
+	rlnode node;			/* node in the work queue, or in the running list */
+	CondVar ready;			/* the worker waits here for the stream */
+	int fired;				/* set by any notification of the stream */
+	CondVar* waiting;		/* where the worker sleeps, or NULL */
+} ioring_op;
+
+typedef struct io_ring_control_block {
+	FCB* fcb;				/* the stream of the ring, NULL when closed */
+	PCB* owner;				/* the process that created the ring */
+	io_ring_t* ring;		/* the queues shared with the process */
+
+	rlnode owner_node;		/* node in the ring list of the owner */
+	int cancelled;			/* set when the operations are cancelled */
+
+	unsigned int inflight;	/* operations taken and not yet completed */
+	rlnode work;			/* operations waiting for a worker */
+	unsigned int queued;	/* the length of work */
+	rlnode running;			/* operations being performed by workers */
+
+	unsigned int workers;	/* the worker threads */
+	unsigned int idle;		/* the workers waiting for work */
+	CondVar has_work;		/* idle workers sleep here */
+	CondVar completed;		/* IoRing_Enter sleeps here */
+} ioring_cb;
+
+
+/* the number of completions not yet removed by the process */
+static inline unsigned int ioring_cq_fill(io_ring_t* ring)
+{
+	return __atomic_load_n(&ring->cq_tail, __ATOMIC_RELAXED)
+		- __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+}
+
+static void ioring_free(ioring_cb* ir)
+{
+	free(ir->ring);
+	free(ir);
+}
+
+
+/* Post a completion; there is always room for it */
+static void ioring_complete(ioring_cb* ir, uintptr_t data, int result)
+{
+	io_ring_t* ring = ir->ring;
+	unsigned int tail = ring->cq_tail;
+
+	io_cqe_t* cqe = &ring->cq[tail & (ring->cq_entries - 1)];
+	cqe->result = result;
+	cqe->data = data;
+	__atomic_store_n(&ring->cq_tail, tail + 1, __ATOMIC_RELEASE);
+	ir->inflight--;
+
+	if(ir->fcb != NULL){
+		kernel_broadcast(&ir->completed);
+		stream_notify(&ir->fcb->watchers);
+	}
+}
+
+
+/* Perform an operation, as its system call */
+static int ioring_execute(io_sqe_t* sqe)
+{
+	switch(sqe->opcode){
+		case IO_NOP:
+			return 0;
+		case IO_READ:
+			return sys_Read(sqe->fd, sqe->buf, sqe->size);
+		case IO_WRITE:
+			return sys_Write(sqe->fd, sqe->buf, sqe->size);
+		case IO_ACCEPT:
+			return sys_Accept(sqe->fd);
+		case IO_CONNECT:
+			return sys_Connect(sqe->fd, sqe->port, sqe->timeout);
+	}
+	return -1;
+}
+
+
+/* The events an operation waits for, or 0 if it does not poll */
+static int ioring_events(io_sqe_t* sqe)
+{
+	switch(sqe->opcode){
+		case IO_READ:
+		case IO_ACCEPT:
+			return POLL_READ;
+		case IO_WRITE:
+			return POLL_WRITE;
+		default:
+			return 0;
+	}
+}
+
+
+/* Return 1 if an operation can be performed without blocking */
+static int ioring_ready(io_sqe_t* sqe)
+{
+	if(sqe->opcode == IO_CONNECT)
+		return 0;	// waits for the listener
+
+	int events = ioring_events(sqe);
+	if(events == 0)
+		return 1;	// fails at once
+
+	// a bad fid fails at once, and a stream that cannot poll is assumed ready
+	FCB* fcb = get_fcb(sqe->fd);
+	if(fcb == NULL || fcb->nonblocking || fcb->streamfunc->Poll == NULL)
+		return 1;
+	return fcb->streamfunc->Poll(fcb->streamobj, events, NULL) != 0;
+}
+
+
+static void ioring_notify(stream_watch* watch)
+{
+	ioring_op* op = watch->owner;
+	op->fired = 1;
+	kernel_broadcast(&op->ready);
+}
+
+
+/*
+	Wait until the stream of an operation polls ready. Return 0 if the
+	ring is cancelled meanwhile. As in ioring_ready, a bad fid and a
+	stream that cannot block are ready.
+ */
+static int ioring_wait_ready(ioring_cb* ir, ioring_op* op, int events)
+{
+	FCB* fcb = get_fcb(op->sqe.fd);
+	if(fcb == NULL || fcb->nonblocking || fcb->streamfunc->Poll == NULL)
+		return ! ir->cancelled;
+
+	/* The stream must not be closed while we watch it */
+	FCB_incref(fcb);
+
+	stream_watch watch = { .notify = ioring_notify, .owner = op, .lock = NULL };
+	op->fired = 0;
+	int ready = fcb->streamfunc->Poll(fcb->streamobj, events, &watch) != 0;
+
+	op->waiting = &op->ready;
+	while(! ready && ! ir->cancelled){
+		if(! op->fired)
+			kernel_wait(&op->ready, SCHED_IO);
+		op->fired = 0;
+		ready = fcb->streamfunc->Poll(fcb->streamobj, events, NULL) != 0;
+	}
+	op->waiting = NULL;
+
+	stream_unwatch(&watch);
+	FCB_decref(fcb);
+	return ! ir->cancelled;
+}
+
+
+/* Perform an operation in a worker, unless the ring is cancelled */
+static int ioring_perform(ioring_cb* ir, ioring_op* op)
+{
+	io_sqe_t* sqe = &op->sqe;
+
+	if(sqe->opcode == IO_CONNECT)
+		return socket_connect(sqe->fd, sqe->port, sqe->timeout, &ir->cancelled, &op->waiting);
+
+	int events = ioring_events(sqe);
+	if(events != 0 && ! ioring_wait_ready(ir, op, events))
+		return -1;
+	return ioring_execute(sqe);
+}
+
+
+static int ioring_worker(int argl, void* args)
+{
+	ioring_cb* ir = args;
+
+	kernel_lock();
+	while(1){
+		if(! is_rlist_empty(&ir->work)){
+			ioring_op* op = rlist_pop_front(&ir->work)->obj;
+			ir->queued--;
+			rlist_push_back(&ir->running, &op->node);
+
+			int rc = ioring_perform(ir, op);
+			rlist_remove(&op->node);
+			ioring_complete(ir, op->sqe.data, rc);
+			free(op);
+			continue;
+		}
+
+		if(ir->fcb == NULL || ir->cancelled)
+			break;
+
+		ir->idle++;
+		int signalled = kernel_timedwait(&ir->has_work, SCHED_IO, IORING_WORKER_LINGER);
+		ir->idle--;
+		if(! signalled && is_rlist_empty(&ir->work))
+			break;
+	}
+
+	ir->workers--;
+	ir->owner->ioring_workers--;
+	if(ir->fcb == NULL && ir->workers == 0)
+		ioring_free(ir);
+	kernel_unlock();
+
+	return 0;
+}
+
+
+/* Hand an operation to the workers, creating one if none is idle */
+static void ioring_queue(ioring_cb* ir, io_sqe_t* sqe)
+{
+	ioring_op* op = xmalloc(sizeof(ioring_op));
+	op->sqe = *sqe;
+	op->ready = COND_INIT;
+	op->waiting = NULL;
+	rlnode_init(&op->node, op);
+	rlist_push_back(&ir->work, &op->node);
+	ir->queued++;
+
+	if(ir->idle >= ir->queued){
+		kernel_signal(&ir->has_work);
+		return;
+	}
+
+	if(ir->workers < IORING_MAX_WORKERS){
+		Tid_t tid = sys_CreateThread(ioring_worker, 0, ir);
+		if(tid != NOTHREAD){
+			sys_ThreadDetach(tid);
+			ir->workers++;
+			ir->owner->ioring_workers++;
+		}
+	}
+}
+
+
+/*
+	Cancel the operations of a ring: the queued ones complete at once,
+	and the running ones when their workers wake up.
+ */
+static void ioring_cancel(ioring_cb* ir)
+{
+	if(ir->cancelled)
+		return;
+	ir->cancelled = 1;
+	rlist_remove(&ir->owner_node);
+
+	while(! is_rlist_empty(&ir->work)){
+		ioring_op* op = rlist_pop_front(&ir->work)->obj;
+		ir->queued--;
+		ioring_complete(ir, op->sqe.data, -1);
+		free(op);
+	}
+
+	for(rlnode* p = ir->running.next; p != &ir->running; p = p->next){
+		ioring_op* op = p->obj;
+		if(op->waiting != NULL)
+			kernel_broadcast(op->waiting);
+	}
+
+	// the idle workers exit
+	kernel_broadcast(&ir->has_work);
+}
+
+
+void ioring_cancel_all(PCB* pcb)
+{
+	while(! is_rlist_empty(&pcb->ioring_list))
+		ioring_cancel(pcb->ioring_list.next->obj);
+}
+
+
+int ioring_poll(void* this, int events, stream_watch* watch)
+{
+	ioring_cb* ir = (ioring_cb*) this;
+
+	if(watch != NULL)
+		stream_watch_add(&ir->fcb->watchers, watch, NULL);
+
+	return (ioring_cq_fill(ir->ring) > 0) ? (events & POLL_READ) : 0;
+}
+
+int ioring_close(void* this)
+{
+	ioring_cb* ir = (ioring_cb*) this;
+	if(ir == NULL) return -1;
+
+	// the operations in flight are cancelled, and the last worker frees the ring
+	ir->fcb = NULL;
+	ioring_cancel(ir);
+	if(ir->workers == 0)
+		ioring_free(ir);
+	return 0;
+}
+
+
+file_ops ioring_file_ops = {
+	.Open = null_open,
+	.Read = null_read,
+	.Write = null_write,
+	.Close = ioring_close,
+	.Poll = ioring_poll
+};
+
+
+Fid_t sys_IoRing_Create(unsigned int entries, io_ring_t** ring)
+{
+	if(entries == 0 || entries > MAX_IORING_ENTRIES || ring == NULL)
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) == 0)
+		return NOFILE;
+
+	// round up to a power of 2
+	unsigned int sq_entries = 1;
+	while(sq_entries < entries) sq_entries <<= 1;
+	unsigned int cq_entries = 2*sq_entries;
+
+	// the queues follow the header, in one block
+	io_ring_t* r = xmalloc(sizeof(io_ring_t)
+		+ sq_entries*sizeof(io_sqe_t) + cq_entries*sizeof(io_cqe_t));
+	r->sq_head = r->sq_tail = 0;
+	r->sq_entries = sq_entries;
+	r->sq = (io_sqe_t*) (r + 1);
+	r->cq_head = r->cq_tail = 0;
+	r->cq_entries = cq_entries;
+	r->cq = (io_cqe_t*) (r->sq + sq_entries);
+
+	ioring_cb* ir = xmalloc(sizeof(ioring_cb));
+	ir->fcb = fcb;
+	ir->owner = CURPROC;
+	ir->ring = r;
+	rlnode_init(&ir->owner_node, ir);
+	rlist_push_back(&CURPROC->ioring_list, &ir->owner_node);
+	ir->cancelled = 0;
+	ir->inflight = 0;
+	rlnode_init(&ir->work, NULL);
+	ir->queued = 0;
+	rlnode_init(&ir->running, NULL);
+	ir->workers = ir->idle = 0;
+	ir->has_work = ir->completed = COND_INIT;
+
+	fcb->streamobj = ir;
+	fcb->streamfunc = &ioring_file_ops;
+
+	*ring = r;
+	return fid;
+}
+
+
+int sys_IoRing_Enter(Fid_t ringfd, unsigned int to_submit, unsigned int min_complete, timeout_t timeout)
+{
+	FCB* fcb = get_fcb(ringfd);
+	if(fcb == NULL || fcb->streamfunc != &ioring_file_ops)
+		return -1;
+
+	ioring_cb* ir = fcb->streamobj;
+	io_ring_t* ring = ir->ring;
+	if(ir->owner != CURPROC || ir->cancelled || min_complete > ring->cq_entries)
+		return -1;
+
+	/* The ring must not be closed while we use it */
+	FCB_incref(fcb);
+
+	/* Take the submissions, as long as their completions fit */
+	unsigned int submitted = 0;
+	unsigned int tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+	while(submitted < to_submit && ring->sq_head != tail
+		&& ir->inflight + ioring_cq_fill(ring) < ring->cq_entries){
+
+		unsigned int head = ring->sq_head;
+		io_sqe_t sqe = ring->sq[head & (ring->sq_entries - 1)];
+		__atomic_store_n(&ring->sq_head, head + 1, __ATOMIC_RELEASE);
+		submitted++;
+		ir->inflight++;
+
+		if(ioring_ready(&sqe))
+			ioring_complete(ir, sqe.data, ioring_execute(&sqe));
+		else
+			ioring_queue(ir, &sqe);
+	}
+
+	/* Wait for the completions, while enough operations are in flight */
+	TimerDuration deadline = bios_clock() + 1000ul*timeout;
+	while(ioring_cq_fill(ring) < min_complete
+		&& ioring_cq_fill(ring) + ir->inflight >= min_complete){
+
+		if(timeout == 0) break;
+
+		TimerDuration t = NO_TIMEOUT;
+		if(timeout != (timeout_t)-1){
+			TimerDuration now = bios_clock();
+			if(now >= deadline) break;
+			t = deadline - now;
+		}
+		kernel_timedwait(&ir->completed, SCHED_IO, t);
+	}
+
+	FCB_decref(fcb);
+	return submitted;
+}
@@ -0,0 +1,43 @@
+#ifndef __KERNEL_IORING_H
+#define __KERNEL_IORING_H
+
+/**
+  @file kernel_ioring.h
+  @brief I/O rings.
+
+  @defgroup ioring I/O rings
+  @ingroup kernel
+  @brief I/O rings.
+
+  The operations of an I/O ring that would block are performed by
+  worker threads of the process that created the ring. The rings of a
+  process are recorded in the @c ioring_list of its PCB, and its
+  workers are counted in @c ioring_workers.
+
+  The workers must not keep their process from exiting. Therefore,
+  when the threads left in a process are only ring workers, its rings
+  are cancelled: their operations complete with -1, and the workers
+  exit.
+
+  A worker can only be cancelled while it waits for its stream to poll
+  ready. An operation whose data is taken by another thread after that
+  blocks inside the stream, out of reach of the cancellation, until the
+  stream is ready again or closed.
+
+  @{
+*/
+
+#include "tinyos.h"
+#include "kernel_proc.h"
+
+/**
+  @brief Cancel the I/O rings of a process.
+
+  This is called when a thread exits, and the threads left in its
+  process are only ring workers.
+ */
+void ioring_cancel_all(PCB* pcb);
+
+/** @} */
+
+#endif
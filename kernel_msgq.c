@@ -0,0 +1,280 @@
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+#include "kernel_dev.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+
+/*
+	Message queues.
+
+	All the messages of a queue live in a slab of maxmsg slots of
+	msgsize bytes, allocated when the queue is created. A free slot
+	is taken from the free list by each send, and is linked into
+	the FIFO list of its priority. A bitmask of the non-empty
+	priorities locates the highest priority message in O(1).
+
+	Any number of threads (of any number of processes) may send and
+	receive. As in pipes, senders and receivers count themselves as
+	waiting, so that wakeups are only issued when someone sleeps.
+ */
+
+typedef struct msgq_slot {
+	rlnode node;			/* node in the free list or in a priority list */
+	unsigned int size;		/* the length of the message */
+	char* data;				/* the msgsize bytes of this slot */
+} msgq_slot;
+
+typedef struct msgq_control_block {
+	FCB* fcb;				/* the stream of the queue, for the watchers */
+
+	unsigned int maxmsg;	/* the number of slots */
+	unsigned int msgsize;	/* the size of each slot */
+	unsigned int count;		/* the number of queued messages */
+
+	rlnode queue[MSGQ_PRIORITIES];	/* queued messages, per priority */
+	uint32_t prio_mask;		/* bit p is set iff queue[p] is non-empty */
+	rlnode free;			/* the free slots */
+
+	msgq_slot* slab;		/* the slots */
+	char* data;				/* the message bytes of all slots */
+
+	CondVar not_empty;		/* receivers sleep here */
+	CondVar not_full;		/* senders sleep here */
+	int receivers_waiting;
+	int senders_waiting;
+} msgq_cb;
+
+_Static_assert(MSGQ_PRIORITIES <= 32, "prio_mask is 32 bits");
+
+
+/* Take the oldest message of the highest priority */
+static msgq_slot* msgq_pop(msgq_cb* mq, unsigned int* prio)
+{
+	unsigned int p = 31 - __builtin_clz(mq->prio_mask);
+	msgq_slot* slot = rlist_pop_front(&mq->queue[p])->obj;
+	if(is_rlist_empty(&mq->queue[p]))
+		mq->prio_mask &= ~(1u << p);
+
+	mq->count--;
+	*prio = p;
+	return slot;
+}
+
+
+/*
+	Send one message, blocking while the queue is full.
+	Return size, -1 on error or WOULDBLOCK.
+ */
+static int msgq_send(msgq_cb* mq, const char* buf, unsigned int size, unsigned int prio)
+{
+	if(size == 0 || size > mq->msgsize || prio >= MSGQ_PRIORITIES)
+		return -1;
+
+	while(mq->count == mq->maxmsg){
+		if(mq->fcb->nonblocking)
+			return WOULDBLOCK;
+		mq->senders_waiting++;
+		kernel_wait(&mq->not_full, SCHED_PIPE);
+		mq->senders_waiting--;
+	}
+
+	msgq_slot* slot = rlist_pop_front(&mq->free)->obj;
+	memcpy(slot->data, buf, size);
+	slot->size = size;
+
+	rlist_push_back(&mq->queue[prio], &slot->node);
+	mq->prio_mask |= 1u << prio;
+	mq->count++;
+
+	if(mq->receivers_waiting > 0)
+		kernel_signal(&mq->not_empty);
+
+	// pass the wakeup on to the next sender, if a slot is left
+	if(mq->count < mq->maxmsg && mq->senders_waiting > 0)
+		kernel_signal(&mq->not_full);
+
+	stream_notify(&mq->fcb->watchers);
+	return size;
+}
+
+
+/*
+	Receive up to count messages, blocking while the queue is empty.
+	Return the number of messages, -1 on error or WOULDBLOCK.
+ */
+static int msgq_receive(msgq_cb* mq, msg_t* msgs, unsigned int count)
+{
+	while(mq->count == 0){
+		if(mq->fcb->nonblocking)
+			return WOULDBLOCK;
+		mq->receivers_waiting++;
+		kernel_wait(&mq->not_empty, SCHED_PIPE);
+		mq->receivers_waiting--;
+	}
+
+	unsigned int n;
+	for(n = 0; n < count && mq->count > 0; n++){
+		unsigned int prio;
+		msgq_slot* slot = msgq_pop(mq, &prio);
+
+		// the excess of the message is discarded
+		unsigned int len = (slot->size < msgs[n].size) ? slot->size : msgs[n].size;
+		memcpy(msgs[n].buf, slot->data, len);
+		msgs[n].size = len;
+		msgs[n].prio = prio;
+
+		rlist_push_front(&mq->free, &slot->node);
+
+		// one slot is free for one sender
+		if(mq->senders_waiting > 0)
+			kernel_signal(&mq->not_full);
+	}
+
+	// pass the wakeup on to the next receiver, if messages are left
+	if(mq->count > 0 && mq->receivers_waiting > 0)
+		kernel_signal(&mq->not_empty);
+
+	stream_notify(&mq->fcb->watchers);
+	return n;
+}
+
+
+/*
+	Messages are never empty, so that Read never returns 0, which
+	would mean the end of data. A message cannot be received into an
+	empty buffer, either.
+ */
+int msgq_read(void* this, char *buf, unsigned int size)
+{
+	if(size == 0) return -1;
+
+	msg_t msg = { .buf = buf, .size = size };
+	int rc = msgq_receive((msgq_cb*) this, &msg, 1);
+	return (rc == 1) ? (int) msg.size : rc;
+}
+
+int msgq_write(void* this, const char* buf, unsigned int size)
+{
+	return msgq_send((msgq_cb*) this, buf, size, 0);
+}
+
+int msgq_poll(void* this, int events, stream_watch* watch)
+{
+	msgq_cb* mq = (msgq_cb*) this;
+
+	if(watch != NULL)
+		stream_watch_add(&mq->fcb->watchers, watch, NULL);
+
+	int revents = 0;
+	if(mq->count > 0)
+		revents |= POLL_READ;
+	if(mq->count < mq->maxmsg)
+		revents |= POLL_WRITE;
+
+	return revents & events;
+}
+
+int msgq_close(void* this)
+{
+	msgq_cb* mq = (msgq_cb*) this;
+	if(mq == NULL) return -1;
+
+	free(mq->data);
+	free(mq->slab);
+	free(mq);
+	return 0;
+}
+
+
+file_ops msgq_file_ops = {
+	.Open = null_open,
+	.Read = msgq_read,
+	.Write = msgq_write,
+	.Close = msgq_close,
+	.Poll = msgq_poll
+};
+
+
+/* Translate an fid to a message queue, or NULL */
+static FCB* get_msgq_fcb(Fid_t fid)
+{
+	FCB* fcb = get_fcb(fid);
+	if(fcb == NULL || fcb->streamfunc != &msgq_file_ops)
+		return NULL;
+	return fcb;
+}
+
+
+Fid_t sys_MsgQueue(unsigned int maxmsg, unsigned int msgsize)
+{
+	if(maxmsg == 0 || maxmsg > MAX_MSGQ_MESSAGES
+		|| msgsize == 0 || msgsize > MAX_MSG_SIZE)
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+
+	if(FCB_reserve(1, &fid, &fcb) == 0)
+		return NOFILE;
+
+	msgq_cb* mq = xmalloc(sizeof(msgq_cb));
+	mq->fcb = fcb;
+	mq->maxmsg = maxmsg;
+	mq->msgsize = msgsize;
+	mq->count = 0;
+	mq->prio_mask = 0;
+	mq->not_empty = mq->not_full = COND_INIT;
+	mq->receivers_waiting = mq->senders_waiting = 0;
+
+	for(unsigned int p = 0; p < MSGQ_PRIORITIES; p++)
+		rlnode_init(&mq->queue[p], NULL);
+
+	// preallocate the slab of slots
+	mq->slab = xmalloc(maxmsg * sizeof(msgq_slot));
+	mq->data = xmalloc(maxmsg * msgsize);
+	rlnode_init(&mq->free, NULL);
+	for(unsigned int i = 0; i < maxmsg; i++){
+		mq->slab[i].data = mq->data + i*msgsize;
+		rlnode_init(&mq->slab[i].node, &mq->slab[i]);
+		rlist_push_back(&mq->free, &mq->slab[i].node);
+	}
+
+	fcb->streamobj = mq;
+	fcb->streamfunc = &msgq_file_ops;
+
+	return fid;
+}
+
+
+int sys_MsgSend(Fid_t mqd, const char* buf, unsigned int size, unsigned int prio)
+{
+	FCB* fcb = get_msgq_fcb(mqd);
+	if(fcb == NULL || (buf == NULL && size > 0))
+		return -1;
+
+	/* the queue must not be closed while we wait */
+	FCB_incref(fcb);
+	int rc = msgq_send(fcb->streamobj, buf, size, prio);
+	FCB_decref(fcb);
+	return rc;
+}
+
+
+int sys_MsgReceive(Fid_t mqd, msg_t* msgs, unsigned int count)
+{
+	FCB* fcb = get_msgq_fcb(mqd);
+	if(fcb == NULL || msgs == NULL || count == 0)
+		return -1;
+
+	for(unsigned int i = 0; i < count; i++)
+		if(msgs[i].buf == NULL && msgs[i].size > 0)
+			return -1;
+
+	/* the queue must not be closed while we wait */
+	FCB_incref(fcb);
+	int rc = msgq_receive(fcb->streamobj, msgs, count);
+	FCB_decref(fcb);
+	return rc;
+}
@@ -17,110 +17,532 @@ int null_read(void* this, char *buf, unsigned int size){
 }
 
 
+/* the pipes created by Pipe and Pipe2; socket pipes live in connections */
+static slab_cache pipe_cache = SLAB_CACHE_INIT(pipe_cache, pipe_cb, 4);
+
+/* release a pipe whose both ends are closed */
+static void pipe_release(pipe_cb *pp)
+{
+	if(pp->buffer != pp->BUFFER)
+		free(pp->buffer);
+
+	if(pp->conn != NULL)
+		connection_release(pp->conn);
+	else
+		slab_free(&pipe_cache, pp);
+}
+
+
+/* the pipes of the two ends, for CopyStream; records are left to Read and Write */
+static pipe_cb* pipe_reader_get_pipe(void* this, int reading){
+	pipe_cb *pp = (pipe_cb *)this;
+	return (reading && ! pp->packet) ? pp : NULL;
+}
+
+static pipe_cb* pipe_writer_get_pipe(void* this, int reading){
+	pipe_cb *pp = (pipe_cb *)this;
+	return (! reading && ! pp->packet) ? pp : NULL;
+}
+
+
 file_ops reader_file_ops = {
   .Open = null_open,
   .Read = pipe_read,
   .Write = null_write,
-  .Close = pipe_reader_close
+  .Close = pipe_reader_close,
+  .ReadV = pipe_readv,
+  .Poll = pipe_reader_poll,
+  .FastRead = pipe_fast_read,
+  .GetPipe = pipe_reader_get_pipe
 };
 
 file_ops writer_file_ops = {
   .Open = null_open,
   .Read = null_read,
   .Write = pipe_write,
-  .Close = pipe_writer_close
+  .Close = pipe_writer_close,
+  .WriteV = pipe_writev,
+  .Poll = pipe_writer_poll,
+  .FastWrite = pipe_fast_write,
+  .GetPipe = pipe_writer_get_pipe
 };
 
-int pipe_read(void* this, char *buf, unsigned int size){
-pipe_cb *pp = (pipe_cb *)this;//create a pipe
 
-	//if pipe reader exists and if there is not space in the buffer 
-	while(pp->reader != NULL && pp->numOfElem == 0){
-		if(pp->writer != NULL){
-			kernel_signal(&pp->has_space); // signal the writer
-			kernel_wait(&pp->has_data, SCHED_PIPE); // make reader sleep
+/* the ring positions are reduced modulo the ring size, which must
+   divide 2^32 for the counters to wrap around correctly */
+_Static_assert((PIPE_BUFFER_SIZE & (PIPE_BUFFER_SIZE-1)) == 0,
+	"PIPE_BUFFER_SIZE must be a power of 2");
+
+/* copy n bytes out of the circular buffer, starting at position r */
+static void ring_get(pipe_cb *pp, unsigned int r, char *buf, unsigned int n)
+{
+	unsigned int pos = r & (pp->size - 1);
+	unsigned int first = pp->size - pos;
+	if(first > n) first = n;
+
+	memcpy(buf, pp->buffer + pos, first);
+	memcpy(buf + first, pp->buffer, n - first);
+}
+
+/* copy n bytes into the circular buffer, starting at position w */
+static void ring_put(pipe_cb *pp, unsigned int w, const char *buf, unsigned int n)
+{
+	unsigned int pos = w & (pp->size - 1);
+	unsigned int first = pp->size - pos;
+	if(first > n) first = n;
+
+	memcpy(pp->buffer + pos, buf, first);
+	memcpy(pp->buffer, buf + first, n - first);
+}
+
+/* copy n bytes out of the circular buffer; the caller holds r_lock */
+static void pipe_copy_out(pipe_cb *pp, char *buf, unsigned int n)
+{
+	unsigned int r = pp->r_position;
+	ring_get(pp, r, buf, n);
+
+	// publish the free space to the writer
+	__atomic_store_n(&pp->r_position, r + n, __ATOMIC_RELEASE);
+}
+
+/* copy n bytes into the circular buffer; the caller holds w_lock */
+static void pipe_copy_in(pipe_cb *pp, const char *buf, unsigned int n)
+{
+	unsigned int w = pp->w_position;
+	ring_put(pp, w, buf, n);
+
+	// publish the data to the reader
+	__atomic_store_n(&pp->w_position, w + n, __ATOMIC_RELEASE);
+}
+
+/* the total size of a segment vector */
+static unsigned long iov_size(const iovec_t* iov, unsigned int iovcnt)
+{
+	unsigned long total = 0;
+	for(unsigned int i=0; i<iovcnt; i++)
+		total += iov[i].size;
+	return total;
+}
+
+/* copy the next record out of the ring, discarding the bytes that do not
+   fit in the segments; the caller holds r_lock */
+static int pipe_get_record(pipe_cb *pp, const iovec_t* iov, unsigned int iovcnt)
+{
+	if(pipe_fill(pp) == 0 || iov_size(iov, iovcnt) == 0)
+		return 0;
+
+	unsigned int r = pp->r_position;
+	unsigned int len;
+	ring_get(pp, r, (char*) &len, PIPE_RECORD_HEADER);
+
+	unsigned int Bytes_Read = 0;
+	for(unsigned int i=0; i<iovcnt && Bytes_Read < len; i++){
+		unsigned int n = iov[i].size;
+		if(len - Bytes_Read < n) n = len - Bytes_Read;
+
+		ring_get(pp, r + PIPE_RECORD_HEADER + Bytes_Read, iov[i].buf, n);
+		Bytes_Read += n;
+	}
+
+	// the whole record is consumed
+	__atomic_store_n(&pp->r_position, r + PIPE_RECORD_HEADER + len, __ATOMIC_RELEASE);
+	return Bytes_Read;
+}
+
+/* copy the segments into the ring as one record of len bytes, if it fits;
+   the caller holds w_lock */
+static int pipe_put_record(pipe_cb *pp, const iovec_t* iov, unsigned int iovcnt, unsigned int len)
+{
+	if(len == 0 || pipe_space(pp) < PIPE_RECORD_HEADER + len)
+		return 0;
+
+	unsigned int w = pp->w_position;
+	ring_put(pp, w, (const char*) &len, PIPE_RECORD_HEADER);
+
+	unsigned int pos = w + PIPE_RECORD_HEADER;
+	for(unsigned int i=0; i<iovcnt; i++){
+		ring_put(pp, pos, iov[i].buf, iov[i].size);
+		pos += iov[i].size;
+	}
+
+	// the record becomes visible as a whole
+	__atomic_store_n(&pp->w_position, pos, __ATOMIC_RELEASE);
+	return len;
+}
+
+/* copy the segments out of the ring, until the ring is drained
+   (in packet mode, copy one record) */
+static int pipe_scatter(pipe_cb *pp, const iovec_t* iov, unsigned int iovcnt)
+{
+	int Bytes_Read = 0;
+
+	Mutex_Lock(&pp->r_lock);
+	if(pp->packet){
+		Bytes_Read = pipe_get_record(pp, iov, iovcnt);
+		Mutex_Unlock(&pp->r_lock);
+		return Bytes_Read;
+	}
+
+	unsigned int elemInRing = pipe_fill(pp);
+	for(unsigned int i=0; i<iovcnt && elemInRing > 0; i++){
+		unsigned int elemInBuffer = iov[i].size;
+		if (elemInRing < elemInBuffer){
+			elemInBuffer = elemInRing;
 		}
-		else{
-			return 0;
+
+		pipe_copy_out(pp, iov[i].buf, elemInBuffer);
+		Bytes_Read += elemInBuffer;
+		elemInRing -= elemInBuffer;
+	}
+	Mutex_Unlock(&pp->r_lock);
+
+	return Bytes_Read;
+}
+
+/* copy the segments into the ring, until the ring is full
+   (in packet mode, copy them as one record of len bytes) */
+static int pipe_gather(pipe_cb *pp, const iovec_t* iov, unsigned int iovcnt, unsigned int len)
+{
+	int Bytes_Written = 0;
+
+	Mutex_Lock(&pp->w_lock);
+	if(pp->packet){
+		Bytes_Written = pipe_put_record(pp, iov, iovcnt, len);
+		Mutex_Unlock(&pp->w_lock);
+		return Bytes_Written;
+	}
+
+	unsigned int free_pos_buffer = pipe_space(pp);
+	for(unsigned int i=0; i<iovcnt && free_pos_buffer > 0; i++){
+		// checking not to write more than the free space
+		unsigned int bToWrite = iov[i].size;
+		if (free_pos_buffer < bToWrite){
+			bToWrite = free_pos_buffer;
 		}
+
+		pipe_copy_in(pp, iov[i].buf, bToWrite);
+		Bytes_Written += bToWrite;
+		free_pos_buffer -= bToWrite;
 	}
+	Mutex_Unlock(&pp->w_lock);
 
-	// checking if pipe reader exists after waiting 
-	if (pp->reader == NULL){
-		return -1;
+	return Bytes_Written;
+}
+
+/* return 1 if the watch list of an end may be non-empty */
+static inline int pipe_end_watched(FCB* end)
+{
+	return end != NULL
+		&& __atomic_load_n(&end->watchers.next, __ATOMIC_RELAXED) != &end->watchers;
+}
+
+/*
+	Wake up the writers after data was read, and the readers after data
+	was written. The kernel lock must be held.
+
+	Threads only sleep on an empty (full) ring. Since the other end
+	may be moving data without the kernel lock, a sleeper first counts
+	itself as waiting and then checks the ring again, while the other
+	end first publishes its data and then checks for sleepers.
+ */
+static void pipe_wake_writers(pipe_cb *pp)
+{
+	if(pp->writers_waiting > 0)
+		kernel_signal(&pp->has_space);
+	if(pp->writer != NULL)
+		stream_notify(&pp->writer->watchers);
+}
+
+static void pipe_wake_readers(pipe_cb *pp)
+{
+	// a coalescing writer lets the readers sleep on small amounts
+	unsigned int wake = pp->coalesce ? PIPE_COALESCE_BYTES : 1;
+	if(wake < pp->lowat) wake = pp->lowat;
+
+	if(pp->readers_waiting > 0 && pipe_fill(pp) >= wake)
+		kernel_signal(&pp->has_data);
+	if(pp->reader != NULL)
+		stream_notify(&pp->reader->watchers);
+}
+
+/* check whether the other end needs a wakeup, after our data was published */
+static inline int pipe_writers_need_wakeup(pipe_cb *pp)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&pp->writers_waiting, __ATOMIC_RELAXED) > 0
+		|| pipe_end_watched(pp->writer);
+}
+
+static inline int pipe_readers_need_wakeup(pipe_cb *pp)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&pp->readers_waiting, __ATOMIC_RELAXED) > 0
+		|| pipe_end_watched(pp->reader);
+}
+
+/*
+	Adaptive spinning.
+
+	A thread about to sleep on an empty (full) ring first spins, with the
+	kernel lock released, as long as the thread at the other end is
+	running on another core. This saves a sleep and a wakeup when the
+	data (space) arrives within microseconds.
+
+	The spin is bounded by twice the average length of the spins that
+	succeeded. A spin that fails halves the average, so that an end whose
+	peer is slow falls back to sleeping at once.
+ */
+#define PIPE_SPIN_MIN 64
+#define PIPE_SPIN_MAX 20000
+
+/* record that the current thread moved data through an end */
+static inline void pipe_mark(struct thread_control_block** thread, unsigned int* core)
+{
+	__atomic_store_n(thread, cur_thread(), __ATOMIC_RELAXED);
+	__atomic_store_n(core, cpu_core_id, __ATOMIC_RELAXED);
+}
+
+/* return 1 if thread is running on core; the thread may have exited,
+   so it is only compared, never dereferenced */
+static inline int pipe_peer_running(struct thread_control_block** thread, unsigned int* core)
+{
+	TCB* tcb = __atomic_load_n(thread, __ATOMIC_RELAXED);
+	unsigned int c = __atomic_load_n(core, __ATOMIC_RELAXED);
+	return tcb != NULL && tcb != cur_thread()
+		&& __atomic_load_n(&cctx[c].current_thread, __ATOMIC_RELAXED) == tcb;
+}
+
+/* return 1 if a reader (writer) needing need bytes (of space) should not sleep */
+static inline int pipe_spin_done(pipe_cb *pp, int reading, unsigned int need)
+{
+	if(reading)
+		return pipe_fill(pp) >= pp->lowat || __atomic_load_n(&pp->writer, __ATOMIC_RELAXED) == NULL;
+	else
+		return pipe_space(pp) >= need
+			|| __atomic_load_n(&pp->reader, __ATOMIC_RELAXED) == NULL;
+}
+
+/*
+	Spin while the ring is empty (full) and the peer runs. The kernel
+	lock must be held; it is released while spinning.
+	Return 1 if the ring became ready.
+ */
+static int pipe_spin_wait(pipe_cb *pp, int reading, unsigned int need)
+{
+	struct thread_control_block** peer = reading ? &pp->w_thread : &pp->r_thread;
+	unsigned int* peer_core = reading ? &pp->w_core : &pp->r_core;
+	unsigned int* budget = reading ? &pp->r_spin : &pp->w_spin;
+
+	if(cpu_cores() == 1 || ! pipe_peer_running(peer, peer_core))
+		return 0;
+
+	unsigned int avg = __atomic_load_n(budget, __ATOMIC_RELAXED);
+	unsigned int limit = 2*avg + PIPE_SPIN_MIN;
+	if(limit > PIPE_SPIN_MAX) limit = PIPE_SPIN_MAX;
+
+	kernel_unlock();
+	unsigned int n = 0;
+	int done;
+	while(! (done = pipe_spin_done(pp, reading, need))
+		&& n < limit && pipe_peer_running(peer, peer_core)){
+#if defined(__x86__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+		n++;
 	}
+	kernel_lock();
+
+	// the budget is only a hint, racing updates are harmless
+	if(done)
+		avg = avg + ((int)n - (int)avg)/8;
+	else
+		avg = avg/2;
+	__atomic_store_n(budget, avg, __ATOMIC_RELAXED);
+
+	return done;
+}
+
+
+/* sleep on cv, but not longer than the coalescing delay, if the writer coalesces */
+static void pipe_sleep(pipe_cb *pp, CondVar* cv)
+{
+	if(pp->coalesce)
+		kernel_timedwait(cv, SCHED_PIPE, PIPE_COALESCE_DELAY);
+	else
+		kernel_wait(cv, SCHED_PIPE);
+}
+
+
+int pipe_read(void* this, char *buf, unsigned int size){
+	iovec_t iov = { .buf = buf, .size = size };
+	return pipe_readv(this, &iov, 1);
+}
+
+int pipe_readv(void* this, const iovec_t* iov, unsigned int iovcnt){
+pipe_cb *pp = (pipe_cb *)this;//create a pipe
 
 	int Bytes_Read = 0;
 
-	int elemInBuffer;
-	//reading until the given size
- 		if (pp->numOfElem < size){
- 			elemInBuffer = pp->numOfElem;
- 		}
- 		else{
-			elemInBuffer = size;
+	do{
+		//if pipe reader exists and if the buffer is below the low-watermark
+		while(pp->reader != NULL && pipe_fill(pp) < pp->lowat){
+			if(pp->writer == NULL){
+				// the end of the data is returned, however short
+				if(pipe_fill(pp) == 0) return 0;
+				break;
+			}
+
+			if(pipe_spin_wait(pp, 1, 1))
+				continue;
+
+			__atomic_add_fetch(&pp->readers_waiting, 1, __ATOMIC_SEQ_CST);
+			if(pipe_fill(pp) < pp->lowat)
+				pipe_sleep(pp, &pp->has_data); // make reader sleep
+			__atomic_sub_fetch(&pp->readers_waiting, 1, __ATOMIC_SEQ_CST);
 		}
 
-	// read the elements from pipe
-	for(int i=0; i<elemInBuffer; i++){
+		// checking if pipe reader exists after waiting 
+		if (pp->reader == NULL){
+			return -1;
+		}
 
-		buf[i] = pp->BUFFER[pp->r_position];
-		pp->r_position = (pp->r_position+1)%PIPE_BUFFER_SIZE; // matching the read position of the buffer
-		pp->numOfElem--;
-		Bytes_Read++;
-	}
+		// fill the segments in order, until the buffer is drained;
+		// a fast reader of another process may have drained it first
+		Bytes_Read = pipe_scatter(pp, iov, iovcnt);
+	} while(Bytes_Read == 0 && pipe_fill(pp) == 0);
 
-	// signal the writer after completing reading
-	kernel_signal(&pp->has_space);
+	if(Bytes_Read > 0)
+		pipe_mark(&pp->r_thread, &pp->r_core);
+
+	if(Bytes_Read > 0 && pipe_writers_need_wakeup(pp))
+		pipe_wake_writers(pp);
+
+	// pass the wakeup on to the next reader, if data is left
+	if(pipe_fill(pp) >= pp->lowat && pp->readers_waiting > 0)
+		kernel_signal(&pp->has_data);
 
 	return Bytes_Read;
 }
 
 int pipe_write(void* this, const char* buf, unsigned int size){
+	iovec_t iov = { .buf = (char*) buf, .size = size };
+	return pipe_writev(this, &iov, 1);
+}
+
+int pipe_writev(void* this, const iovec_t* iov, unsigned int iovcnt){
 
 	pipe_cb *pp = (pipe_cb *)this;
 
+	//the size of the written bytes
+	int Bytes_Written = 0;
 
-	//number free positions of the buffer 
-	int free_pos_buffer = PIPE_BUFFER_SIZE - pp->numOfElem;
+	// in packet mode, the whole record must fit
+	unsigned long len = iov_size(iov, iovcnt);
+	if(pp->packet && len > MAX_PACKET_SIZE){
+		return -1;
+	}
+	unsigned int need = pp->packet ? PIPE_RECORD_HEADER + len : 1;
+
+	do{
+		//if pipe reader exists and if there is not space in the buffer 
+		while(pp->writer != NULL && pp->reader != NULL && pipe_space(pp) < need){
+			if(pipe_spin_wait(pp, 0, need))
+				continue;
+
+			__atomic_add_fetch(&pp->writers_waiting, 1, __ATOMIC_SEQ_CST);
+			if(pipe_space(pp) < need)
+				kernel_wait(&pp->has_space, SCHED_PIPE); // writer goes to sleep 
+			__atomic_sub_fetch(&pp->writers_waiting, 1, __ATOMIC_SEQ_CST);
+		}
+
+		// check if pipe reader and writer are still effective after waiting 
+		if (pp->reader == NULL || pp->writer == NULL){
+			return -1;
+		}
 
-	//if pipe reader exists and if there is not space in the buffer 
-	while(pp->writer != NULL && pp->reader != NULL && free_pos_buffer == 0){
+		// drain the segments in order, until the buffer is full
+		Bytes_Written = pipe_gather(pp, iov, iovcnt, len);
+	} while(Bytes_Written == 0 && pipe_space(pp) < need);
 
-		kernel_signal(&pp->has_data); // signal the reader
-		kernel_wait(&pp->has_space, SCHED_PIPE); // writer goes to sleep 
-		free_pos_buffer = PIPE_BUFFER_SIZE-pp->numOfElem; // update the free positions of buffer after waiting
-	}
+	if(Bytes_Written > 0)
+		pipe_mark(&pp->w_thread, &pp->w_core);
+
+	if(Bytes_Written > 0 && pipe_readers_need_wakeup(pp))
+		pipe_wake_readers(pp);
 
-	// check if pipe reader and writer are still effective after waiting 
-	if (pp->reader == NULL || pp->writer == NULL){
+	// pass the wakeup on to the next writer, if space is left
+	if(pipe_space(pp) > 0 && pp->writers_waiting > 0)
+		kernel_signal(&pp->has_space);
+	
+	return Bytes_Written;
+}
+
+/*
+	The lock-free fast paths. They only move data when the ring is
+	not empty (full), and take the kernel lock only if the other end
+	has sleepers or watchers to wake up.
+ */
+int pipe_fast_read(void* this, char *buf, unsigned int size){
+	pipe_cb *pp = (pipe_cb *)this;
+
+	if(size == 0 || __atomic_test_and_set(&pp->r_lock, __ATOMIC_ACQUIRE))
 		return -1;
+
+	unsigned int n;
+	if(pp->packet){
+		iovec_t iov = { .buf = buf, .size = size };
+		n = pipe_get_record(pp, &iov, 1);
 	}
+	else{
+		n = pipe_fill(pp);
+		if(n > size) n = size;
+		if(n > 0)
+			pipe_copy_out(pp, buf, n);
+	}
+	Mutex_Unlock(&pp->r_lock);
 
-	//the size of the written bytes
-	int Bytes_Written = 0;
-	// checking not to write more than the given size
-	int bToWrite;
-	if (free_pos_buffer < size){
- 			 bToWrite = free_pos_buffer;
- 		}
- 		else{
-			bToWrite = size;
-		}
+	if(n == 0) return -1;
+	pipe_mark(&pp->r_thread, &pp->r_core);
+
+	if(pipe_writers_need_wakeup(pp)){
+		kernel_lock();
+		pipe_wake_writers(pp);
+		kernel_unlock();
+	}
+	return n;
+}
+
+int pipe_fast_write(void* this, const char* buf, unsigned int size){
+	pipe_cb *pp = (pipe_cb *)this;
 
-	// write the elements to the pipe
-	for(int j=0; j<bToWrite; j++){
+	// a closed reader is reported by the slow path
+	if(size == 0 || pp->reader == NULL
+		|| __atomic_test_and_set(&pp->w_lock, __ATOMIC_ACQUIRE))
+		return -1;
 
-		pp->BUFFER[pp->w_position] = buf[j];
-		pp->w_position = (pp->w_position+1)%PIPE_BUFFER_SIZE; // fixing the write position of circular buffer
-		pp->numOfElem++;
-		Bytes_Written++;		
+	unsigned int n;
+	if(pp->packet){
+		// oversized records are rejected by the slow path
+		iovec_t iov = { .buf = (char*) buf, .size = size };
+		n = (size <= MAX_PACKET_SIZE) ? pipe_put_record(pp, &iov, 1, size) : 0;
 	}
+	else{
+		n = pipe_space(pp);
+		if(n > size) n = size;
+		if(n > 0)
+			pipe_copy_in(pp, buf, n);
+	}
+	Mutex_Unlock(&pp->w_lock);
 
-	// signal the reader after completing the writing
-	kernel_signal(&pp->has_data);
-	
-	return Bytes_Written;
+	if(n == 0) return -1;
+	pipe_mark(&pp->w_thread, &pp->w_core);
+
+	if(pipe_readers_need_wakeup(pp)){
+		kernel_lock();
+		pipe_wake_readers(pp);
+		kernel_unlock();
+	}
+	return n;
 }
 
 int pipe_reader_close(void* this){
@@ -130,9 +552,10 @@ int pipe_reader_close(void* this){
 		pp->reader = NULL; // close the end of reader
 
 		if(pp->writer == NULL){ // case: end of writer is NULL 
-			free(pp); // free the pipe
+			pipe_release(pp); // free the pipe
 		}else{
 			kernel_broadcast(&pp->has_space); //signal the writer
+			stream_notify(&pp->writer->watchers);
 		}
 
 	}else{
@@ -149,9 +572,10 @@ int pipe_writer_close(void* this){
 		pp->writer = NULL;// close the end of writer
 
 		if(pp->reader == NULL){ // case: the end of reader is NULL 
-			free(pp); // free the  pipe
+			pipe_release(pp); // free the  pipe
 		}else{
 			kernel_broadcast(&pp->has_data); //signal the reader
+			stream_notify(&pp->reader->watchers);
 		}
 
 	}else{
@@ -160,8 +584,209 @@ int pipe_writer_close(void* this){
 
 	return 0;
 }
+int pipe_reader_poll(void* this, int events, stream_watch* watch){
+	pipe_cb *pp = (pipe_cb *)this;
+
+	if(watch != NULL){
+		stream_watch_add(&pp->reader->watchers, watch, NULL);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // pairs with pipe_readers_need_wakeup
+	}
+
+	int revents = 0;
+	if(pp->writer == NULL)
+		revents |= POLL_HANGUP | POLL_READ; // a read returns 0
+	if(pipe_fill(pp) >= pp->lowat)
+		revents |= POLL_READ;
+
+	return revents & (events | POLL_HANGUP | POLL_ERROR);
+}
+
+int pipe_writer_poll(void* this, int events, stream_watch* watch){
+	pipe_cb *pp = (pipe_cb *)this;
+
+	if(watch != NULL){
+		stream_watch_add(&pp->writer->watchers, watch, NULL);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // pairs with pipe_writers_need_wakeup
+	}
+
+	int revents = 0;
+	// in packet mode, a record of maximal size must fit
+	unsigned int need = pp->packet ? PIPE_RECORD_HEADER + MAX_PACKET_SIZE : 1;
+
+	if(pp->reader == NULL)
+		revents |= POLL_ERROR; // a write returns -1
+	else if(pipe_space(pp) >= need)
+		revents |= POLL_WRITE;
+
+	return revents & (events | POLL_HANGUP | POLL_ERROR);
+}
+
+pipe_cb* pipe_create(FCB* reader, FCB* writer, int flags){
+	pipe_cb *pp = slab_alloc(&pipe_cache);
+	pipe_init(pp, reader, writer, flags);
+	return pp;
+}
+
+void pipe_init(pipe_cb* pp, FCB* reader, FCB* writer, int flags){
+	//attach fcbs with pipe_cbs
+	pp->reader = reader;
+	pp->writer = writer;
+
+	// initialize the condition variables
+	pp->has_space = pp->has_data = COND_INIT;
+	pp->readers_waiting = pp->writers_waiting = 0;
+	pp->r_lock = pp->w_lock = MUTEX_INIT;
+	pp->packet = (flags & PACKET_MODE) != 0;
+	pp->w_position = pp->r_position = 0;
+	pp->r_thread = pp->w_thread = NULL;
+	pp->r_core = pp->w_core = 0;
+	pp->r_spin = pp->w_spin = 0;
+	pp->conn = NULL;
+	pp->size = PIPE_BUFFER_SIZE;
+	pp->buffer = pp->BUFFER;
+	pp->lowat = 1;
+	pp->coalesce = 0;
+}
+
+
+/*
+	Change the size of the ring to a power of 2, not less than the data
+	in it. The data is moved to the start of the new ring. The kernel
+	lock must be held. Return 0 on success, -1 if the data does not fit.
+ */
+int pipe_resize(pipe_cb* pp, unsigned int size){
+	assert(size > 0 && (size & (size-1)) == 0);
+
+	// exclude the fast paths
+	Mutex_Lock(&pp->r_lock);
+	Mutex_Lock(&pp->w_lock);
+
+	unsigned int fill = pipe_fill(pp);
+	if(fill > size){
+		Mutex_Unlock(&pp->w_lock);
+		Mutex_Unlock(&pp->r_lock);
+		return -1;
+	}
+
+	char *data = xmalloc(fill + 1);
+	ring_get(pp, pp->r_position, data, fill);
+
+	if(pp->buffer != pp->BUFFER)
+		free(pp->buffer);
+	pp->buffer = (size <= PIPE_BUFFER_SIZE) ? pp->BUFFER : xmalloc(size);
+	pp->size = size;
+
+	pp->r_position = 0;
+	pp->w_position = fill;
+	ring_put(pp, 0, data, fill);
+	free(data);
+
+	Mutex_Unlock(&pp->w_lock);
+	Mutex_Unlock(&pp->r_lock);
+
+	// the space may have grown
+	kernel_broadcast(&pp->has_space);
+	if(pp->writer != NULL)
+		stream_notify(&pp->writer->watchers);
+	return 0;
+}
+
+/*
+	Move up to len bytes from the ring of src to the ring of dst, with one
+	copy from ring to ring. The kernel lock must be held.
+
+	This blocks like a read of src and a write of dst, until len bytes are
+	moved, src falls below its low-watermark after some bytes were moved,
+	or src reaches the end of data. As with a read, the data of src is
+	taken once it reaches the low-watermark, or its writer is closed. Return the number of bytes moved,
+	0 at the end of data, -1 if an end is closed, or WOULDBLOCK if a
+	non-blocking end would block before any data is moved.
+ */
+int pipe_splice(pipe_cb *src, pipe_cb *dst, unsigned int len, int src_nonblocking, int dst_nonblocking){
+	assert(! src->packet && ! dst->packet && src != dst);
+
+	unsigned int moved = 0;
+	while(moved < len){
+		// wait for data, up to the low-watermark
+		while(src->reader != NULL && src->writer != NULL && pipe_fill(src) < src->lowat){
+			if(moved > 0)
+				return moved;	// as a read, return what is available
+			if(src_nonblocking)
+				return (moved > 0) ? (int) moved : WOULDBLOCK;
+			if(pipe_spin_wait(src, 1, 1))
+				continue;
+
+			__atomic_add_fetch(&src->readers_waiting, 1, __ATOMIC_SEQ_CST);
+			if(pipe_fill(src) < src->lowat)
+				pipe_sleep(src, &src->has_data);
+			__atomic_sub_fetch(&src->readers_waiting, 1, __ATOMIC_SEQ_CST);
+		}
+		if(src->reader == NULL)
+			return (moved > 0) ? (int) moved : -1;
+		if(pipe_fill(src) == 0)
+			break;	// the end of data
+
+		// wait for space
+		while(dst->reader != NULL && dst->writer != NULL && pipe_space(dst) == 0){
+			if(dst_nonblocking)
+				return (moved > 0) ? (int) moved : WOULDBLOCK;
+			if(pipe_spin_wait(dst, 0, 1))
+				continue;
+
+			__atomic_add_fetch(&dst->writers_waiting, 1, __ATOMIC_SEQ_CST);
+			if(pipe_space(dst) == 0)
+				kernel_wait(&dst->has_space, SCHED_PIPE);
+			__atomic_sub_fetch(&dst->writers_waiting, 1, __ATOMIC_SEQ_CST);
+		}
+		if(dst->reader == NULL || dst->writer == NULL)
+			return (moved > 0) ? (int) moved : -1;
+
+		// copy the readable part of the source ring, in at most two pieces
+		Mutex_Lock(&src->r_lock);
+		Mutex_Lock(&dst->w_lock);
+
+		unsigned int n = len - moved;
+		if(n > pipe_fill(src)) n = pipe_fill(src);
+		if(n > pipe_space(dst)) n = pipe_space(dst);
+
+		unsigned int r = src->r_position;
+		unsigned int pos = r & (src->size - 1);
+		unsigned int first = src->size - pos;
+		if(first > n) first = n;
+		pipe_copy_in(dst, src->buffer + pos, first);
+		pipe_copy_in(dst, src->buffer, n - first);
+		__atomic_store_n(&src->r_position, r + n, __ATOMIC_RELEASE);
+
+		Mutex_Unlock(&dst->w_lock);
+		Mutex_Unlock(&src->r_lock);
+
+		moved += n;
+		if(n == 0) continue;	// a fast path got there first
+
+		pipe_mark(&src->r_thread, &src->r_core);
+		pipe_mark(&dst->w_thread, &dst->w_core);
+		if(pipe_writers_need_wakeup(src))
+			pipe_wake_writers(src);
+		if(pipe_readers_need_wakeup(dst))
+			pipe_wake_readers(dst);
+	}
+
+	return moved;
+}
+
+
 int sys_Pipe(pipe_t* pipe)
 {
+	return sys_Pipe2(pipe, 0);
+}
+
+int sys_Pipe2(pipe_t* pipe, int flags)
+{
+	// only the known flags are legal
+	if((flags & ~PACKET_MODE) != 0){
+		return -1;
+	}
+
 	FCB *fcb[2];
 	Fid_t fid[2];
 	//use FCB_reserve function to reserve a fcb
@@ -176,15 +801,7 @@ int sys_Pipe(pipe_t* pipe)
 	  .write = fid[1]
 	};
 
-	pipe_cb *pp = xmalloc(sizeof(pipe_cb));
-
-	//attach fcbs with pipe_cbs
-	pp->reader = fcb[0];
-	pp->writer = fcb[1];
-
-	// initialize the condition variables
-	pp->has_space = pp->has_data = COND_INIT;
-	pp->w_position = pp->r_position = pp->numOfElem = 0;
+	pipe_cb *pp = pipe_create(fcb[0], fcb[1], flags);
 
 	// connect fcbs wiwth the pipe_cb
 	fcb[0]->streamobj = pp;
@@ -197,4 +814,3 @@ int sys_Pipe(pipe_t* pipe)
 	return 0;
 
 }
-
@@ -0,0 +1,116 @@
+
+#include "tinyos.h"
+#include "kernel_streams.h"
+#include "kernel_dev.h"
+#include "kernel_sched.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+
+/*
+	The Poll system call.
+
+	The polling thread registers one stream_watch with each polled
+	stream. Each stream notifies its watches when its readiness may
+	have changed, which wakes up the poller to scan the streams again.
+ */
+
+typedef struct poll_waiter {
+	CondVar ready;		/* the poller sleeps here */
+	int fired;			/* set by any notification */
+} poll_waiter;
+
+
+static void poll_notify(stream_watch* watch)
+{
+	poll_waiter* waiter = watch->owner;
+	waiter->fired = 1;
+	kernel_broadcast(&waiter->ready);
+}
+
+
+/* Scan all streams, registering the watches if watch!=NULL */
+static int poll_scan(pollfd_t* fds, unsigned int nfds, FCB** fcbs, stream_watch* watch)
+{
+	int count = 0;
+
+	for(unsigned int i=0; i<nfds; i++){
+		if(fcbs[i] == NULL) continue;
+
+		file_ops* fops = fcbs[i]->streamfunc;
+		if(fops->Poll)
+			fds[i].revents = fops->Poll(fcbs[i]->streamobj, fds[i].events,
+				(watch==NULL) ? NULL : &watch[i]);
+		else
+			fds[i].revents = fds[i].events & (POLL_READ|POLL_WRITE);
+
+		if(fds[i].revents) count++;
+	}
+
+	return count;
+}
+
+
+int sys_Poll(pollfd_t* fds, unsigned int nfds, timeout_t timeout)
+{
+	if(nfds>0 && fds==NULL) return -1;
+
+	FCB** fcbs = xmalloc((nfds+1)*sizeof(FCB*));
+	stream_watch* watch = xmalloc((nfds+1)*sizeof(stream_watch));
+
+	poll_waiter waiter = { .ready = COND_INIT, .fired = 0 };
+
+	/* Pin the streams, so that they are not closed while we poll */
+	int invalid = 0;
+	for(unsigned int i=0; i<nfds; i++){
+		fds[i].revents = 0;
+		fcbs[i] = NULL;
+
+		if(fds[i].fd == NOFILE) continue;
+
+		fcbs[i] = get_fcb(fds[i].fd);
+		if(fcbs[i] == NULL){
+			fds[i].revents = POLL_INVALID;
+			invalid++;
+			continue;
+		}
+
+		FCB_incref(fcbs[i]);
+		watch[i].notify = poll_notify;
+		watch[i].owner = &waiter;
+		watch[i].lock = NULL;
+	}
+
+	/* The first scan also registers the watches */
+	int count = poll_scan(fds, nfds, fcbs, watch) + invalid;
+
+	TimerDuration deadline = bios_clock() + 1000ul*timeout;
+
+	while(count == 0 && timeout != 0){
+		if(! waiter.fired){
+			TimerDuration t = NO_TIMEOUT;
+			if(timeout != (timeout_t)-1){
+				TimerDuration now = bios_clock();
+				if(now >= deadline) break;
+				t = deadline - now;
+			}
+			kernel_timedwait(&waiter.ready, SCHED_IO, t);
+			if(! waiter.fired) continue;
+		}
+
+		waiter.fired = 0;
+		count = poll_scan(fds, nfds, fcbs, NULL);
+	}
+
+	/* Clean up */
+	for(unsigned int i=0; i<nfds; i++){
+		if(fcbs[i] == NULL) continue;
+		if(fcbs[i]->streamfunc->Poll)
+			stream_unwatch(&watch[i]);
+		FCB_decref(fcbs[i]);
+	}
+
+	free(watch);
+	free(fcbs);
+
+	return count;
+}
@@ -39,8 +39,10 @@ static inline void initialize_PCB(PCB* pcb)
   pcb->argl = 0;
   pcb->args = NULL;
 
-  for(int i=0;i<MAX_FILEID;i++)
-    pcb->FIDT[i] = NULL;
+  pcb->FIDT = NULL;
+  pcb->fid_map = NULL;
+  pcb->fidt_size = 0;
+  pcb->fid_limit = MAX_FILEID;
 
   rlnode_init(& pcb->children_list, NULL);
   rlnode_init(& pcb->exited_list, NULL);
@@ -50,6 +52,13 @@ static inline void initialize_PCB(PCB* pcb)
 
   //initialize new field
   pcb->thread_count=0;
+
+  rlnode_init(& pcb->shm_list, NULL);
+
+  rlnode_init(& pcb->ioring_list, NULL);
+  pcb->ioring_workers = 0;
+
+  pcb->exit_hook = NULL;
 }
 
 
@@ -147,6 +156,7 @@ Pid_t sys_Exec(Task call, int argl, void* args)
     /* Processes with pid<=1 (the scheduler and the init process) 
        are parentless and are treated specially. */
     newproc->parent = NULL;
+    FIDT_init(newproc, FIDT_MIN_SIZE, MAX_FILEID);
   }
   else
   {
@@ -157,15 +167,15 @@ Pid_t sys_Exec(Task call, int argl, void* args)
     newproc->parent = curproc;
     rlist_push_front(& curproc->children_list, & newproc->children_node);
 
-    /* Inherit file streams from parent */
-    for(int i=0; i<MAX_FILEID; i++) {
-       newproc->FIDT[i] = curproc->FIDT[i];
-       if(newproc->FIDT[i])
-          FCB_incref(newproc->FIDT[i]);
-    }
+    /* Inherit file streams and the fid limit from parent */
+    FIDT_init(newproc, curproc->fidt_size, curproc->fid_limit);
+    FIDT_inherit(newproc, curproc);
   }
 
 
+  /* The hook of an earlier process with this PCB is not inherited */
+  newproc->exit_hook = NULL;
+
   /* Set the main thread's function */
   newproc->main_task = call;
 
@@ -344,6 +354,12 @@ void sys_Exit(int exitval)
 }
 
 
+void sys_SetExitHook(ExitHook hook)
+{
+  CURPROC->exit_hook = hook;
+}
+
+
 typedef struct procinfo_cb {
   procinfo info;
   PCB *cursor;
@@ -58,12 +58,24 @@ typedef struct process_control_block {
                              process terminates. It is used in the implementation of
                              @c WaitChild() */
 
-  FCB* FIDT[MAX_FILEID];  /**< @brief The fileid table of the process */
+  FCB** FIDT;             /**< @brief The fileid table of the process, 
+                             with @c fidt_size entries */
+  unsigned int fidt_size; /**< @brief The size of @c FIDT, grown on demand */
+  unsigned int fid_limit; /**< @brief The limit of fids, see @c SetFileLimit */
+  unsigned long* fid_map; /**< @brief Bitmap of the occupied entries of @c FIDT */
+  rlnode fidt_retired;    /**< @brief Tables replaced by larger ones, freed at exit */
 
 
   rlnode ptcb_list;
   int thread_count;
 
+  rlnode shm_list;        /**< @brief The shared memory attachments of the process */
+
+  rlnode ioring_list;     /**< @brief The I/O rings of the process, until cancelled */
+  int ioring_workers;     /**< @brief The threads of the process that are I/O ring workers */
+
+  ExitHook exit_hook;     /**< @brief Run by the last thread as it exits, see @c SetExitHook */
+
 
 } PCB;
 
@@ -0,0 +1,538 @@
+
+#include <string.h>
+#include "tinyos.h"
+#include "kernel_ramfs.h"
+#include "kernel_streams.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+
+/*
+	The in-memory file system.
+
+	Each file is an inode. A directory holds a list of entries, each
+	naming an inode. A regular file holds an array of extents, sorted by
+	offset, which cover the file from offset 0 up to its capacity. A file
+	grows by whole extents, each at least as large as the file (up to
+	RAMFS_MAX_EXTENT), so that a file of n pages has O(log n) extents.
+
+	The bytes between the size and the capacity of a file are always 0,
+	so that the gaps left by writes beyond the end read as zeros.
+
+	An inode is destroyed when it is in no directory and no stream has
+	it open. The extents of a mapped file are kept while the file is
+	open, even if it is emptied.
+
+	Everything is protected by the kernel lock.
+ */
+
+#define RAMFS_PAGE_SIZE SHM_PAGE_SIZE
+#define RAMFS_MAX_EXTENT (256*RAMFS_PAGE_SIZE)
+
+typedef struct ramfs_extent {
+	unsigned long offset;	/* the offset of the first byte in the file */
+	unsigned long size;		/* a multiple of RAMFS_PAGE_SIZE */
+	char* data;				/* page-aligned */
+} ramfs_extent;
+
+typedef struct ramfs_inode {
+	file_type type;
+	unsigned long ino;
+	unsigned int nlink;		/* the directory entries of this inode */
+	unsigned int opens;		/* the streams that have it open */
+	unsigned int maps;		/* the mappings made by these streams */
+
+	/* regular files */
+	unsigned long size;
+	unsigned long capacity;	/* the total size of the extents */
+	ramfs_extent* ext;
+	unsigned int n_ext, max_ext;
+
+	/* directories */
+	rlnode entries;
+	unsigned int n_entries;
+} ramfs_inode;
+
+typedef struct ramfs_dirent {
+	char name[MAX_FILE_NAME];
+	ramfs_inode* inode;
+	rlnode node;			/* node in the entries of the directory */
+} ramfs_dirent;
+
+typedef struct ramfs_file {
+	ramfs_inode* inode;
+	unsigned long pos;		/* the position, in bytes or directory entries */
+	int flags;				/* the open_flags */
+	unsigned int maps;		/* the mappings made through this stream */
+} ramfs_file;
+
+
+static ramfs_inode* ramfs_root = NULL;
+static unsigned long ramfs_next_ino;
+
+
+static ramfs_inode* inode_create(file_type type)
+{
+	ramfs_inode* inode = xmalloc(sizeof(ramfs_inode));
+	inode->type = type;
+	inode->ino = ramfs_next_ino++;
+	inode->nlink = inode->opens = inode->maps = 0;
+	inode->size = inode->capacity = 0;
+	inode->ext = NULL;
+	inode->n_ext = inode->max_ext = 0;
+	rlnode_init(&inode->entries, NULL);
+	inode->n_entries = 0;
+	return inode;
+}
+
+/* Free the extents of a regular file */
+static void inode_free_extents(ramfs_inode* inode)
+{
+	for(unsigned int i = 0; i < inode->n_ext; i++)
+		free(inode->ext[i].data);
+	free(inode->ext);
+	inode->ext = NULL;
+	inode->n_ext = inode->max_ext = 0;
+	inode->capacity = 0;
+}
+
+/* Destroy an inode that is in no directory and not open */
+static void inode_put(ramfs_inode* inode)
+{
+	if(inode->nlink > 0 || inode->opens > 0)
+		return;
+	inode_free_extents(inode);
+	free(inode);
+}
+
+/* Empty a regular file, keeping the extents if they are mapped */
+static void inode_truncate(ramfs_inode* inode)
+{
+	if(inode->maps == 0)
+		inode_free_extents(inode);
+	else
+		for(unsigned int i = 0; i < inode->n_ext; i++)
+			memset(inode->ext[i].data, 0, inode->ext[i].size);
+	inode->size = 0;
+}
+
+
+/* Add extents until the capacity reaches end. Return -1 if memory is exhausted. */
+static int inode_reserve(ramfs_inode* inode, unsigned long end)
+{
+	while(inode->capacity < end){
+		unsigned long need = end - inode->capacity;
+		unsigned long size = inode->capacity;
+		if(size < need) size = need;
+		if(size > RAMFS_MAX_EXTENT) size = RAMFS_MAX_EXTENT;
+		size = (size + RAMFS_PAGE_SIZE - 1) & ~(unsigned long)(RAMFS_PAGE_SIZE - 1);
+
+		char* data = aligned_alloc(RAMFS_PAGE_SIZE, size);
+		if(data == NULL)
+			return -1;
+		memset(data, 0, size);
+
+		if(inode->n_ext == inode->max_ext){
+			inode->max_ext = inode->max_ext ? 2*inode->max_ext : 4;
+			inode->ext = realloc(inode->ext, inode->max_ext * sizeof(ramfs_extent));
+		}
+		inode->ext[inode->n_ext++] = (ramfs_extent){
+			.offset = inode->capacity, .size = size, .data = data
+		};
+		inode->capacity += size;
+	}
+	return 0;
+}
+
+/* Return the extent holding offset, which is less than the capacity */
+static ramfs_extent* inode_extent(ramfs_inode* inode, unsigned long offset)
+{
+	unsigned int lo = 0, hi = inode->n_ext;
+	while(hi - lo > 1){
+		unsigned int mid = (lo + hi) / 2;
+		if(inode->ext[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &inode->ext[lo];
+}
+
+/* Copy n bytes at offset, between the file and buf, across extents */
+static void inode_copy(ramfs_inode* inode, unsigned long offset, char* buf, unsigned long n, int writing)
+{
+	while(n > 0){
+		ramfs_extent* ext = inode_extent(inode, offset);
+		unsigned long pos = offset - ext->offset;
+		unsigned long len = ext->size - pos;
+		if(len > n) len = n;
+
+		if(writing)
+			memcpy(ext->data + pos, buf, len);
+		else
+			memcpy(buf, ext->data + pos, len);
+
+		offset += len;
+		buf += len;
+		n -= len;
+	}
+}
+
+
+/* Find an entry of a directory by name, or NULL */
+static ramfs_dirent* dir_find(ramfs_inode* dir, const char* name)
+{
+	for(rlnode* p = dir->entries.next; p != &dir->entries; p = p->next){
+		ramfs_dirent* e = p->obj;
+		if(strcmp(e->name, name) == 0) return e;
+	}
+	return NULL;
+}
+
+static void dir_add(ramfs_inode* dir, const char* name, ramfs_inode* inode)
+{
+	ramfs_dirent* e = xmalloc(sizeof(ramfs_dirent));
+	strcpy(e->name, name);
+	e->inode = inode;
+	rlnode_init(&e->node, e);
+	rlist_push_back(&dir->entries, &e->node);
+	dir->n_entries++;
+	inode->nlink++;
+}
+
+static void dir_remove(ramfs_inode* dir, ramfs_dirent* e)
+{
+	ramfs_inode* inode = e->inode;
+	rlist_remove(&e->node);
+	dir->n_entries--;
+	free(e);
+
+	inode->nlink--;
+	inode_put(inode);
+}
+
+
+/*
+	Resolve a path. Return its inode, or NULL if it does not exist.
+	If the directory that would hold the last name exists, store it in
+	parent and the last name in name; else store NULL in parent. The
+	root has no parent.
+ */
+static ramfs_inode* ramfs_lookup(const char* path, ramfs_inode** parent, char* name)
+{
+	*parent = NULL;
+	name[0] = 0;
+	if(path == NULL || path[0] != '/' || strnlen(path, MAX_PATH_LENGTH) == MAX_PATH_LENGTH)
+		return NULL;
+
+	ramfs_inode* dir = NULL;
+	ramfs_inode* inode = ramfs_root;
+	const char* p = path;
+	while(1){
+		while(*p == '/') p++;
+		if(*p == 0) break;
+
+		size_t len = strcspn(p, "/");
+		if(inode == NULL || inode->type != FILE_DIRECTORY || len >= MAX_FILE_NAME)
+			return NULL;
+		memcpy(name, p, len);
+		name[len] = 0;
+		if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+			return NULL;
+
+		dir = inode;
+		ramfs_dirent* e = dir_find(dir, name);
+		inode = (e != NULL) ? e->inode : NULL;
+		p += len;
+	}
+
+	*parent = dir;
+	return inode;
+}
+
+
+static ramfs_file* ramfs_open_inode(ramfs_inode* inode, int flags)
+{
+	ramfs_file* f = xmalloc(sizeof(ramfs_file));
+	f->inode = inode;
+	f->pos = 0;
+	f->flags = flags;
+	f->maps = 0;
+	inode->opens++;
+	return f;
+}
+
+/* The device Open opens the root directory */
+static void* ramfs_open(uint minor)
+{
+	return ramfs_open_inode(ramfs_root, OPEN_READ);
+}
+
+static int ramfs_read(void* this, char* buf, unsigned int size)
+{
+	ramfs_file* f = (ramfs_file*) this;
+	ramfs_inode* inode = f->inode;
+
+	if(! (f->flags & OPEN_READ))
+		return -1;
+
+	if(inode->type == FILE_DIRECTORY){
+		/* whole records, from entry pos */
+		unsigned int count = size / sizeof(dirent_t);
+		if(count == 0) return -1;
+
+		rlnode* p = inode->entries.next;
+		for(unsigned long i = 0; i < f->pos && p != &inode->entries; i++)
+			p = p->next;
+
+		unsigned int n = 0;
+		for(; n < count && p != &inode->entries; n++, p = p->next){
+			ramfs_dirent* e = p->obj;
+			dirent_t d;
+			memset(&d, 0, sizeof(d));
+			strcpy(d.name, e->name);
+			d.type = e->inode->type;
+			memcpy(buf + n*sizeof(dirent_t), &d, sizeof(d));
+		}
+		f->pos += n;
+		return n * sizeof(dirent_t);
+	}
+
+	if(f->pos >= inode->size)
+		return 0;
+	unsigned long n = inode->size - f->pos;
+	if(n > size) n = size;
+
+	inode_copy(inode, f->pos, buf, n, 0);
+	f->pos += n;
+	return n;
+}
+
+static int ramfs_write(void* this, const char* buf, unsigned int size)
+{
+	ramfs_file* f = (ramfs_file*) this;
+	ramfs_inode* inode = f->inode;
+
+	if(! (f->flags & OPEN_WRITE))
+		return -1;
+
+	if(f->flags & OPEN_APPEND)
+		f->pos = inode->size;
+
+	/* the file does not grow beyond MAX_FILE_SIZE */
+	if(f->pos >= MAX_FILE_SIZE)
+		return (size == 0) ? 0 : -1;
+	unsigned long n = MAX_FILE_SIZE - f->pos;
+	if(n > size) n = size;
+
+	if(inode_reserve(inode, f->pos + n) == -1)
+		return -1;
+
+	inode_copy(inode, f->pos, (char*) buf, n, 1);
+	f->pos += n;
+	if(inode->size < f->pos)
+		inode->size = f->pos;
+	return n;
+}
+
+static int ramfs_close(void* this)
+{
+	ramfs_file* f = (ramfs_file*) this;
+	if(f == NULL) return -1;
+
+	ramfs_inode* inode = f->inode;
+	inode->maps -= f->maps;
+	inode->opens--;
+	inode_put(inode);
+	free(f);
+	return 0;
+}
+
+/* Files never block */
+static int ramfs_poll(void* this, int events, stream_watch* watch)
+{
+	return events & (POLL_READ | POLL_WRITE);
+}
+
+
+file_ops ramfs_fops = {
+	.Open = ramfs_open,
+	.Read = ramfs_read,
+	.Write = ramfs_write,
+	.Close = ramfs_close,
+	.Poll = ramfs_poll
+};
+
+
+void initialize_ramfs()
+{
+	ramfs_next_ino = 1;
+	ramfs_root = inode_create(FILE_DIRECTORY);
+	ramfs_root->nlink = 1;	/* the root is never destroyed */
+}
+
+/* Destroy a tree of inodes */
+static void ramfs_destroy(ramfs_inode* inode)
+{
+	while(! is_rlist_empty(&inode->entries)){
+		ramfs_dirent* e = rlist_pop_front(&inode->entries)->obj;
+		ramfs_destroy(e->inode);
+		free(e);
+	}
+	inode_free_extents(inode);
+	free(inode);
+}
+
+void finalize_ramfs()
+{
+	ramfs_destroy(ramfs_root);
+	ramfs_root = NULL;
+}
+
+
+/* Translate an fid to an open file, or NULL. The streams opened by
+   device_open use the copy of the ops in the device table. */
+static ramfs_file* get_ramfs_file(Fid_t fid)
+{
+	FCB* fcb = get_fcb(fid);
+	if(fcb == NULL || fcb->streamfunc->Close != ramfs_close)
+		return NULL;
+	return fcb->streamobj;
+}
+
+
+Fid_t sys_Open(const char* path, int flags)
+{
+	if((flags & OPEN_RDWR) == 0 || (flags & ~(OPEN_RDWR|OPEN_CREATE|OPEN_EXCL|OPEN_TRUNCATE|OPEN_APPEND)) != 0)
+		return NOFILE;
+
+	ramfs_inode* parent;
+	char name[MAX_FILE_NAME];
+	ramfs_inode* inode = ramfs_lookup(path, &parent, name);
+
+	if(inode == NULL){
+		if(! (flags & OPEN_CREATE) || parent == NULL)
+			return NOFILE;
+	}
+	else if((flags & OPEN_CREATE) && (flags & OPEN_EXCL))
+		return NOFILE;
+	else if(inode->type == FILE_DIRECTORY && (flags & OPEN_WRITE))
+		return NOFILE;
+
+	Fid_t fid;
+	FCB* fcb;
+	if(FCB_reserve(1, &fid, &fcb) == 0)
+		return NOFILE;
+
+	if(inode == NULL){
+		inode = inode_create(FILE_REGULAR);
+		dir_add(parent, name, inode);
+	}
+	else if(inode->type == FILE_REGULAR && (flags & OPEN_WRITE) && (flags & OPEN_TRUNCATE))
+		inode_truncate(inode);
+
+	fcb->streamobj = ramfs_open_inode(inode, flags);
+	fcb->streamfunc = &ramfs_fops;
+	return fid;
+}
+
+
+long sys_Seek(Fid_t fd, long offset, seek_origin whence)
+{
+	ramfs_file* f = get_ramfs_file(fd);
+	if(f == NULL) return -1;
+
+	ramfs_inode* inode = f->inode;
+	long base;
+	switch(whence){
+		case SEEK_FROM_START: base = 0; break;
+		case SEEK_FROM_CURRENT: base = f->pos; break;
+		case SEEK_FROM_END:
+			base = (inode->type == FILE_DIRECTORY) ? inode->n_entries : inode->size;
+			break;
+		default:
+			return -1;
+	}
+
+	long pos = base + offset;
+	if(pos < 0 || (unsigned long) pos > MAX_FILE_SIZE)
+		return -1;
+
+	f->pos = pos;
+	return pos;
+}
+
+
+int sys_Stat(const char* path, stat_t* st)
+{
+	ramfs_inode* parent;
+	char name[MAX_FILE_NAME];
+	ramfs_inode* inode = ramfs_lookup(path, &parent, name);
+	if(inode == NULL || st == NULL)
+		return -1;
+
+	st->type = inode->type;
+	st->ino = inode->ino;
+	st->size = (inode->type == FILE_DIRECTORY) ? inode->n_entries : inode->size;
+	return 0;
+}
+
+
+int sys_MkDir(const char* path)
+{
+	ramfs_inode* parent;
+	char name[MAX_FILE_NAME];
+	if(ramfs_lookup(path, &parent, name) != NULL || parent == NULL)
+		return -1;
+
+	dir_add(parent, name, inode_create(FILE_DIRECTORY));
+	return 0;
+}
+
+
+int sys_RmDir(const char* path)
+{
+	ramfs_inode* parent;
+	char name[MAX_FILE_NAME];
+	ramfs_inode* inode = ramfs_lookup(path, &parent, name);
+	if(inode == NULL || parent == NULL || inode->type != FILE_DIRECTORY
+		|| ! is_rlist_empty(&inode->entries))
+		return -1;
+
+	dir_remove(parent, dir_find(parent, name));
+	return 0;
+}
+
+
+int sys_Unlink(const char* path)
+{
+	ramfs_inode* parent;
+	char name[MAX_FILE_NAME];
+	ramfs_inode* inode = ramfs_lookup(path, &parent, name);
+	if(inode == NULL || inode->type != FILE_REGULAR)
+		return -1;
+
+	dir_remove(parent, dir_find(parent, name));
+	return 0;
+}
+
+
+void* sys_MapFile(Fid_t fd, unsigned long offset, unsigned int* size)
+{
+	ramfs_file* f = get_ramfs_file(fd);
+	if(f == NULL || size == NULL)
+		return NULL;
+
+	ramfs_inode* inode = f->inode;
+	if(inode->type != FILE_REGULAR || offset >= inode->size)
+		return NULL;
+
+	/* the rest of the extent, up to the end of the file */
+	ramfs_extent* ext = inode_extent(inode, offset);
+	unsigned long end = ext->offset + ext->size;
+	if(end > inode->size) end = inode->size;
+	*size = end - offset;
+
+	f->maps++;
+	inode->maps++;
+	return ext->data + (offset - ext->offset);
+}
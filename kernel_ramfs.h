@@ -0,0 +1,45 @@
+#ifndef __KERNEL_RAMFS_H
+#define __KERNEL_RAMFS_H
+
+/**
+  @file kernel_ramfs.h
+  @brief The in-memory file system.
+
+  @defgroup ramfs File system
+  @ingroup kernel
+  @brief The in-memory file system.
+
+  The file system is a tree of directories and regular files, kept in
+  memory. The contents of a regular file are stored in extents of whole,
+  page-aligned pages, which are never moved, so that they can be mapped
+  by @c MapFile.
+
+  Open files are streams of device @c DEV_RAMFS. Opening its only minor
+  number opens the root directory; other files are opened by @c Open.
+
+  @{
+*/
+
+#include "tinyos.h"
+#include "kernel_dev.h"
+
+/** @brief The file operations of open files. */
+extern file_ops ramfs_fops;
+
+/**
+  @brief Initialization for the file system.
+
+  This function is called at kernel startup, and creates an empty root.
+ */
+void initialize_ramfs();
+
+/**
+  @brief Destroy the file system.
+
+  This function is called when TinyOS halts, after all files are closed.
+ */
+void finalize_ramfs();
+
+/** @} */
+
+#endif
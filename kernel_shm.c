@@ -0,0 +1,150 @@
+
+#include <string.h>
+#include "tinyos.h"
+#include "kernel_shm.h"
+#include "kernel_proc.h"
+#include "kernel_cc.h"
+
+/*
+	Shared memory regions.
+
+	The regions are kept in a global list, searched by name. Each
+	attachment of a process is a shm_attachment in the shm_list of
+	the PCB, holding a reference to the region.
+ */
+
+typedef struct shm_control_block {
+	char name[MAX_SHM_NAME];	/* the name of the region */
+	void* addr;					/* the page-aligned buffer */
+	unsigned int size;			/* the size of the buffer, a multiple of SHM_PAGE_SIZE */
+	uint refcount;				/* the number of attachments */
+	rlnode node;				/* node in the region list */
+} shm_cb;
+
+typedef struct shm_attachment {
+	shm_cb* shm;				/* the attached region */
+	rlnode node;				/* node in the shm_list of the PCB */
+} shm_attachment;
+
+
+static rlnode shm_regions;
+
+
+void initialize_shm()
+{
+	rlnode_init(&shm_regions, NULL);
+}
+
+
+/* Return 1 if name is a legal region name */
+static int shm_legal_name(const char* name)
+{
+	if(name == NULL) return 0;
+	size_t len = strnlen(name, MAX_SHM_NAME);
+	return len > 0 && len < MAX_SHM_NAME;
+}
+
+/* Find a region by name, or NULL */
+static shm_cb* shm_find(const char* name)
+{
+	for(rlnode* p = shm_regions.next; p != &shm_regions; p = p->next){
+		shm_cb* shm = p->obj;
+		if(strcmp(shm->name, name) == 0) return shm;
+	}
+	return NULL;
+}
+
+/* Add an attachment of the region to the current process */
+static void* shm_attach(shm_cb* shm)
+{
+	shm_attachment* att = xmalloc(sizeof(shm_attachment));
+	att->shm = shm;
+	rlnode_init(&att->node, att);
+	rlist_push_back(&CURPROC->shm_list, &att->node);
+
+	shm->refcount++;
+	return shm->addr;
+}
+
+/* Remove an attachment, destroying the region with the last one */
+static void shm_detach(shm_attachment* att)
+{
+	shm_cb* shm = att->shm;
+
+	rlist_remove(&att->node);
+	free(att);
+
+	shm->refcount--;
+	if(shm->refcount == 0){
+		rlist_remove(&shm->node);
+		free(shm->addr);
+		free(shm);
+	}
+}
+
+
+void* sys_ShmCreate(const char* name, unsigned int size)
+{
+	if(! shm_legal_name(name) || size == 0 || size > MAX_SHM_SIZE)
+		return NULL;
+
+	if(shm_find(name) != NULL)
+		return NULL;
+
+	/* Round up to whole pages */
+	size = (size + SHM_PAGE_SIZE - 1) & ~(SHM_PAGE_SIZE - 1);
+
+	void* addr = aligned_alloc(SHM_PAGE_SIZE, size);
+	if(addr == NULL)
+		return NULL;
+	memset(addr, 0, size);
+
+	shm_cb* shm = xmalloc(sizeof(shm_cb));
+	strcpy(shm->name, name);
+	shm->addr = addr;
+	shm->size = size;
+	shm->refcount = 0;
+	rlnode_init(&shm->node, shm);
+	rlist_push_back(&shm_regions, &shm->node);
+
+	return shm_attach(shm);
+}
+
+
+void* sys_ShmAttach(const char* name, unsigned int* size)
+{
+	if(! shm_legal_name(name))
+		return NULL;
+
+	shm_cb* shm = shm_find(name);
+	if(shm == NULL)
+		return NULL;
+
+	if(size != NULL)
+		*size = shm->size;
+
+	return shm_attach(shm);
+}
+
+
+int sys_ShmRelease(void* addr)
+{
+	rlnode* list = &CURPROC->shm_list;
+
+	for(rlnode* p = list->next; p != list; p = p->next){
+		shm_attachment* att = p->obj;
+		if(att->shm->addr == addr){
+			shm_detach(att);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+void shm_release_all(PCB* pcb)
+{
+	while(! is_rlist_empty(&pcb->shm_list))
+		shm_detach(pcb->shm_list.next->obj);
+}
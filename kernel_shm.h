@@ -0,0 +1,43 @@
+#ifndef __KERNEL_SHM_H
+#define __KERNEL_SHM_H
+
+/**
+  @file kernel_shm.h
+  @brief Named shared memory regions.
+
+  @defgroup shm Shared memory
+  @ingroup kernel
+  @brief Named shared memory regions.
+
+  A shared memory region is a named, page-aligned buffer. Since all
+  processes share one address space, a region has the same address
+  in every process that attaches it.
+
+  Regions are reference-counted: each attachment of a process holds
+  one reference, and is recorded in the @c shm_list of its PCB. A region
+  is destroyed, and its name becomes free, when its last attachment is
+  released.
+
+  @{
+*/
+
+#include "tinyos.h"
+#include "kernel_proc.h"
+
+/**
+  @brief Initialization for shared memory.
+
+  This function is called at kernel startup.
+ */
+void initialize_shm();
+
+/**
+  @brief Release all the shared memory attachments of a process.
+
+  This is called when the process exits.
+ */
+void shm_release_all(PCB* pcb);
+
+/** @} */
+
+#endif
@@ -4,13 +4,244 @@
 #include "kernel_sched.h"
 #include "kernel_proc.h"
 #include "kernel_cc.h"
+#include "kernel_gateway.h"
+
+/*
+	The port table holds the group of every port in use, hashed by port.
+	The connection table holds the peer sockets whose both ends are bound,
+	hashed by their (local, remote) pair of ports.
+ */
+#define PORT_HASH_SIZE 256
+#define CONN_HASH_SIZE 1024
+
+static rlnode PORT_TABLE[PORT_HASH_SIZE];
+static rlnode CONN_TABLE[CONN_HASH_SIZE];
+
+static port_t next_ephemeral = MIN_EPHEMERAL_PORT; // where the search for a free port starts
+
+/* a queued datagram */
+typedef struct datagram {
+	rlnode node;			// node in the queue of the receiver
+	port_t from;			// the port of the sender
+	unsigned int size;		// the size of data
+	char data[];
+} datagram;
+
+/* forward */
+int socket_readv(void* this, const iovec_t* iov, unsigned int iovcnt);
+int socket_writev(void* this, const iovec_t* iov, unsigned int iovcnt);
+int socket_poll(void* this, int events, stream_watch* watch);
+
+
+/*
+	Sockets, connection requests and connections are recycled through
+	slab caches, so that a connect/accept/close cycle does not call malloc.
+ */
+static slab_cache socket_cache = SLAB_CACHE_INIT(socket_cache, socket_cb, 32);
+static slab_cache request_cache = SLAB_CACHE_INIT(request_cache, connection_request, 32);
+static slab_cache connection_cache = SLAB_CACHE_INIT(connection_cache, connection_cb, 2);
+
+void connection_release(connection_cb* conn)
+{
+	conn->pipes_open--;
+	if(conn->pipes_open == 0)
+		slab_free(&connection_cache, conn);
+}
+
+/* release a reference to a socket, freeing it with the last one */
+static void socket_decref(socket_cb* scb)
+{
+	scb->refcount--;
+	if(scb->refcount == 0)
+		slab_free(&socket_cache, scb);
+}
+
+void initialize_sockets()
+{
+	next_ephemeral = MIN_EPHEMERAL_PORT;
+	for(int i = 0; i < PORT_HASH_SIZE; i++)
+		rlnode_init(&PORT_TABLE[i], NULL);
+	for(int i = 0; i < CONN_HASH_SIZE; i++)
+		rlnode_init(&CONN_TABLE[i], NULL);
+}
+
+/* the group of a port, or NULL if the port is not in use */
+static port_group* port_lookup(port_t port)
+{
+	rlnode *bucket = &PORT_TABLE[port % PORT_HASH_SIZE];
+	for(rlnode* p = bucket->next; p != bucket; p = p->next){
+		port_group *group = p->obj;
+		if(group->port == port)
+			return group;
+	}
+	return NULL;
+}
+
+/* bind one more socket to a port, creating its group if needed */
+static port_group* port_group_get(port_t port)
+{
+	port_group *group = port_lookup(port);
+	if(group == NULL){
+		group = xmalloc(sizeof(port_group));
+		group->port = port;
+		group->sockets = 0;
+		rlnode_init(&group->listeners, NULL);
+		group->flags = 0;
+		group->datagram = NULL;
+		rlnode_init(&group->hash_node, group);
+		rlist_push_front(&PORT_TABLE[port % PORT_HASH_SIZE], &group->hash_node);
+	}
+	group->sockets++;
+	return group;
+}
+
+/* unbind a socket from a port, releasing the group with the last one */
+static void port_group_put(port_t port)
+{
+	port_group *group = port_lookup(port);
+	group->sockets--;
+	if(group->sockets == 0){
+		rlist_remove(&group->hash_node);
+		free(group);
+	}
+}
+
+/* find a port that is not in use, from the ephemeral range, or NOPORT */
+static port_t port_ephemeral()
+{
+	for(int i = MIN_EPHEMERAL_PORT; i <= MAX_PORT; i++){
+		port_t port = next_ephemeral;
+		next_ephemeral = (port == MAX_PORT) ? MIN_EPHEMERAL_PORT : port + 1;
+		if(port_lookup(port) == NULL)
+			return port;
+	}
+	return NOPORT;
+}
+
+static inline rlnode* connection_bucket(port_t local, port_t remote)
+{
+	return &CONN_TABLE[((unsigned int)local * 31 + (unsigned int)remote) % CONN_HASH_SIZE];
+}
+
+/* the connected socket with the given ports, or NULL */
+static socket_cb* connection_lookup(port_t local, port_t remote)
+{
+	rlnode *bucket = connection_bucket(local, remote);
+	for(rlnode* p = bucket->next; p != bucket; p = p->next){
+		socket_cb *scb = p->obj;
+		if(scb->port == local && scb->peer_s.peer_port == remote)
+			return scb;
+	}
+	return NULL;
+}
+
+/*
+	The listener of a port with the fewest pending requests, among those
+	whose backlog is not full, or NULL. The first one wins a tie.
+ */
+static socket_cb* port_least_loaded(port_group* group)
+{
+	socket_cb* best = NULL;
+	for(rlnode* p = group->listeners.next; p != &group->listeners; p = p->next){
+		socket_cb* lsock = p->obj;
+		if(lsock->listener_s.pending >= lsock->listener_s.backlog)
+			continue;
+		if(best == NULL || lsock->listener_s.pending < best->listener_s.pending)
+			best = lsock;
+	}
+	return best;
+}
+
+/*
+	Pick the least loaded listener of a port, or return NULL. Ties are
+	broken round-robin, by moving the chosen listener to the back of the
+	list, so a caller picks only once it is sure to queue a request.
+ */
+static socket_cb* port_pick_listener(port_group* group)
+{
+	socket_cb* best = port_least_loaded(group);
+
+	if(best == NULL)
+		return NULL;
+
+	rlist_remove(&best->listener_s.port_node);
+	rlist_push_back(&group->listeners, &best->listener_s.port_node);
+	return best;
+}
+
+/* add a connection request to the queue of a listener */
+static void listener_enqueue(socket_cb* lsock, connection_request* request)
+{
+	request->listener = lsock;
+	rlist_push_back(&lsock->listener_s.queue, &request->queue_node);
+	lsock->listener_s.pending++;
+
+	// signal that this request is waiting ready
+	kernel_signal(&lsock->listener_s.req_available);
+	stream_notify(&lsock->fcb->watchers);
+}
+
+
+/*
+	Queue the pending host connections of a gateway port to its listeners,
+	as far as their backlogs allow. Host connections are streams, so they
+	are left pending on a packet-mode port.
+ */
+static void port_pull_gateway(port_t port)
+{
+	port_group *group = port_lookup(port);
+
+	if(group == NULL || (group->flags & PACKET_MODE)){
+		return;
+	}
+
+	while(1){
+		// pick the listener first, so that full backlogs leave the connections to the host
+		socket_cb *lsock = port_pick_listener(group);
+		if(lsock == NULL){
+			return;
+		}
+
+		int channel = gateway_accept(port);
+		if(channel == -1){
+			return;
+		}
+
+		connection_request *request = slab_alloc(&request_cache);
+		request->admitted = 0;
+		request->peer = NULL;
+		request->channel = channel;
+		request->connected_cv = COND_INIT;
+		rlnode_init(&request->queue_node, request);
+
+		listener_enqueue(lsock, request);
+	}
+}
+
+/* the gateway interrupt wakes up the threads waiting on the listener */
+static void listener_gateway_notify(stream_watch* watch)
+{
+	socket_cb *scb = watch->owner;
+	kernel_broadcast(&scb->listener_s.req_available);
+}
 
-socket_cb *PORT_MAP[MAX_PORT+1] = {NULL}; // make the port map for SCBs
 
 int socket_read(void* this, char *buf, unsigned int size){
+	iovec_t iov = { .buf = buf, .size = size };
+	return socket_readv(this, &iov, 1);
+}
+
+int socket_readv(void* this, const iovec_t* iov, unsigned int iovcnt){
 	
 	socket_cb *scb = (socket_cb *)this;
 
+	if(scb->type == SOCKET_GATEWAY){
+		if(scb->gateway_s.read_shut){
+			return -1;
+		}
+		return gateway_readv(scb->gateway_s.channel, iov, iovcnt, scb->fcb->nonblocking);
+	}
+
 	socket_cb *peer_scb = scb->peer_s.peer; // create the peer socket
 
 	if(scb->type != SOCKET_PEER){
@@ -23,18 +254,30 @@ int socket_read(void* this, char *buf, unsigned int size){
 	}
 
 	//  if the writer is closed and there is no more data in pipe
-	if (peer_scb->peer_s.write_pipe == NULL && scb->peer_s.read_pipe->numOfElem == 0){ 
+	if (peer_scb->peer_s.write_pipe == NULL && pipe_fill(scb->peer_s.read_pipe) == 0){ 
 		return 0; 
 	}
 
 	// read from pipe
-	return pipe_read(scb->peer_s.read_pipe, buf, size);  
+	return pipe_readv(scb->peer_s.read_pipe, iov, iovcnt);  
 }
 
 int socket_write(void* this, const char *buf, unsigned int size){
+	iovec_t iov = { .buf = (char*) buf, .size = size };
+	return socket_writev(this, &iov, 1);
+}
+
+int socket_writev(void* this, const iovec_t* iov, unsigned int iovcnt){
 	
 	socket_cb *scb = (socket_cb *)this;
 
+	if(scb->type == SOCKET_GATEWAY){
+		if(scb->gateway_s.write_shut){
+			return -1;
+		}
+		return gateway_writev(scb->gateway_s.channel, iov, iovcnt, scb->fcb->nonblocking);
+	}
+
 	socket_cb *peer_scb = scb->peer_s.peer; // create the peer socket
 
 	if(scb->type != SOCKET_PEER){
@@ -51,7 +294,7 @@ int socket_write(void* this, const char *buf, unsigned int size){
 		return -1;
 	}
 
- 	return pipe_write(scb->peer_s.write_pipe, buf, size);
+ 	return pipe_writev(scb->peer_s.write_pipe, iov, iovcnt);
 }
 
 
@@ -64,20 +307,57 @@ int socket_close(void* this){
 			//close reader and writer
 			pipe_reader_close(scb->peer_s.read_pipe);
 			pipe_writer_close(scb->peer_s.write_pipe);
+			rlist_remove(&scb->peer_s.conn_node);
+
+		}else if(scb->type == SOCKET_GATEWAY){
+			gateway_close(scb->gateway_s.channel);
 
 		}else if(scb->type == SOCKET_LISTENER){
-			// release its port map position
-			PORT_MAP[scb->port] = NULL;
-			
+			// leave the port
+			port_group *group = port_lookup(scb->port);
+			rlist_remove(&scb->listener_s.port_node);
+			if(scb->listener_s.gateway){
+				stream_unwatch(&scb->listener_s.gateway_watch);
+			}
+
+			// the pending requests move to the other listeners, or are refused
+			while(! is_rlist_empty(&scb->listener_s.queue)){
+				connection_request *request = rlist_pop_front(&scb->listener_s.queue)->obj;
+				socket_cb *other = port_pick_listener(group);
+				if(other == NULL && request->peer == NULL){
+					// nobody waits for a host connection; just close it
+					gateway_close(request->channel);
+					slab_free(&request_cache, request);
+				}else if(other == NULL){
+					request->admitted = -1;
+					kernel_signal(&request->connected_cv);
+				}else{
+					listener_enqueue(other, request);
+				}
+			}
+			scb->listener_s.pending = 0;
+
 			// wake up every thread which is waiting before lisnener close
-			CondVar *request_avail = &(scb->listener_s.req_available);
-			
-			// signal all the waiting threads
-			kernel_broadcast(request_avail);
+			scb->listener_s.closed = 1;
+			kernel_broadcast(&scb->listener_s.req_available);
+
+		}else if(scb->type == SOCKET_DATAGRAM){
+			// drop the queued datagrams, and leave the port
+			while(! is_rlist_empty(&scb->datagram_s.queue)){
+				free(rlist_pop_front(&scb->datagram_s.queue)->obj);
+			}
+			if(scb->port != NOPORT){
+				port_lookup(scb->port)->datagram = NULL;
+			}
+		}
+
+		// release the port, with the last socket bound to it
+		if(scb->port != NOPORT){
+			port_group_put(scb->port);
 		}
 
-		// free the socket
-		free(scb);
+		// free the socket, unless Accept or Connect still use it
+		socket_decref(scb);
 		
 		return 0;
 
@@ -87,21 +367,170 @@ int socket_close(void* this){
 }
 
 
+// the pipe a read (write) of a peer socket goes through, for CopyStream
+static pipe_cb* socket_get_pipe(void* this, int reading){
+	socket_cb *scb = (socket_cb *)this;
+
+	if(scb->type != SOCKET_PEER){
+		return NULL;
+	}
+
+	pipe_cb *pp = reading ? scb->peer_s.read_pipe : scb->peer_s.write_pipe;
+	return (pp != NULL && ! pp->packet) ? pp : NULL;
+}
+
 file_ops socket_file_ops = {
   .Open = null_open,
   .Read = socket_read,
   .Write = socket_write,
-  .Close = socket_close
+  .Close = socket_close,
+  .ReadV = socket_readv,
+  .WriteV = socket_writev,
+  .Poll = socket_poll,
+  .GetPipe = socket_get_pipe
 };
 
 
+int socket_poll(void* this, int events, stream_watch* watch){
+	socket_cb *scb = (socket_cb *)this;
+
+	// peers are notified through their pipes, listeners by Connect, gateways by interrupts
+	if(watch != NULL && scb->type != SOCKET_GATEWAY)
+		stream_watch_add(&scb->fcb->watchers, watch, NULL);
+
+	int revents = 0;
+	switch(scb->type){
+		case SOCKET_LISTENER:
+			if(scb->listener_s.gateway)
+				port_pull_gateway(scb->port);
+
+			// an Accept will not block
+			if(! is_rlist_empty(&scb->listener_s.queue))
+				revents |= POLL_READ;
+			break;
+
+		case SOCKET_UNBOUND:
+			revents |= POLL_ERROR;
+			break;
+
+		case SOCKET_DATAGRAM:
+			// a RecvFrom will not block, a SendTo never does
+			if(! is_rlist_empty(&scb->datagram_s.queue))
+				revents |= POLL_READ;
+			revents |= POLL_WRITE;
+			break;
+
+		case SOCKET_PEER:
+			// report errors only for the requested directions
+			if(events & POLL_READ){
+				if(scb->peer_s.read_pipe != NULL)
+					revents |= pipe_reader_poll(scb->peer_s.read_pipe, POLL_READ, NULL);
+				else
+					revents |= POLL_ERROR;
+			}
+
+			if(events & POLL_WRITE){
+				if(scb->peer_s.write_pipe != NULL)
+					revents |= pipe_writer_poll(scb->peer_s.write_pipe, POLL_WRITE, NULL);
+				else
+					revents |= POLL_ERROR;
+			}
+			break;
+
+		case SOCKET_GATEWAY:
+			revents |= gateway_poll(scb->gateway_s.channel, events, watch);
+			if(((events & POLL_READ) && scb->gateway_s.read_shut)
+				|| ((events & POLL_WRITE) && scb->gateway_s.write_shut))
+				revents |= POLL_ERROR;
+			break;
+	}
+
+	return revents & (events | POLL_HANGUP | POLL_ERROR);
+}
+
+
+/* create an unbound socket as the stream of fcb */
+static socket_cb* socket_create(FCB* fcb, port_t port, int flags)
+{
+	// initialize scb
+	socket_cb *scb = (socket_cb*)slab_alloc(&socket_cache);
+	scb->refcount = 1;
+	scb->fcb = fcb;
+	scb->type = SOCKET_UNBOUND;
+	scb->port = port;
+	scb->flags = flags;
+	rlnode_init(&scb->unbound_s.unbound_socket, scb);
+	if(port != NOPORT){
+		port_group_get(port);
+	}
+	
+	// connect fcb with socket blocks
+	fcb->streamobj = scb; 
+	fcb->streamfunc = &socket_file_ops;
+
+	return scb;
+}
+
+/* make two sockets peers, connected by two pipes */
+static void socket_connect_peers(socket_cb *client, socket_cb *server, int flags)
+{
+	// connect the peers
+	server->type = SOCKET_PEER;
+	client->type = SOCKET_PEER;
+	server->peer_s.peer = client;
+	client->peer_s.peer = server; 
+
+	// create two pipes in one connection, connecting the fcbs with each pipe
+	connection_cb *conn = slab_alloc(&connection_cache);
+	pipe_cb *pipe1 = &conn->pipe[0];
+	pipe_cb *pipe2 = &conn->pipe[1];
+	pipe_init(pipe1, client->fcb, server->fcb, flags);
+	pipe_init(pipe2, server->fcb, client->fcb, flags);
+	pipe1->conn = pipe2->conn = conn;
+	conn->pipes_open = 2;
+
+	// connect the sockets with the pipes
+	client->peer_s.read_pipe = pipe1;
+	server->peer_s.write_pipe = pipe1;
+	client->peer_s.write_pipe = pipe2;
+	server->peer_s.read_pipe = pipe2;
+
+	// sockets bound at both ends enter the connection table
+	client->peer_s.peer_port = server->port;
+	server->peer_s.peer_port = client->port;
+	rlnode_init(&client->peer_s.conn_node, client);
+	rlnode_init(&server->peer_s.conn_node, server);
+	if(client->port != NOPORT && server->port != NOPORT){
+		rlist_push_front(connection_bucket(client->port, server->port), &client->peer_s.conn_node);
+		rlist_push_front(connection_bucket(server->port, client->port), &server->peer_s.conn_node);
+	}
+}
+
+
 Fid_t sys_Socket(port_t port)
+{
+	return sys_Socket2(port, 0);
+}
+
+Fid_t sys_Socket2(port_t port, int flags)
 {
 	// port moves between 0 and MAX_PORT
 	if(port < NOPORT || port > MAX_PORT){ 
 		return NOFILE;
 	}
 
+	// only the known flags are legal, and datagram sockets take no other flags
+	if((flags & ~(PACKET_MODE|REUSE_PORT|DATAGRAM)) != 0
+		|| ((flags & DATAGRAM) && flags != DATAGRAM)){
+		return NOFILE;
+	}
+
+	// a port has one datagram socket
+	if((flags & DATAGRAM) && port != NOPORT
+		&& port_lookup(port) != NULL && port_lookup(port)->datagram != NULL){
+		return NOFILE;
+	}
+
 	Fid_t fid[1];
 	FCB *fcb[1];
 
@@ -110,41 +539,70 @@ Fid_t sys_Socket(port_t port)
 		return NOFILE; 
 	}
 	
-	// initialize scb
-	socket_cb *scb = (socket_cb*)xmalloc(sizeof(socket_cb));
-	scb->refcount = 1;
-	scb->fcb = fcb[0];
-	scb->type = SOCKET_UNBOUND;
-	scb->port = port;
-	rlnode_init(&scb->unbound_s.unbound_socket, scb);
-	
-	// connect fcb with socket blocks
-	fcb[0]->streamobj = scb; 
-	fcb[0]->streamfunc = &socket_file_ops;
-
+	socket_cb *scb = socket_create(fcb[0], port, flags);
+
+	// datagram sockets are bound at once
+	if(flags & DATAGRAM){
+		scb->type = SOCKET_DATAGRAM;
+		rlnode_init(&scb->datagram_s.queue, NULL);
+		scb->datagram_s.count = 0;
+		scb->datagram_s.has_data = COND_INIT;
+		if(port != NOPORT){
+			port_lookup(port)->datagram = scb;
+		}
+	}
 
 	return fid[0];
 }
 
-int sys_Listen(Fid_t sock)
-{
 
-	if (sock < 0 || sock >= MAX_FILEID) //  if fid is legal
-	{ 
+int sys_SocketPair(Fid_t fids[2])
+{
+	if(fids == NULL){
 		return -1;
 	}
 
-	if(CURPROC->FIDT[sock] == NULL){ //  if given fid is NULL
+	Fid_t fid[2];
+	FCB *fcb[2];
+
+	// reserve two fcbs of the file table with two fids of process table
+	if( FCB_reserve(2, fid, fcb) == 0 )  {
+		return -1; 
+	}
+
+	// connect two unbound sockets directly, without a listener
+	socket_cb *scb0 = socket_create(fcb[0], NOPORT, 0);
+	socket_cb *scb1 = socket_create(fcb[1], NOPORT, 0);
+	socket_connect_peers(scb0, scb1, 0);
+
+	fids[0] = fid[0];
+	fids[1] = fid[1];
+	return 0;
+}
+
+int sys_Listen(Fid_t sock)
+{
+	return sys_Listen2(sock, LISTEN_BACKLOG);
+}
+
+int sys_Listen2(Fid_t sock, unsigned int backlog)
+{
+
+	if(get_fcb(sock) == NULL){ //  if fid is legal and not NULL
 		return -1;
 	}
 
-	socket_cb *scb = (socket_cb *) CURPROC->FIDT[sock]->streamobj;
+	socket_cb *scb = (socket_cb *) get_fcb(sock)->streamobj;
 
 	if(scb == NULL || scb->port == NOPORT){ //  if the socket is not bound to a port
 		return -1;
 	}
 
-	if(PORT_MAP[scb->port] != NULL){ //  if the port of the listener is bounded by another listener
+	port_group *group = port_lookup(scb->port);
+
+	//  if the port of the listener is bounded by other listeners, they must all reuse it
+	if(group != NULL && ! is_rlist_empty(&group->listeners)
+		&& ((scb->flags & REUSE_PORT) == 0 || scb->flags != group->flags)){
 		return -1;
 	}
 
@@ -156,120 +614,196 @@ int sys_Listen(Fid_t sock)
 		return -1;
 	}
 
+	if(backlog == 0 || backlog > MAX_LISTEN_BACKLOG){ //  if the backlog is not legal
+		return -1;
+	}
+
+	// the first listener of the port sets the flags of its group
+	if(is_rlist_empty(&group->listeners)){
+		group->flags = scb->flags;
+	}
+
 	// initialize listener of the sock
 	scb->type = SOCKET_LISTENER;
-	PORT_MAP[scb->port] = scb;
 	rlnode_init(&scb->listener_s.queue, NULL);
 	scb->listener_s.req_available = COND_INIT;
+	scb->listener_s.pending = 0;
+	scb->listener_s.backlog = backlog;
+	scb->listener_s.closed = 0;
+	rlnode_init(&scb->listener_s.port_node, scb);
+	rlist_push_back(&group->listeners, &scb->listener_s.port_node);
+
+	// host connections to the port wake up the listener
+	scb->listener_s.gateway = gateway_serves(scb->port);
+	if(scb->listener_s.gateway){
+		scb->listener_s.gateway_watch.notify = listener_gateway_notify;
+		scb->listener_s.gateway_watch.owner = scb;
+		gateway_watch(&scb->listener_s.gateway_watch);
+	}
 
 	return 0;
 }
 
 
-Fid_t sys_Accept(Fid_t lsock)
+/* translate an fid to a listening socket, or NULL */
+static socket_cb* get_listener(Fid_t lsock)
 {
-	if (lsock < 0 || lsock >= MAX_FILEID) //  if fid is legal
-	{ 
-		return NOFILE;
+	if(get_fcb(lsock) == NULL){ //  if fid is legal and not NULL
+		return NULL;
 	}
 
-	if(CURPROC->FIDT[lsock] == NULL){ //  if given fid is NULL
-		return NOFILE;
-	}
-
-	socket_cb *scb = (socket_cb *) CURPROC->FIDT[lsock]->streamobj;
+	socket_cb *scb = (socket_cb *) get_fcb(lsock)->streamobj;
 
 	if(scb == NULL || scb->port == NOPORT){ //  if the socket is not bound to a port
-		return NOFILE;
+		return NULL;
 	}
 
 	if(scb->type != SOCKET_LISTENER){ //  if the socket is a listener
-		return NOFILE;
+		return NULL;
 	}
 
+	return scb;
+}
 
-	scb->refcount++;// increase the SCB's refcount by one
-
-	port_t lport= scb->port;// create a port for the listener socket
-
-	//fprintf(stderr, "\n Before wait");
 
+/*
+	Wait until a request is pending. The caller holds a reference to the
+	listener. Return -1 if the listener was closed while waiting.
+ */
+static int listener_wait(socket_cb *scb)
+{
 	// wait while request list is empty and Listener is not closed
-	while(is_rlist_empty(&scb->listener_s.queue) && (PORT_MAP[lport] != NULL)){
+	while(is_rlist_empty(&scb->listener_s.queue) && ! scb->listener_s.closed){
+		if(scb->listener_s.gateway){
+			port_pull_gateway(scb->port);
+			if(! is_rlist_empty(&scb->listener_s.queue))
+				break;
+		}
 		kernel_wait(&scb->listener_s.req_available, SCHED_IO);
 	}		
 
-	//fprintf(stderr, "\n After wait");
+	//  listener still open after the kernel_wait()
+	return scb->listener_s.closed ? -1 : 0;
+}
+
 
-	if(PORT_MAP[lport] == NULL){ //  port still valid after the kernel_wait()
-		//scb->refcount--;
+/*
+	Admit the first pending request, connecting its socket to a new
+	socket of the current process. Return the fid of the new socket,
+	or NOFILE if the fids are exhausted.
+ */
+static Fid_t listener_admit(socket_cb *scb)
+{
+	// create a socket to serve the client, before taking the request
+	Fid_t server_fid = sys_Socket2(scb->port, scb->flags & PACKET_MODE);
+	
+	if (server_fid == NOFILE) //  if sys_Socket failed
+	{
 		return NOFILE;
 	}
 
 	// next request
 	rlnode *reqNode = rlist_pop_front(&scb->listener_s.queue);
+	scb->listener_s.pending--;
 	connection_request *request = reqNode->obj;
 	request->admitted = 1; // now it is admitted
 
 	socket_cb *client = request->peer; // the socket of the client
 
-	// create a socket to serve the client
-	Fid_t server_fid = sys_Socket(scb->port);
-	
-	if (server_fid == NOFILE) //  if sys_Socket failed
-	{
-		return NOFILE;
+	socket_cb *server = (socket_cb *) get_fcb(server_fid)->streamobj; // the socket of the server
+
+	// a host connection is served directly by its channel
+	if(client == NULL){
+		server->type = SOCKET_GATEWAY;
+		server->gateway_s.channel = request->channel;
+		server->gateway_s.read_shut = 0;
+		server->gateway_s.write_shut = 0;
+		slab_free(&request_cache, request);
+		return server_fid;
 	}
-	//fprintf(stderr, "\n After NOfile");
 
-	socket_cb *server = (socket_cb *) CURPROC->FIDT[server_fid]->streamobj; // the socket of the server
+	socket_connect_peers(client, server, scb->flags);
 
+	// signal the connection request
+	kernel_signal(&request->connected_cv);
 
-	// connect the peers
-	server->type = SOCKET_PEER;
-	client->type = SOCKET_PEER;
-	server->peer_s.peer = client;
-	client->peer_s.peer = server; 
+	return server_fid; // return the fid of the socket server
+}
 
-	// create two pipes
-	pipe_cb *pipe1 = xmalloc(sizeof(pipe_cb));
-	pipe_cb *pipe2 = xmalloc(sizeof(pipe_cb));
-	
-	// connect the fcbs with each pipe
-	pipe1->reader = client->fcb;
-	pipe1->writer = server->fcb;
-	pipe2->reader = server->fcb;
-	pipe2->writer = client->fcb;
-
-	// initialize the remainnig fields of the pipes
-	pipe1->has_space = pipe1->has_data = COND_INIT;
-	pipe2->has_space = pipe2->has_data = COND_INIT;
-	pipe1->w_position = pipe1->r_position = pipe1->numOfElem = 0;
-	pipe2->w_position = pipe2->r_position = pipe2->numOfElem = 0;
 
-	// connect the sockets with the pipes
-	client->peer_s.read_pipe = pipe1;
-	server->peer_s.write_pipe = pipe1;
-	client->peer_s.write_pipe = pipe2;
-	server->peer_s.read_pipe = pipe2;
+Fid_t sys_Accept(Fid_t lsock)
+{
+	socket_cb *scb = get_listener(lsock);
 
-	// signal the connection request
-	kernel_signal(&request->connected_cv);
+	if(scb == NULL){
+		return NOFILE;
+	}
+
+	// a non-blocking listener does not wait, but takes the pending host connections
+	if(scb->listener_s.gateway){
+		port_pull_gateway(scb->port);
+	}
+	if(get_fcb(lsock)->nonblocking && is_rlist_empty(&scb->listener_s.queue)){
+		return NOFILE;
+	}
 
-	scb->refcount--; // substract the refcount of SCB by one
+	scb->refcount++;// the listener must not be freed while we wait
 
-	return server_fid; // return the fid of the socket server
+	Fid_t server_fid = (listener_wait(scb) == 0) ? listener_admit(scb) : NOFILE;
+
+	socket_decref(scb); // substract the refcount of SCB by one
+
+	return server_fid;
 }
 
 
-int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
+int sys_AcceptMany(Fid_t lsock, Fid_t* fids, unsigned int n)
 {
-	if (sock < 0 || sock >= MAX_FILEID) //  if file id is legal
-	{ 
+	socket_cb *scb = get_listener(lsock);
+
+	if(scb == NULL || fids == NULL || n == 0){
 		return -1;
 	}
 
-	if(CURPROC->FIDT[sock] == NULL){ //  if given fid is NULL
+	// a non-blocking listener does not wait, but takes the pending host connections
+	if(scb->listener_s.gateway){
+		port_pull_gateway(scb->port);
+	}
+	if(get_fcb(lsock)->nonblocking && is_rlist_empty(&scb->listener_s.queue)){
+		return 0;
+	}
+
+	scb->refcount++;// the listener must not be freed while we wait
+
+	int count = -1;
+	if(listener_wait(scb) == 0){
+		// drain the queue, as far as the fids last
+		count = 0;
+		while(count < n && ! is_rlist_empty(&scb->listener_s.queue)){
+			Fid_t server_fid = listener_admit(scb);
+			if(server_fid == NOFILE)
+				break;
+			fids[count++] = server_fid;
+		}
+		if(count == 0)
+			count = -1;
+	}
+
+	socket_decref(scb); // substract the refcount of SCB by one
+
+	return count;
+}
+
+
+int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
+{
+	return socket_connect(sock, port, timeout, NULL, NULL);
+}
+
+
+int socket_connect(Fid_t sock, port_t port, timeout_t timeout, const int* cancel, CondVar** waiting)
+{
+	if(get_fcb(sock) == NULL){ //  if fid is legal and not NULL
 		return -1;
 	}
 
@@ -277,23 +811,50 @@ int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
 		return -1;
 	}
 
-	socket_cb *scb = (socket_cb *) CURPROC->FIDT[sock]->streamobj; 
+	socket_cb *scb = (socket_cb *) get_fcb(sock)->streamobj; 
 
-	if(PORT_MAP[port] == NULL){ 
+	port_group *group = port_lookup(port);
+
+	if(group == NULL || is_rlist_empty(&group->listeners)){ //  if there is no listener on the port
 		return -1;
 	}
 
-	if (scb == NULL || scb->type != SOCKET_UNBOUND || PORT_MAP[port]->type != SOCKET_LISTENER) //  if the socket is not unbounded return -1
+	if (scb == NULL || scb->type != SOCKET_UNBOUND) //  if the socket is not unbounded return -1
 	{
 		return -1;
 	}
 
-	scb->refcount++;
+	if ((scb->flags & PACKET_MODE) != (group->flags & PACKET_MODE)) //  packet mode must agree with the listener
+	{
+		return -1;
+	}
 
-	scb->port = port; // update the socket port from the argument
+	// if all backlogs are full, fail at once
+	if(port_least_loaded(group) == NULL){
+		return -1;
+	}
+
+	// a bound socket connects once to each port
+	if(scb->port != NOPORT && connection_lookup(scb->port, port) != NULL){
+		return -1;
+	}
+
+	// an unbound socket gets an ephemeral port, kept until it is closed
+	if(scb->port == NOPORT){
+		scb->port = port_ephemeral();
+		if(scb->port == NOPORT){
+			return -1;
+		}
+		port_group_get(scb->port);
+	}
+
+	// the checks have passed, so the round-robin may advance
+	socket_cb *lsock = port_pick_listener(group);
+
+	scb->refcount++;
 
 	// build the request 
-	connection_request *request = xmalloc(sizeof(connection_request));
+	connection_request *request = slab_alloc(&request_cache);
 	//initialize every field
 	request->admitted = 0;
 	request->peer = scb;
@@ -302,38 +863,53 @@ int sys_Connect(Fid_t sock, port_t port, timeout_t timeout)
 	// add to the request queue
 	rlnode_init(&request->queue_node, request);
 
-	// add the request to the tail of the listener's queue
-	rlist_push_back(&PORT_MAP[port]->listener_s.queue, &request->queue_node);
-
-	// signal that this request is waiting ready 
-	kernel_signal(&PORT_MAP[port]->listener_s.req_available);
+	// add the request to the tail of the queue of the least loaded listener
+	listener_enqueue(lsock, request);
 
-	// goes to sleep until admitted==1
-	while(request->admitted == 0){
-		if(kernel_timedwait(&request->connected_cv, SCHED_PIPE, 1000*timeout) == 0){ //  return -1, when timeout has ended without a successful connection.
-			
-			return -1;
+	// goes to sleep until admitted, refused or cancelled
+	if(waiting != NULL)
+		*waiting = &request->connected_cv;
+	while(request->admitted == 0 && ! (cancel != NULL && *cancel)){
+		if(kernel_timedwait(&request->connected_cv, SCHED_PIPE, 1000*timeout) == 0){ //  the timeout has ended
+			break;
 		}
 	}
+	if(waiting != NULL)
+		*waiting = NULL;
 
-	scb->refcount--; // substract the refcount of the SCB by one
+	// a request that timed out leaves the queue of its listener
+	if(request->admitted == 0){
+		rlist_remove(&request->queue_node);
+		request->listener->listener_s.pending--;
+	}
 
-	return 0;
+	int rc = (request->admitted == 1) ? 0 : -1;
+	slab_free(&request_cache, request);
+
+	socket_decref(scb); // substract the refcount of the SCB by one
+
+	return rc;
 }
 
 
 int sys_ShutDown(Fid_t sock, shutdown_mode how)
 {
-	if (sock < 0 || sock >= MAX_FILEID) //  if fid is legal
-	{ 
+	if(get_fcb(sock) == NULL){ //  if fid is legal and not NULL
 		return -1;
 	}
 
-	if(CURPROC->FIDT[sock] == NULL){ //  if given fid is NULL
-		return -1;
-	}
+	socket_cb *scb = (socket_cb *) get_fcb(sock)->streamobj;
 
-	socket_cb *scb = (socket_cb *) CURPROC->FIDT[sock]->streamobj;
+	if(scb->type == SOCKET_GATEWAY){
+		if(how != SHUTDOWN_READ && ! scb->gateway_s.write_shut){
+			gateway_shutdown(scb->gateway_s.channel);
+			scb->gateway_s.write_shut = 1;
+		}
+		if(how != SHUTDOWN_WRITE){
+			scb->gateway_s.read_shut = 1;
+		}
+		return 0;
+	}
 
 	if (scb->type != SOCKET_PEER) //  if it is a peer socket
 	{
@@ -365,3 +941,261 @@ int sys_ShutDown(Fid_t sock, shutdown_mode how)
 	return 0;
 }
 
+
+/* translate an fid to a connected socket, or NULL */
+static socket_cb* get_peer_socket(Fid_t sock)
+{
+	FCB *fcb = get_fcb(sock);
+
+	if(fcb == NULL || fcb->streamfunc != &socket_file_ops){
+		return NULL;
+	}
+
+	socket_cb *scb = (socket_cb *) fcb->streamobj;
+
+	if(scb->type != SOCKET_PEER){
+		return NULL;
+	}
+
+	return scb;
+}
+
+
+int sys_GetSockName(Fid_t sock, port_t* port)
+{
+	FCB *fcb = get_fcb(sock);
+
+	if(fcb == NULL || fcb->streamfunc != &socket_file_ops || port == NULL){
+		return -1;
+	}
+
+	*port = ((socket_cb *) fcb->streamobj)->port;
+	return 0;
+}
+
+
+int sys_GetPeerName(Fid_t sock, port_t* port)
+{
+	socket_cb *scb = get_peer_socket(sock);
+
+	if(scb == NULL || port == NULL){
+		return -1;
+	}
+
+	*port = scb->peer_s.peer_port;
+	return 0;
+}
+
+/* the pipe of a connected socket carrying an option, or NULL if shut down */
+static pipe_cb* sockopt_pipe(socket_cb *scb, socket_option opt)
+{
+	switch(opt){
+		case SO_SNDBUF:
+		case SO_NODELAY:
+			return scb->peer_s.write_pipe;
+		case SO_RCVBUF:
+		case SO_RCVLOWAT:
+			return scb->peer_s.read_pipe;
+	}
+	return NULL;
+}
+
+/* resize a socket buffer, rounding up to a power of 2 */
+static int socket_set_buffer(pipe_cb *pp, unsigned int value)
+{
+	if(value < MIN_SOCKET_BUFFER || value > MAX_SOCKET_BUFFER){
+		return -1;
+	}
+
+	unsigned int size = MIN_SOCKET_BUFFER;
+	while(size < value) size *= 2;
+
+	// a record of maximal size must fit, and so must the low-watermark
+	if(pp->packet && size < PIPE_RECORD_HEADER + MAX_PACKET_SIZE){
+		return -1;
+	}
+	if(size < pp->lowat){
+		return -1;
+	}
+
+	return pipe_resize(pp, size);
+}
+
+
+int sys_SetSockOpt(Fid_t sock, socket_option opt, unsigned int value)
+{
+	socket_cb *scb = get_peer_socket(sock);
+
+	if(scb == NULL){
+		return -1;
+	}
+
+	pipe_cb *pp = sockopt_pipe(scb, opt);
+
+	if(pp == NULL){ //  if the option is not legal, or its direction is shut down
+		return -1;
+	}
+
+	switch(opt){
+		case SO_SNDBUF:
+		case SO_RCVBUF:
+			return socket_set_buffer(pp, value);
+
+		case SO_RCVLOWAT:
+			if(pp->packet || value == 0 || value > pp->size){
+				return -1;
+			}
+			pp->lowat = value;
+			// a lower watermark may be reached already
+			kernel_broadcast(&pp->has_data);
+			stream_notify(&scb->fcb->watchers);
+			return 0;
+
+		case SO_NODELAY:
+			if(value > 1){
+				return -1;
+			}
+			pp->coalesce = ! value;
+			// deliver what was coalesced so far
+			if(value){
+				kernel_broadcast(&pp->has_data);
+				if(pp->reader != NULL)
+					stream_notify(&pp->reader->watchers);
+			}
+			return 0;
+	}
+
+	return -1;
+}
+
+
+int sys_GetSockOpt(Fid_t sock, socket_option opt, unsigned int* value)
+{
+	socket_cb *scb = get_peer_socket(sock);
+
+	if(scb == NULL || value == NULL){
+		return -1;
+	}
+
+	pipe_cb *pp = sockopt_pipe(scb, opt);
+
+	if(pp == NULL){ //  if the option is not legal, or its direction is shut down
+		return -1;
+	}
+
+	switch(opt){
+		case SO_SNDBUF:
+		case SO_RCVBUF:
+			*value = pp->size;
+			return 0;
+
+		case SO_RCVLOWAT:
+			*value = pp->lowat;
+			return 0;
+
+		case SO_NODELAY:
+			*value = ! pp->coalesce;
+			return 0;
+	}
+
+	return -1;
+}
+
+
+/* translate an fid to a datagram socket, or NULL */
+static socket_cb* get_datagram_socket(Fid_t sock)
+{
+	FCB *fcb = get_fcb(sock);
+
+	if(fcb == NULL || fcb->streamfunc != &socket_file_ops){
+		return NULL;
+	}
+
+	socket_cb *scb = (socket_cb *) fcb->streamobj;
+
+	if(scb->type != SOCKET_DATAGRAM){
+		return NULL;
+	}
+
+	return scb;
+}
+
+
+int sys_SendTo(Fid_t sock, port_t port, const char* buf, unsigned int size)
+{
+	socket_cb *scb = get_datagram_socket(sock);
+
+	if(scb == NULL || (buf == NULL && size > 0) || size > MAX_DATAGRAM_SIZE){
+		return -1;
+	}
+
+	if(port <= NOPORT || port > MAX_PORT){ // port moves between 0 and MAX_PORT
+		return -1;
+	}
+
+	//  if there is no datagram socket on the port
+	port_group *group = port_lookup(port);
+	if(group == NULL || group->datagram == NULL){
+		return -1;
+	}
+
+	socket_cb *dest = group->datagram;
+
+	//  if the queue of the receiver is full, the datagram is dropped
+	if(dest->datagram_s.count >= MAX_DATAGRAM_QUEUE){
+		return -1;
+	}
+
+	datagram *dg = xmalloc(sizeof(datagram) + size);
+	dg->from = scb->port;
+	dg->size = size;
+	memcpy(dg->data, buf, size);
+	rlnode_init(&dg->node, dg);
+
+	rlist_push_back(&dest->datagram_s.queue, &dg->node);
+	dest->datagram_s.count++;
+
+	kernel_signal(&dest->datagram_s.has_data);
+	stream_notify(&dest->fcb->watchers);
+
+	return size;
+}
+
+
+int sys_RecvFrom(Fid_t sock, char* buf, unsigned int size, port_t* port)
+{
+	socket_cb *scb = get_datagram_socket(sock);
+
+	if(scb == NULL || scb->port == NOPORT || (buf == NULL && size > 0)){
+		return -1;
+	}
+
+	FCB *fcb = scb->fcb;
+
+	// a non-blocking socket does not wait
+	if(fcb->nonblocking && is_rlist_empty(&scb->datagram_s.queue)){
+		return WOULDBLOCK;
+	}
+
+	// the socket must not be closed while we wait
+	FCB_incref(fcb);
+
+	while(is_rlist_empty(&scb->datagram_s.queue)){
+		kernel_wait(&scb->datagram_s.has_data, SCHED_IO);
+	}
+
+	datagram *dg = rlist_pop_front(&scb->datagram_s.queue)->obj;
+	scb->datagram_s.count--;
+
+	// the excess of the datagram is discarded
+	unsigned int n = (dg->size < size) ? dg->size : size;
+	memcpy(buf, dg->data, n);
+	if(port != NULL){
+		*port = dg->from;
+	}
+	free(dg);
+
+	FCB_decref(fcb);
+
+	return n;
+}
@@ -1,4 +1,5 @@
 
+#include <limits.h>
 #include "util.h"
 #include "tinyos.h"
 #include "kernel_cc.h"
@@ -9,49 +10,189 @@
 #define MAX_FILES MAX_PROC
 
 FCB FT[MAX_FILES];
-rlnode FCB_freelist;
+
+
+/*
+  FCB allocation.
+
+  Each core keeps a magazine of free FCBs, so that most opens and
+  closes do not touch shared state. An empty magazine is refilled
+  with a batch of FCBs from the global depot, and a full one returns
+  a batch to it.
+
+  A magazine is used by its core, with preemption off so that the
+  thread cannot move to another core meanwhile. When both the local
+  magazine and the depot are empty, the free FCBs may still sit in the
+  magazines of other cores, so half of the first non-empty one is
+  flushed to the depot before giving up. Therefore, each magazine has
+  a spinlock, which its own core almost never finds taken. A magazine
+  lock may be held while taking the depot lock, but never another
+  magazine lock.
+ */
+
+#define FCB_MAGAZINE 32
+#define FCB_BATCH (FCB_MAGAZINE/2)
+
+typedef struct fcb_magazine {
+  _Alignas(64) Mutex spinlock;   /* aligned, to keep the cores off each other's lines */
+  unsigned int count;
+  FCB* fcb[FCB_MAGAZINE];
+} fcb_magazine;
+
+static fcb_magazine FCB_magazines[MAX_CORES];
+static rlnode FCB_depot;
+static Mutex FCB_depot_spinlock = MUTEX_INIT;
 
 
 void initialize_files()
 {
-  rlnode_init(&FCB_freelist,NULL);
+  rlnode_init(&FCB_depot,NULL);
   for(int i=0;i<MAX_FILES;i++) {
 
     FT[i].refcount = 0;
     rlnode_init(& FT[i].freelist_node, &FT[i]);
-    rlist_push_back(&FCB_freelist, & FT[i].freelist_node);
+    rlist_push_back(&FCB_depot, & FT[i].freelist_node);
+  }
+
+  for(int c=0;c<MAX_CORES;c++) {
+    FCB_magazines[c].spinlock = MUTEX_INIT;
+    FCB_magazines[c].count = 0;
+  }
+}
+
+
+/* Pop an FCB from a magazine, refilling it from the depot if empty */
+static FCB* magazine_pop(fcb_magazine* mag)
+{
+  FCB* fcb = NULL;
+  Mutex_Lock(& mag->spinlock);
+
+  if(mag->count == 0) {
+    /* Refill from the depot */
+    Mutex_Lock(& FCB_depot_spinlock);
+    while(mag->count < FCB_BATCH && ! is_rlist_empty(& FCB_depot))
+      mag->fcb[mag->count++] = rlist_pop_front(& FCB_depot)->fcb;
+    Mutex_Unlock(& FCB_depot_spinlock);
   }
+
+  if(mag->count > 0)
+    fcb = mag->fcb[--mag->count];
+
+  Mutex_Unlock(& mag->spinlock);
+  return fcb;
 }
 
+/* Flush the older half of another core's magazine to the depot */
+static int magazine_steal(unsigned int core)
+{
+  for(unsigned int c=0; c<MAX_CORES; c++) {
+    if(c == core) continue;
+    fcb_magazine* mag = & FCB_magazines[c];
+
+    Mutex_Lock(& mag->spinlock);
+    unsigned int n = (mag->count+1)/2;
+    if(n > 0) {
+      Mutex_Lock(& FCB_depot_spinlock);
+      for(unsigned int i=0; i<n; i++)
+        rlist_push_back(& FCB_depot, & mag->fcb[i]->freelist_node);
+      Mutex_Unlock(& FCB_depot_spinlock);
+
+      memmove(mag->fcb, mag->fcb+n, (mag->count-n)*sizeof(FCB*));
+      mag->count -= n;
+    }
+    Mutex_Unlock(& mag->spinlock);
+
+    if(n > 0) return 1;
+  }
+  return 0;
+}
 
 FCB* acquire_FCB()
 {
-  if(! is_rlist_empty(& FCB_freelist)) {
-    FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
+  int pre = preempt_off;
+  fcb_magazine* mag = & FCB_magazines[cpu_core_id];
+
+  FCB* fcb = magazine_pop(mag);
+  while(fcb == NULL && magazine_steal(cpu_core_id))
+    fcb = magazine_pop(mag);
+
+  if(pre) preempt_on;
+
+  if(fcb) {
     fcb->refcount = 0;
-    return fcb;
+    fcb->streamfunc = NULL;   /* not yet visible to the fast path */
+    fcb->nonblocking = 0;
+    rlnode_init(& fcb->watchers, NULL);
+    rlnode_init(& fcb->evq_items, NULL);
   }
-  else
-    return NULL;
+  return fcb;
 }
 
 void release_FCB(FCB* fcb)
 {
-  rlist_push_back(& FCB_freelist, & fcb->freelist_node);
+  int pre = preempt_off;
+  fcb_magazine* mag = & FCB_magazines[cpu_core_id];
+  Mutex_Lock(& mag->spinlock);
+
+  if(mag->count == FCB_MAGAZINE) {
+    /* Return the older half to the depot */
+    Mutex_Lock(& FCB_depot_spinlock);
+    for(unsigned int i=0; i<FCB_BATCH; i++)
+      rlist_push_front(& FCB_depot, & mag->fcb[i]->freelist_node);
+    Mutex_Unlock(& FCB_depot_spinlock);
+
+    memmove(mag->fcb, mag->fcb+FCB_BATCH, (FCB_MAGAZINE-FCB_BATCH)*sizeof(FCB*));
+    mag->count -= FCB_BATCH;
+  }
+
+  /* The most recently released FCB is reused first, while it is hot */
+  mag->fcb[mag->count++] = fcb;
+
+  Mutex_Unlock(& mag->spinlock);
+  if(pre) preempt_on;
+}
+
+
+void* slab_alloc(slab_cache* cache)
+{
+  assert(cache->size >= sizeof(rlnode));
+
+  if(is_rlist_empty(& cache->free)) {
+    char* slab = xmalloc(cache->size * cache->per_slab);
+    for(uint i=0; i<cache->per_slab; i++)
+      slab_free(cache, slab + i*cache->size);
+  }
+
+  return rlist_pop_front(& cache->free)->obj;
+}
+
+void slab_free(slab_cache* cache, void* obj)
+{
+  /* The most recently freed object is reused first, while it is hot */
+  rlnode* node = obj;
+  rlnode_init(node, obj);
+  rlist_push_front(& cache->free, node);
 }
 
 
+/*
+  The reference count is atomic, since the fast path of Read and Write
+  takes references without the kernel lock (see fast_get_fcb). The
+  last reference is always dropped under the kernel lock, where the
+  stream is closed.
+ */
 void FCB_incref(FCB* fcb)
 {
   assert(fcb);
-  fcb->refcount++;
+  __atomic_fetch_add(& fcb->refcount, 1, __ATOMIC_RELAXED);
 }
 
 int FCB_decref(FCB* fcb)
 {
   assert(fcb);
-  fcb->refcount --;
-  if(fcb->refcount==0) {
+  if(__atomic_sub_fetch(& fcb->refcount, 1, __ATOMIC_ACQ_REL)==0) {
+    if(! is_rlist_empty(& fcb->evq_items))
+      evq_release_stream(fcb);
     int retval = fcb->streamfunc->Close(fcb->streamobj);
     release_FCB(fcb);
     return retval;
@@ -62,17 +203,156 @@ int FCB_decref(FCB* fcb)
 
 
 
+/*
+  File id tables.
+
+  The FIDT of a process starts with FIDT_MIN_SIZE entries and doubles
+  when a fid beyond its end is needed, up to the fid limit. A bitmap
+  marks the occupied entries, so that the lowest free fid is found a
+  word at a time, and a table is copied or closed visiting only its
+  occupied entries.
+
+  The tables are changed under the kernel lock, but they are also read
+  without it by fast_get_fcb. Hence, the entries are stored atomically,
+  and a table replaced by a larger one is not freed at once, since a
+  reader may still be looking at it; it is kept until the process exits.
+  Since tables double, the kept ones take less space than the current.
+ */
+
+typedef struct fidt_retired {
+  rlnode node;
+  FCB** table;
+} fidt_retired;
+
+static inline unsigned int fid_map_words(unsigned int size)
+{
+  return (size + FID_MAP_BITS - 1) / FID_MAP_BITS;
+}
+
+void FIDT_init(PCB* pcb, unsigned int size, unsigned int limit)
+{
+  unsigned int n = FIDT_MIN_SIZE;
+  while(n < size) n *= 2;
+
+  pcb->FIDT = xmalloc(n * sizeof(FCB*));
+  memset(pcb->FIDT, 0, n * sizeof(FCB*));
+  pcb->fid_map = xmalloc(fid_map_words(n) * sizeof(unsigned long));
+  memset(pcb->fid_map, 0, fid_map_words(n) * sizeof(unsigned long));
+  pcb->fidt_size = n;
+  pcb->fid_limit = limit;
+  rlnode_init(& pcb->fidt_retired, NULL);
+}
+
+/* Double the table until it holds fid */
+static void FIDT_grow(PCB* pcb, Fid_t fid)
+{
+  unsigned int n = pcb->fidt_size;
+  while(n <= (unsigned int) fid) n *= 2;
+
+  FCB** table = xmalloc(n * sizeof(FCB*));
+  memcpy(table, pcb->FIDT, pcb->fidt_size * sizeof(FCB*));
+  memset(table + pcb->fidt_size, 0, (n - pcb->fidt_size) * sizeof(FCB*));
+
+  pcb->fid_map = realloc(pcb->fid_map, fid_map_words(n) * sizeof(unsigned long));
+  assert(pcb->fid_map != NULL);
+  unsigned int words = fid_map_words(pcb->fidt_size);
+  memset(pcb->fid_map + words, 0, (fid_map_words(n) - words) * sizeof(unsigned long));
+
+  fidt_retired* old = xmalloc(sizeof(fidt_retired));
+  old->table = pcb->FIDT;
+  rlnode_init(& old->node, old);
+  rlist_push_back(& pcb->fidt_retired, & old->node);
+
+  /* Publish the table before its size, readers load them in reverse order */
+  __atomic_store_n(& pcb->FIDT, table, __ATOMIC_RELEASE);
+  __atomic_store_n(& pcb->fidt_size, n, __ATOMIC_RELEASE);
+}
+
+void FIDT_set(PCB* pcb, Fid_t fid, FCB* fcb)
+{
+  assert(fid >= 0 && (unsigned int) fid < pcb->fid_limit);
+  if((unsigned int) fid >= pcb->fidt_size)
+    FIDT_grow(pcb, fid);
+
+  unsigned long bit = 1ul << (fid % FID_MAP_BITS);
+  if(fcb)
+    pcb->fid_map[fid / FID_MAP_BITS] |= bit;
+  else
+    pcb->fid_map[fid / FID_MAP_BITS] &= ~bit;
+  __atomic_store_n(& pcb->FIDT[fid], fcb, __ATOMIC_RELEASE);
+}
+
+/* Return the lowest free fid not less than from, or NOFILE */
+static Fid_t FIDT_find_free(PCB* pcb, Fid_t from)
+{
+  unsigned int end = (pcb->fidt_size < pcb->fid_limit) ? pcb->fidt_size : pcb->fid_limit;
+
+  for(unsigned int w = from / FID_MAP_BITS; w < fid_map_words(end); w++) {
+    unsigned long avail = ~pcb->fid_map[w];
+    if(w == from / FID_MAP_BITS)
+      avail &= ~0ul << (from % FID_MAP_BITS);
+    if(avail) {
+      /* The bits past the end of the table are clear */
+      unsigned int f = w * FID_MAP_BITS + __builtin_ctzl(avail);
+      return (f < pcb->fid_limit) ? (Fid_t) f : NOFILE;
+    }
+  }
+
+  /* The table is full; the fid past its end is free, within the limit */
+  unsigned int f = (from > end) ? from : end;
+  return (f < pcb->fid_limit) ? (Fid_t) f : NOFILE;
+}
+
+void FIDT_inherit(PCB* newproc, PCB* parent)
+{
+  for(unsigned int w = 0; w < fid_map_words(parent->fidt_size); w++) {
+    unsigned long used = parent->fid_map[w];
+    while(used) {
+      Fid_t fid = w * FID_MAP_BITS + __builtin_ctzl(used);
+      used &= used - 1;
+      FIDT_set(newproc, fid, parent->FIDT[fid]);
+      FCB_incref(parent->FIDT[fid]);
+    }
+  }
+}
+
+void FIDT_release(PCB* pcb)
+{
+  for(unsigned int w = 0; w < fid_map_words(pcb->fidt_size); w++) {
+    unsigned long used = pcb->fid_map[w];
+    while(used) {
+      Fid_t fid = w * FID_MAP_BITS + __builtin_ctzl(used);
+      used &= used - 1;
+      FCB* fcb = pcb->FIDT[fid];
+      FIDT_set(pcb, fid, NULL);
+      FCB_decref(fcb);
+    }
+  }
+
+  while(! is_rlist_empty(& pcb->fidt_retired)) {
+    fidt_retired* old = rlist_pop_front(& pcb->fidt_retired)->obj;
+    free(old->table);
+    free(old);
+  }
+  free(pcb->FIDT);
+  free(pcb->fid_map);
+  pcb->FIDT = NULL;
+  pcb->fid_map = NULL;
+  pcb->fidt_size = 0;
+}
+
+
+
 int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
 {
     PCB* cur = CURPROC;
-    size_t f=0;
+    Fid_t f=0;
     uint i;
 
     /* Find distinct fids */
     for(i=0; i<num; i++) {
-	while(f<MAX_FILEID && cur->FIDT[f]!=NULL)
-	    f++;
-	if(f==MAX_FILEID) break;
+	f = FIDT_find_free(cur, f);
+	if(f==NOFILE) break;
 	fid[i] = f; f++;
     }
     if(i<num) return 0;
@@ -90,7 +370,7 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
     }
     /* Found all */
     for(i=0;i<num;i++) {
-	cur->FIDT[fid[i]]=fcb[i];
+	FIDT_set(cur, fid[i], fcb[i]);
 	FCB_incref(fcb[i]);
     }
     return 1;
@@ -103,7 +383,7 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
     PCB* cur = CURPROC;
     for(size_t i=0; i<num ; i++) {
 	assert(cur->FIDT[fid[i]]==fcb[i]);
-	cur->FIDT[fid[i]] = NULL;
+	FIDT_set(cur, fid[i], NULL);
 	release_FCB(fcb[i]);
     }
 }
@@ -113,6 +393,57 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
 
 
 
+/*
+ *
+ *   Stream watches
+ *
+ */
+
+
+void stream_watch_add(rlnode* watchers, stream_watch* watch, Mutex* lock)
+{
+  rlnode_init(& watch->node, watch);
+  watch->lock = lock;
+
+  if(lock) {
+    int pre = preempt_off;
+    Mutex_Lock(lock);
+    rlist_push_back(watchers, & watch->node);
+    Mutex_Unlock(lock);
+    if(pre) preempt_on;
+  }
+  else
+    rlist_push_back(watchers, & watch->node);
+}
+
+
+void stream_unwatch(stream_watch* watch)
+{
+  if(watch->lock) {
+    int pre = preempt_off;
+    Mutex_Lock(watch->lock);
+    rlist_remove(& watch->node);
+    Mutex_Unlock(watch->lock);
+    if(pre) preempt_on;
+  }
+  else
+    rlist_remove(& watch->node);
+}
+
+
+void stream_notify(rlnode* watchers)
+{
+  for(rlnode* p = watchers->next; p != watchers; ) {
+    /* notify() may unlink the watch, so advance first */
+    stream_watch* watch = p->obj;
+    p = p->next;
+    watch->notify(watch);
+  }
+}
+
+
+
+
 /*
  *
  *   I/O routines
@@ -122,9 +453,22 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
 
 FCB* get_fcb(Fid_t fid)
 {
-  if(fid < 0 || fid >= MAX_FILEID) return NULL;
+  PCB* cur = CURPROC;
+  if(fid < 0 || (unsigned int) fid >= cur->fidt_size) return NULL;
+
+  return cur->FIDT[fid];
+}
+
 
-  return CURPROC->FIDT[fid];
+/*
+  Return 1 if the stream is in non-blocking mode and none of the
+  given events is ready, i.e., the operation would block.
+ */
+static inline int would_block(FCB* fcb, int events)
+{
+  if(! fcb->nonblocking || fcb->streamfunc->Poll == NULL)
+    return 0;
+  return fcb->streamfunc->Poll(fcb->streamobj, events, NULL) == 0;
 }
 
 
@@ -146,7 +490,9 @@ int sys_Read(Fid_t fd, char *buf, unsigned int size)
        while we are using it! */
     FCB_incref(fcb);
   
-    if(devread)
+    if(would_block(fcb, POLL_READ))
+      retcode = WOULDBLOCK;
+    else if(devread)
       retcode = devread(sobj, buf, size);
 
     /* Need to decrease the reference to FCB */
@@ -180,7 +526,9 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
     FCB_incref(fcb);
   
 
-    if(devwrite)
+    if(would_block(fcb, POLL_WRITE))
+      retcode = WOULDBLOCK;
+    else if(devwrite)
       retcode = devwrite(sobj, buf, size);
 
     /* Need to decrease the reference to FCB */
@@ -193,14 +541,340 @@ int sys_Write(Fid_t fd, const char *buf, unsigned int size)
 }
 
 
+/*
+  Drop a reference taken by fast_get_fcb. If it may be the last one,
+  the stream is closed under the kernel lock.
+ */
+static void fast_put_fcb(FCB* fcb)
+{
+  uint rc = __atomic_load_n(& fcb->refcount, __ATOMIC_RELAXED);
+  while(rc > 1)
+    if(__atomic_compare_exchange_n(& fcb->refcount, &rc, rc-1, 0,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return;
+
+  kernel_lock();
+  FCB_decref(fcb);
+  kernel_unlock();
+}
+
+/*
+  Return the FCB of fid for a lock-free fast path, with a new reference,
+  or NULL.
+
+  This runs concurrently with other threads of the process, which may
+  close fid, reuse it, or grow the file id table. The table is safe to
+  read (see FIDT_grow), and the FCBs are never freed, only recycled.
+  So, we take a reference unless the FCB is being released, and then
+  check that fid still refers to it; if not, it was recycled meanwhile.
+
+  An FCB that is being set up by the syscall that reserved it has no
+  stream functions yet, and is left to the slow path.
+ */
+static FCB* fast_get_fcb(Fid_t fid)
+{
+  PCB* cur = CURPROC;
+  if(fid < 0 || (unsigned int) fid >= __atomic_load_n(& cur->fidt_size, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  FCB** table = __atomic_load_n(& cur->FIDT, __ATOMIC_ACQUIRE);
+  FCB* fcb = __atomic_load_n(& table[fid], __ATOMIC_ACQUIRE);
+  if(fcb == NULL) return NULL;
+
+  uint rc = __atomic_load_n(& fcb->refcount, __ATOMIC_RELAXED);
+  do {
+    if(rc == 0) return NULL;
+  } while(! __atomic_compare_exchange_n(& fcb->refcount, &rc, rc+1, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  table = __atomic_load_n(& cur->FIDT, __ATOMIC_ACQUIRE);
+  if(__atomic_load_n(& table[fid], __ATOMIC_ACQUIRE) != fcb
+     || __atomic_load_n(& fcb->streamfunc, __ATOMIC_ACQUIRE) == NULL) {
+    fast_put_fcb(fcb);
+    return NULL;
+  }
+  return fcb;
+}
+
+
+int fast_Read(Fid_t fd, char *buf, unsigned int size)
+{
+  FCB* fcb = fast_get_fcb(fd);
+  if(fcb == NULL) return -1;
+
+  int rc = -1;
+  if(fcb->streamfunc->FastRead != NULL)
+    rc = fcb->streamfunc->FastRead(fcb->streamobj, buf, size);
+  fast_put_fcb(fcb);
+  return rc;
+}
+
+
+int fast_Write(Fid_t fd, const char *buf, unsigned int size)
+{
+  FCB* fcb = fast_get_fcb(fd);
+  if(fcb == NULL) return -1;
+
+  int rc = -1;
+  if(fcb->streamfunc->FastWrite != NULL)
+    rc = fcb->streamfunc->FastWrite(fcb->streamobj, buf, size);
+  fast_put_fcb(fcb);
+  return rc;
+}
+
+
+/*
+  Return the total size of a segment vector, or -1 if the
+  vector is malformed, or its size does not fit the return value.
+ */
+static long iov_total(const iovec_t* iov, unsigned int iovcnt)
+{
+  if(iovcnt>0 && iov==NULL) return -1;
+
+  long total = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    if(iov[i].size>0 && iov[i].buf==NULL) return -1;
+    total += iov[i].size;
+    if(total > INT_MAX) return -1;
+  }
+  return total;
+}
+
+
+/*
+  Fallbacks for streams without ReadV and WriteV.
+
+  A vector that fits IOV_BOUNCE_SIZE goes through a bounce buffer
+  in one call to the stream, so that e.g. a message is not split.
+  A larger one is transferred one segment at a time: only the first
+  call may block, and the next segments follow while the previous
+  ones are complete and the stream is ready. As elsewhere, a stream
+  that cannot poll is assumed ready.
+ */
+#define IOV_BOUNCE_SIZE 4096
+
+static inline int stream_ready(FCB* fcb, int events)
+{
+  return fcb->streamfunc->Poll == NULL
+    || fcb->streamfunc->Poll(fcb->streamobj, events, NULL) != 0;
+}
+
+static int readv_fallback(FCB* fcb, const iovec_t* iov, unsigned int iovcnt, unsigned int total)
+{
+  int (*devread)(void*,char*,uint) = fcb->streamfunc->Read;
+
+  if(total <= IOV_BOUNCE_SIZE) {
+    char bounce[IOV_BOUNCE_SIZE];
+    int rc = devread(fcb->streamobj, bounce, total);
+    for(unsigned int i=0, pos=0; rc>0 && pos<(unsigned int)rc; i++) {
+      unsigned int n = (rc-pos < iov[i].size) ? rc-pos : iov[i].size;
+      memcpy(iov[i].buf, bounce+pos, n);
+      pos += n;
+    }
+    return rc;
+  }
+
+  int count = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    if(iov[i].size == 0) continue;
+    if(count > 0 && ! stream_ready(fcb, POLL_READ)) break;
+
+    int rc = devread(fcb->streamobj, iov[i].buf, iov[i].size);
+    if(rc <= 0) return (count > 0) ? count : rc;
+    count += rc;
+    if((unsigned int) rc < iov[i].size) break;
+  }
+  return count;
+}
+
+static int writev_fallback(FCB* fcb, const iovec_t* iov, unsigned int iovcnt, unsigned int total)
+{
+  int (*devwrite)(void*,const char*,uint) = fcb->streamfunc->Write;
+
+  if(total <= IOV_BOUNCE_SIZE) {
+    char bounce[IOV_BOUNCE_SIZE];
+    for(unsigned int i=0, pos=0; i<iovcnt; i++) {
+      memcpy(bounce+pos, iov[i].buf, iov[i].size);
+      pos += iov[i].size;
+    }
+    return devwrite(fcb->streamobj, bounce, total);
+  }
+
+  int count = 0;
+  for(unsigned int i=0; i<iovcnt; i++) {
+    if(iov[i].size == 0) continue;
+    if(count > 0 && ! stream_ready(fcb, POLL_WRITE)) break;
+
+    int rc = devwrite(fcb->streamobj, iov[i].buf, iov[i].size);
+    if(rc <= 0) return (count > 0) ? count : rc;
+    count += rc;
+    if((unsigned int) rc < iov[i].size) break;
+  }
+  return count;
+}
+
+
+int sys_ReadV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt)
+{
+  int retcode = -1;
+  long total = iov_total(iov, iovcnt);
+
+  /* Get the fields from the stream */
+  FCB* fcb = get_fcb(fd);
+
+  if(fcb && total>=0) {
+    void* sobj = fcb->streamobj;
+    file_ops* fops = fcb->streamfunc;
+
+    /* make sure that the stream will not be closed (by another thread)
+       while we are using it! */
+    FCB_incref(fcb);
+
+    if(would_block(fcb, POLL_READ)) {
+      retcode = WOULDBLOCK;
+    }
+    else if(fops->ReadV) {
+      retcode = fops->ReadV(sobj, iov, iovcnt);
+    }
+    else if(fops->Read) {
+      retcode = readv_fallback(fcb, iov, iovcnt, total);
+    }
+
+    /* Need to decrease the reference to FCB */
+    FCB_decref(fcb);
+  }
+
+  return retcode;
+}
+
+
+int sys_WriteV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt)
+{
+  int retcode = -1;
+  long total = iov_total(iov, iovcnt);
+
+  /* Get the fields from the stream */
+  FCB* fcb = get_fcb(fd);
+
+  if(fcb && total>=0) {
+    void* sobj = fcb->streamobj;
+    file_ops* fops = fcb->streamfunc;
+
+    /* make sure that the stream will not be closed (by another thread)
+       while we are using it! */
+    FCB_incref(fcb);
+
+    if(would_block(fcb, POLL_WRITE)) {
+      retcode = WOULDBLOCK;
+    }
+    else if(fops->WriteV) {
+      retcode = fops->WriteV(sobj, iov, iovcnt);
+    }
+    else if(fops->Write) {
+      retcode = writev_fallback(fcb, iov, iovcnt, total);
+    }
+
+    /* Need to decrease the reference to FCB */
+    FCB_decref(fcb);
+  }
+
+  return retcode;
+}
+
+
+/*
+  Copy through a kernel buffer, for streams that are not both pipes.
+  The data of each read is written completely, blocking if needed,
+  since it cannot be given back to the input stream.
+ */
+#define COPY_BUFFER_SIZE 4096
+
+static int copy_through_buffer(FCB* fin, FCB* fout, unsigned int len)
+{
+  int (*devread)(void*,char*,uint) = fin->streamfunc->Read;
+  int (*devwrite)(void*,const char*,uint) = fout->streamfunc->Write;
+  if(devread == NULL || devwrite == NULL) return -1;
+
+  char buf[COPY_BUFFER_SIZE];
+  unsigned int moved = 0;
+
+  while(moved < len) {
+    if(would_block(fin, POLL_READ) || would_block(fout, POLL_WRITE))
+      return (moved > 0) ? (int) moved : WOULDBLOCK;
+
+    /* As a read, return what is available rather than wait for more */
+    if(moved > 0 && fin->streamfunc->Poll != NULL
+       && fin->streamfunc->Poll(fin->streamobj, POLL_READ, NULL) == 0)
+      break;
+
+    unsigned int n = len - moved;
+    if(n > COPY_BUFFER_SIZE) n = COPY_BUFFER_SIZE;
+
+    int rc = devread(fin->streamobj, buf, n);
+    if(rc <= 0)   /* the end of data, or an error */
+      return (moved > 0) ? (int) moved : rc;
+
+    for(int done = 0; done < rc; ) {
+      int wc = devwrite(fout->streamobj, buf + done, rc - done);
+      if(wc <= 0)
+        return (moved + done > 0) ? (int)(moved + done) : -1;
+      done += wc;
+    }
+    moved += rc;
+  }
+
+  return moved;
+}
+
+
+int sys_CopyStream(Fid_t in, Fid_t out, unsigned int len)
+{
+  FCB* fin = get_fcb(in);
+  FCB* fout = get_fcb(out);
+  if(fin == NULL || fout == NULL) return -1;
+
+  /* The count is returned as an int */
+  if(len > INT_MAX) len = INT_MAX;
+
+  /* make sure that the streams will not be closed (by another thread)
+     while we are using them! */
+  FCB_incref(fin);
+  FCB_incref(fout);
+
+  /* Between two pipes, the data moves from ring to ring */
+  pipe_cb* src = fin->streamfunc->GetPipe ? fin->streamfunc->GetPipe(fin->streamobj, 1) : NULL;
+  pipe_cb* dst = fout->streamfunc->GetPipe ? fout->streamfunc->GetPipe(fout->streamobj, 0) : NULL;
+
+  int retcode;
+  if(src != NULL && dst != NULL && src != dst)
+    retcode = pipe_splice(src, dst, len, fin->nonblocking, fout->nonblocking);
+  else
+    retcode = copy_through_buffer(fin, fout, len);
+
+  FCB_decref(fout);
+  FCB_decref(fin);
+  return retcode;
+}
+
+
+int sys_SetNonBlocking(Fid_t fd, int nonblocking)
+{
+  FCB* fcb = get_fcb(fd);
+  if(fcb == NULL) return -1;
+
+  fcb->nonblocking = (nonblocking != 0);
+  return 0;
+}
+
+
 int sys_Close(int fd)
 {
-  int retcode = (fd>=0 && fd<MAX_FILEID) ? 0 : -1;  /* Closing a closed fd is legal! */
+  int retcode = (fd>=0 && (unsigned int) fd<CURPROC->fid_limit) ? 0 : -1;  /* Closing a closed fd is legal! */
 
   FCB* fcb = get_fcb(fd);
 
   if(fcb) {
-    CURPROC->FIDT[fd] = NULL;
+    FIDT_set(CURPROC, fd, NULL);
     retcode = FCB_decref(fcb);    
   }
 
@@ -218,7 +892,8 @@ int sys_Close(int fd)
 int sys_Dup2(int oldfd, int newfd)
 {
   int retcode=0;
-  if(oldfd<0 || newfd<0 || oldfd>=MAX_FILEID || newfd>=MAX_FILEID)
+  unsigned int limit = CURPROC->fid_limit;
+  if(oldfd<0 || newfd<0 || (unsigned int) oldfd>=limit || (unsigned int) newfd>=limit)
     return -1;
 
   FCB* old = get_fcb(oldfd);
@@ -231,7 +906,7 @@ int sys_Dup2(int oldfd, int newfd)
     if(new)
       FCB_decref(new);
     FCB_incref(old);
-    CURPROC->FIDT[newfd] = old;
+    FIDT_set(CURPROC, newfd, old);
   }
 
   return retcode;
@@ -239,6 +914,25 @@ int sys_Dup2(int oldfd, int newfd)
 
 
 
+int sys_SetFileLimit(unsigned int limit)
+{
+  PCB* cur = CURPROC;
+  if(limit == 0 || limit > MAX_FILEID_LIMIT) return -1;
+
+  /* The open fids must remain legal */
+  for(unsigned int w = limit / FID_MAP_BITS; w < fid_map_words(cur->fidt_size); w++) {
+    unsigned long used = cur->fid_map[w];
+    if(w == limit / FID_MAP_BITS)
+      used &= ~0ul << (limit % FID_MAP_BITS);
+    if(used) return -1;
+  }
+
+  cur->fid_limit = limit;
+  return 0;
+}
+
+
+
 unsigned int sys_GetTerminalDevices()
 {
   return device_no(DEV_SERIAL);
@@ -281,3 +975,11 @@ Fid_t sys_OpenTerminal(unsigned int termno)
   return open_stream(DEV_SERIAL, termno);
 }
 
+
+int sys_IsTerminal(Fid_t fd)
+{
+  FCB* fcb = get_fcb(fd);
+  if(fcb == NULL) return -1;
+  return device_is(DEV_SERIAL, fcb->streamfunc);
+}
+
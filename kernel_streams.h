@@ -41,10 +41,13 @@
  */
 typedef struct file_control_block
 {
-  uint refcount;  			/**< @brief Reference counter. */
+  uint refcount;  			/**< @brief Reference counter, updated atomically. */
   void* streamobj;			/**< @brief The stream object (e.g., a device) */
   file_ops* streamfunc;		/**< @brief The stream implementation methods */
   rlnode freelist_node;		/**< @brief Intrusive list node */
+  int nonblocking;			/**< @brief Set if the stream is in non-blocking mode */
+  rlnode watchers;			/**< @brief The watch list, for streams that notify per FCB */
+  rlnode evq_items;			/**< @brief The registrations of the stream with event queues */
 } FCB;
 
 
@@ -54,42 +57,129 @@ int null_read(void* this, char *buf, unsigned int size);
 
 int pipe_write(void* this, const char* buf, unsigned int size);
 int pipe_read(void* this, char *buf, unsigned int size);
+int pipe_writev(void* this, const iovec_t* iov, unsigned int iovcnt);
+int pipe_readv(void* this, const iovec_t* iov, unsigned int iovcnt);
+
+int pipe_fast_read(void* this, char *buf, unsigned int size);
+int pipe_fast_write(void* this, const char* buf, unsigned int size);
 
 int pipe_reader_close(void* this);
 int pipe_writer_close(void* this);
 
-file_ops reader_file_ops;
-file_ops writer_file_ops;
+int pipe_reader_poll(void* this, int events, stream_watch* watch);
+int pipe_writer_poll(void* this, int events, stream_watch* watch);
+
+extern file_ops reader_file_ops;
+extern file_ops writer_file_ops;
+
+
+/*
+	The buffer of a pipe is a single-producer/single-consumer ring.
+	r_position and w_position count all the bytes ever read and written,
+	and are accessed atomically, so that one reader and one writer can
+	copy data at the same time, with or without the kernel lock.
+	Readers (and writers) exclude each other by r_lock (w_lock).
+
+	In packet mode, each record is stored in the ring as a header
+	holding its length, followed by its bytes.
 
+	The ring is held in BUFFER, unless it was resized beyond
+	PIPE_BUFFER_SIZE (see pipe_resize). Its size is always a power of 2.
 
+	Readers are woken only when lowat bytes are available. If the writer
+	coalesces, readers are woken only when PIPE_COALESCE_BYTES are
+	available, and otherwise wake up after PIPE_COALESCE_DELAY.
+
+	Each end remembers the thread that last moved data through it, and
+	the core it ran on, so that the other end can tell whether it is
+	still running. The spin budgets are the average spin lengths that
+	found the ring ready.
+ */
 typedef struct pipe_control_block
 {
 	FCB *reader, *writer;
 	CondVar has_space;
 	CondVar has_data;
-	int w_position, r_position;
-	int	numOfElem;
+	int readers_waiting;	// threads sleeping on has_data
+	int writers_waiting;	// threads sleeping on has_space
+	Mutex r_lock, w_lock;	// held while copying out of (into) the ring
+	int packet;				// set in packet mode
+	unsigned int w_position, r_position;
+	unsigned int size;		// the size of the ring
+	char *buffer;			// the ring, BUFFER or a larger heap buffer
+	unsigned int lowat;		// the minimum number of bytes a read waits for
+	int coalesce;			// set if small writes do not wake the readers
+	struct connection_block *conn;	// the connection holding the pipe, or NULL
+	struct thread_control_block *r_thread, *w_thread;	// the last reader (writer)
+	unsigned int r_core, w_core;	// the core of r_thread (w_thread)
+	unsigned int r_spin, w_spin;	// the spin budgets of the readers (writers)
 	char BUFFER[PIPE_BUFFER_SIZE];
 } pipe_cb;
 
+/* the number of bytes in the ring */
+static inline unsigned int pipe_fill(pipe_cb* pp)
+{
+	return __atomic_load_n(&pp->w_position, __ATOMIC_ACQUIRE)
+		- __atomic_load_n(&pp->r_position, __ATOMIC_ACQUIRE);
+}
+
+/* the free space in the ring */
+static inline unsigned int pipe_space(pipe_cb* pp)
+{
+	return pp->size - pipe_fill(pp);
+}
+
+#define PIPE_COALESCE_BYTES 512
+#define PIPE_COALESCE_DELAY 10000	/* usec */
+
+/* the length of a record header, in packet mode */
+#define PIPE_RECORD_HEADER (sizeof(unsigned int))
+
+pipe_cb* pipe_create(FCB* reader, FCB* writer, int flags);
+void pipe_init(pipe_cb* pp, FCB* reader, FCB* writer, int flags);
+int pipe_resize(pipe_cb* pp, unsigned int size);
+int pipe_splice(pipe_cb *src, pipe_cb *dst, unsigned int len, int src_nonblocking, int dst_nonblocking);
+
+/*
+	A connection holds the two pipes of a pair of peer sockets, so that
+	both directions are allocated, and recycled, together. It is
+	released when both of its pipes are released.
+ */
+typedef struct connection_block {
+	pipe_cb pipe[2];
+	int pipes_open;			// the pipes not yet released
+} connection_cb;
+
+void connection_release(connection_cb* conn);
+
 /**
 type of sockets
 */
 enum socket_type {
 	SOCKET_LISTENER, 
 	SOCKET_UNBOUND,
-	SOCKET_PEER
+	SOCKET_PEER,
+	SOCKET_DATAGRAM,
+	SOCKET_GATEWAY
 };
 
 typedef struct listener_socket_block listener_socket;
 typedef struct unbound_socket_block unbound_socket;
 typedef struct peer_socket_block peer_socket;
+typedef struct datagram_socket_block datagram_socket;
+typedef struct gateway_socket_block gateway_socket;
 typedef struct socket_control_block socket_cb;
 
 
 typedef struct listener_socket_block{
 	rlnode queue;
 	CondVar req_available;
+	unsigned int pending;	// the length of the queue
+	unsigned int backlog;	// the maximum length of the queue
+	rlnode port_node;		// node in the listener list of the port
+	int closed;				// set when the listener is closed
+	int gateway;			// set if a host gateway serves the port
+	stream_watch gateway_watch;	// woken by the gateway interrupts
 }listener_socket;
 
 typedef struct unbound_socket_block
@@ -102,30 +192,67 @@ typedef struct peer_socket_block
 	socket_cb *peer;
 	pipe_cb *write_pipe;
 	pipe_cb *read_pipe;
+	port_t peer_port;		// the port of the peer
+	rlnode conn_node;		// node in the connection table
 }peer_socket;
 
+typedef struct datagram_socket_block
+{
+	rlnode queue;			// the received datagrams
+	unsigned int count;		// the length of the queue
+	CondVar has_data;		// RecvFrom sleeps here
+}datagram_socket;
+
+/* a socket serving a host connection of a gateway */
+typedef struct gateway_socket_block
+{
+	int channel;			// the gateway channel
+	int read_shut;			// set by ShutDown for reading
+	int write_shut;			// set by ShutDown for writing
+}gateway_socket;
+
 typedef struct socket_control_block{
 	uint refcount;
 	FCB *fcb;
 	enum socket_type type;
 	port_t port;
+	int flags;				// the stream_flags of the socket
 
 	union{
 		listener_socket listener_s;
 		unbound_socket unbound_s;
 		peer_socket peer_s;
+		datagram_socket datagram_s;
+		gateway_socket gateway_s;
 	};
 
 }socket_cb;
 
 typedef struct connection_request {
-	int admitted;
-	socket_cb *peer;
+	int admitted;			// 1 when accepted, -1 when refused
+	socket_cb *peer;		// the connecting socket, or NULL for a gateway
+	socket_cb *listener;	// the listener queueing the request
+	int channel;			// the gateway channel, if peer is NULL
 
 	CondVar connected_cv;
 	rlnode queue_node;
 }connection_request;
 
+/*
+	The sockets bound to a port: its listeners and its datagram socket.
+	A port has several listeners only if they were all created with
+	REUSE_PORT. A port is in use while it has a group, that is, while
+	some socket is bound to it.
+ */
+typedef struct port_group {
+	port_t port;
+	rlnode hash_node;		// node in the port table
+	unsigned int sockets;	// the number of sockets bound to the port
+	rlnode listeners;		// the listeners, in round-robin order
+	int flags;				// the stream_flags of the listeners
+	socket_cb *datagram;	// the datagram socket of the port, or NULL
+}port_group;
+
 /** 
   @brief Initialization for files and streams.
 
@@ -133,6 +260,27 @@ typedef struct connection_request {
  */
 void initialize_files();
 
+/** 
+  @brief Initialization for sockets.
+
+  This function is called at kernel startup.
+ */
+void initialize_sockets();
+
+
+/**
+	@brief Connect a socket, as @c Connect, unless it is cancelled.
+
+	While the connection request waits for a listener, @c *waiting points
+	to the condition variable it sleeps on. Setting @c *cancel and then
+	broadcasting @c *waiting makes the call fail.
+
+	@param cancel the cancel flag, or NULL
+	@param waiting where to publish the condition variable, or NULL
+	@returns 0 on success, -1 on error or if cancelled
+*/
+int socket_connect(Fid_t sock, port_t port, timeout_t timeout, const int* cancel, CondVar** waiting);
+
 
 /**
 	@brief Increase the reference count of an fcb 
@@ -145,10 +293,14 @@ void FCB_incref(FCB* fcb);
 /**
 	@brief Decrease the reference count of the fcb.
 
-	If the reference count drops to 0, release the FCB, calling the 
-	Close method and returning its return value.
+	If the reference count drops to 0, release the FCB, removing its
+	event queue registrations and calling the Close method, and 
+	returning its return value.
 	If the reference count is still >0, return 0. 
 
+	This must be called with the kernel lock held, since it may close
+	the stream.
+
 	@param fcb  the fcb whose reference count is decreased
 	@returns if the reference count is still >0, return 0, else return the value returned by the
 	     `Close()` operation
@@ -196,6 +348,115 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb);
 void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 
 
+/** @brief The initial size of a file id table. */
+#define FIDT_MIN_SIZE 16
+
+/** @brief The number of fids in a word of the bitmap of a file id table. */
+#define FID_MAP_BITS (8*sizeof(unsigned long))
+
+
+/** @brief Initialize the file id table of a new process.
+
+   The table has room for @c size fids, rounded up to a power of 2,
+   and is empty.
+
+   @param pcb the new process
+   @param size the initial size of the table
+   @param limit the maximum number of fids of the process
+*/
+void FIDT_init(PCB* pcb, unsigned int size, unsigned int limit);
+
+
+/** @brief Set a fid of a process to an FCB, or to NULL.
+
+   The table grows as needed, by doubling.
+
+   @param pcb the process
+   @param fid the fid, less than the fid limit of the process
+   @param fcb the FCB, or NULL to free the fid
+*/
+void FIDT_set(PCB* pcb, Fid_t fid, FCB* fcb);
+
+
+/** @brief Copy the open fids of a process to a new process.
+
+   Each copied FCB gains a reference. Only the occupied entries are visited.
+*/
+void FIDT_inherit(PCB* newproc, PCB* parent);
+
+
+/** @brief Close all the fids of a process and release its table. */
+void FIDT_release(PCB* pcb);
+
+
+/** @brief Add a watch to the watch list of a stream.
+
+   This is called by the @c Poll method of a stream, to register
+   @c watch for notifications.
+
+   @param watchers the watch list of the stream
+   @param watch the watch to add
+   @param lock the spinlock protecting @c watchers, or NULL if the list
+      is protected by the kernel lock
+*/
+void stream_watch_add(rlnode* watchers, stream_watch* watch, Mutex* lock);
+
+
+/** @brief Remove a watch from the watch list it was added to. 
+
+   @param watch a watch previously added by @ref stream_watch_add
+*/
+void stream_unwatch(stream_watch* watch);
+
+
+/** @brief Notify all the watches of a watch list.
+
+   Streams call this whenever their readiness may have changed.
+   If the watch list is protected by a spinlock, the caller must hold it.
+
+   @param watchers the watch list of the stream
+*/
+void stream_notify(rlnode* watchers);
+
+
+/** @brief Remove the registrations of a stream from their event queues.
+
+   This is called when the stream is closed, since registrations do
+   not keep a stream open.
+
+   @param fcb the stream, whose reference count has dropped to 0
+*/
+void evq_release_stream(FCB* fcb);
+
+
+/** @brief A slab cache.
+
+	A slab cache recycles objects of one size through a free list, so
+	that frequently created objects avoid @c malloc. When the free list 
+	is empty, it is refilled with a whole slab of objects, allocated at 
+	once. Slabs are never returned to @c malloc. 
+
+	A free object holds its free list node in its first bytes.
+	Caches are protected by the kernel lock.
+*/
+typedef struct slab_cache {
+	rlnode free;			/**< @brief The free objects */
+	size_t size;			/**< @brief The size of the objects */
+	unsigned int per_slab;	/**< @brief The number of objects in a slab */
+} slab_cache;
+
+/** @brief Static initializer for a slab cache of objects of @c type. */
+#define SLAB_CACHE_INIT(cache, type, n) \
+	{ .free = { .obj = NULL, .prev = &(cache).free, .next = &(cache).free }, \
+	  .size = sizeof(type), .per_slab = (n) }
+
+/** @brief Allocate an object from a slab cache. */
+void* slab_alloc(slab_cache* cache);
+
+/** @brief Return an object to its slab cache. */
+void slab_free(slab_cache* cache, void* obj);
+
+
 /** @brief Translate an fid to an FCB.
 
 	This routine will return NULL if the fid is not legal.
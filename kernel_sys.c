@@ -41,6 +41,18 @@ void NAME SIG \
 	POST_CALL\
 }\
 
+/* with a fast path */
+#define SYSCALLF(NAME, RET, SIG, ARGS)\
+RET NAME SIG \
+{\
+	RET __ret = fast_##NAME ARGS;\
+	if(__ret != -1) return __ret;\
+	PRE_CALL\
+	__ret = sys_##NAME ARGS;\
+	POST_CALL\
+	return __ret;\
+}\
+
 
 SYSCALLS
 
@@ -7,6 +7,7 @@
 #define SYSCALLS \
 SYSCALL(Exec, int, (Task task, int argl, void* args), (task, argl, args))\
 SYSCALLV(Exit, (int exitval), (exitval))\
+SYSCALLV(SetExitHook, (ExitHook hook), (hook))\
 SYSCALL(GetPid, int, (void), ())\
 SYSCALL(GetPPid, int, (void), ())\
 SYSCALL(WaitChild, Pid_t, (Pid_t proc, int* exitval), (proc, exitval))\
@@ -17,17 +18,54 @@ SYSCALL(ThreadDetach, int, (Tid_t tid), (tid))\
 SYSCALLV(ThreadExit, (int exitval), (exitval))\
 SYSCALL(GetTerminalDevices, unsigned int, (), ())\
 SYSCALL(OpenTerminal, Fid_t, (unsigned int termno), (termno))\
+SYSCALL(IsTerminal, int, (Fid_t fd), (fd))\
 SYSCALL(OpenNull, Fid_t, (), ())\
-SYSCALL(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
-SYSCALL(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
+SYSCALLF(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
+SYSCALLF(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
+SYSCALL(ReadV,int,(Fid_t fd, const iovec_t* iov, unsigned int iovcnt), (fd,iov,iovcnt))\
+SYSCALL(WriteV,int,(Fid_t fd, const iovec_t* iov, unsigned int iovcnt), (fd,iov,iovcnt))\
+SYSCALL(CopyStream,int,(Fid_t in, Fid_t out, unsigned int len), (in,out,len))\
+SYSCALL(Poll,int,(pollfd_t* fds, unsigned int nfds, timeout_t timeout), (fds,nfds,timeout))\
+SYSCALL(SetNonBlocking,int,(Fid_t fd, int nonblocking), (fd,nonblocking))\
+SYSCALL(EventQueue_Create, Fid_t, (), ())\
+SYSCALL(EventQueue_Ctl, int, (Fid_t evq, evq_op op, Fid_t fd, int events, uintptr_t data), (evq, op, fd, events, data))\
+SYSCALL(EventQueue_Wait, int, (Fid_t evq, evq_event_t* events, unsigned int maxevents, timeout_t timeout), (evq, events, maxevents, timeout))\
 SYSCALL(Close,int,(Fid_t fd),(fd))\
 SYSCALL(Dup2,int, (Fid_t oldfd, Fid_t newfd), (oldfd,newfd))\
+SYSCALL(SetFileLimit, int, (unsigned int limit), (limit))\
 SYSCALL(Pipe, int, (pipe_t* pipe), (pipe))\
+SYSCALL(Pipe2, int, (pipe_t* pipe, int flags), (pipe, flags))\
+SYSCALL(MsgQueue, Fid_t, (unsigned int maxmsg, unsigned int msgsize), (maxmsg, msgsize))\
+SYSCALL(MsgSend, int, (Fid_t mq, const char* buf, unsigned int size, unsigned int prio), (mq, buf, size, prio))\
+SYSCALL(MsgReceive, int, (Fid_t mq, msg_t* msgs, unsigned int count), (mq, msgs, count))\
+SYSCALL(ShmCreate, void*, (const char* name, unsigned int size), (name, size))\
+SYSCALL(ShmAttach, void*, (const char* name, unsigned int* size), (name, size))\
+SYSCALL(ShmRelease, int, (void* addr), (addr))\
+SYSCALL(Open, Fid_t, (const char* path, int flags), (path, flags))\
+SYSCALL(Seek, long, (Fid_t fd, long offset, seek_origin whence), (fd, offset, whence))\
+SYSCALL(Stat, int, (const char* path, stat_t* st), (path, st))\
+SYSCALL(MkDir, int, (const char* path), (path))\
+SYSCALL(RmDir, int, (const char* path), (path))\
+SYSCALL(Unlink, int, (const char* path), (path))\
+SYSCALL(MapFile, void*, (Fid_t fd, unsigned long offset, unsigned int* size), (fd, offset, size))\
+SYSCALL(OpenHostFile, Fid_t, (const char* path, int flags), (path, flags))\
 SYSCALL(Socket, Fid_t, (port_t port), (port))\
+SYSCALL(Socket2, Fid_t, (port_t port, int flags), (port, flags))\
 SYSCALL(Listen, int, (Fid_t sock), (sock))\
+SYSCALL(Listen2, int, (Fid_t sock, unsigned int backlog), (sock, backlog))\
 SYSCALL(Accept, Fid_t, (Fid_t lsock), (lsock))\
+SYSCALL(AcceptMany, int, (Fid_t lsock, Fid_t* fids, unsigned int n), (lsock, fids, n))\
 SYSCALL(Connect, int, (Fid_t sock, port_t port, timeout_t timeout), (sock, port, timeout))\
+SYSCALL(SocketPair, int, (Fid_t fids[2]), (fids))\
+SYSCALL(GetSockName, int, (Fid_t sock, port_t* port), (sock, port))\
+SYSCALL(GetPeerName, int, (Fid_t sock, port_t* port), (sock, port))\
 SYSCALL(ShutDown, int, (Fid_t sock, shutdown_mode how), (sock, how))\
+SYSCALL(SetSockOpt, int, (Fid_t sock, socket_option opt, unsigned int value), (sock, opt, value))\
+SYSCALL(GetSockOpt, int, (Fid_t sock, socket_option opt, unsigned int* value), (sock, opt, value))\
+SYSCALL(SendTo, int, (Fid_t sock, port_t port, const char* buf, unsigned int size), (sock, port, buf, size))\
+SYSCALL(RecvFrom, int, (Fid_t sock, char* buf, unsigned int size, port_t* port), (sock, buf, size, port))\
+SYSCALL(IoRing_Create, Fid_t, (unsigned int entries, io_ring_t** ring), (entries, ring))\
+SYSCALL(IoRing_Enter, int, (Fid_t ring, unsigned int to_submit, unsigned int min_complete, timeout_t timeout), (ring, to_submit, min_complete, timeout))\
 SYSCALL(OpenInfo, Fid_t, (), ())\
 
 
@@ -39,9 +77,16 @@ RET sys_ ## NAME SIG;
 #define SYSCALLV(NAME, SIG, ARGS)\
 void sys_ ## NAME SIG;
 
+/* with a fast path, which runs without the kernel lock and
+   returns -1 when the call must be retried by sys_NAME */
+#define SYSCALLF(NAME, RET, SIG, ARGS)\
+RET sys_ ## NAME SIG;\
+RET fast_ ## NAME SIG;
+
 SYSCALLS
 
 #undef SYSCALL
 #undef SYSCALLV
+#undef SYSCALLF
 
 #endif
\ No newline at end of file
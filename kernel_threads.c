@@ -4,6 +4,8 @@
 #include "kernel_proc.h"
 #include "kernel_cc.h"
 #include "kernel_streams.h"
+#include "kernel_shm.h"
+#include "kernel_ioring.h"
 #include "kernel_sys.h"
 
 
@@ -168,10 +170,24 @@ void sys_ThreadExit(int exitval){
   PCB* curproc = CURPROC;
   TCB *curthread = cur_thread();
 
+  /* The last thread runs the exit hook, outside the kernel, since it may
+     make system calls. No other thread of the process is left to race. */
+  if(curproc->thread_count == 1 && curproc->exit_hook != NULL) {
+    ExitHook hook = curproc->exit_hook;
+    curproc->exit_hook = NULL;
+    kernel_unlock();
+    hook();
+    kernel_lock();
+  }
+
   // thread count is the number of active threads of the current process
   curproc->thread_count--;
   int remainingThreads = curproc->thread_count;
 
+  /* The workers of the I/O rings must not keep the process alive */
+  if(remainingThreads > 0 && remainingThreads == curproc->ioring_workers)
+    ioring_cancel_all(curproc);
+
 
   if(remainingThreads==0){// cleanup process children if it is not init
     if (get_pid(curproc)!=1){
@@ -207,13 +223,11 @@ void sys_ThreadExit(int exitval){
       curproc->args = NULL;
     }
 
+    /* Release the shared memory attachments */
+    shm_release_all(curproc);
+
     /* Clean up FIDT */
-    for(int i=0;i<MAX_FILEID;i++) {
-      if(curproc->FIDT[i] != NULL) {
-        FCB_decref(curproc->FIDT[i]);
-        curproc->FIDT[i] = NULL;
-      }
-    }
+    FIDT_release(curproc);
 
     /* Disconnect my main_thread */
     curproc->main_thread = NULL;
@@ -231,19 +245,11 @@ void sys_ThreadExit(int exitval){
       Delete all the PTCBs from current process 
     */
     rlnode* List = &curproc->ptcb_list;
-    rlnode* front= List->next; 
-    rlnode* previous = front;
 
-    while(front!=List) {
-      // free the ptcb
-      PTCB* ptcb_to_delete = front->ptcb;
+    while(! is_rlist_empty(List)) {
+      // unlink the ptcb before freeing it, its node is inside it
+      PTCB* ptcb_to_delete = rlist_pop_front(List)->ptcb;
       free(ptcb_to_delete);
-      
-      previous = front;
-      front = front->next;
-
-      rlist_remove(previous);
-    
     }
   
 }
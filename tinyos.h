@@ -45,10 +45,14 @@ typedef unsigned long timeout_t;
 /** @brief The type of a file ID. */
 typedef int Fid_t;  
 
-/** @brief The maximum number of open files per process. 
-   Only values 0 to MAX_FILEID-1 are legal for file descriptors. */
+/** @brief The default maximum number of open files per process. 
+   Only values 0 to MAX_FILEID-1 are legal for file descriptors, unless
+   the limit is changed by @ref SetFileLimit. */
 #define MAX_FILEID 16
 
+/** @brief The largest limit of open files per process. */
+#define MAX_FILEID_LIMIT 65536
+
 /** @brief The invalid file id. */
 #define NOFILE  (-1)
 
@@ -255,6 +259,25 @@ Pid_t Exec(Task task, int argl, void* args);
    */
 void Exit(int val);
 
+
+/** @brief A function run when a process ends.
+  @see SetExitHook
+ */
+typedef void (*ExitHook)(void);
+
+/** @brief Set the exit hook of the current process.
+
+  The exit hook is called by the last thread of the process, as it exits
+  (by @c Exit, by @c ThreadExit, or by returning from its function), before
+  the process releases its resources. Thus, the hook may still use the file
+  ids of the process, e.g., to flush buffered output. It is called once; 
+  a new process starts without a hook.
+
+  @param hook the new hook, or NULL for none
+  @see Exit
+ */
+void SetExitHook(ExitHook hook);
+
 /** @brief Wait on a terminating child.
 
    This function will return the exit status of a terminated 
@@ -400,6 +423,16 @@ unsigned int GetTerminalDevices();
 Fid_t OpenTerminal(unsigned int termno);
 
 
+/** @brief Check whether a file id refers to a terminal.
+
+  @param fd the file id to check
+  @return 1 if @c fd is a stream on a terminal device, 0 if it is another
+    stream, and -1 if @c fd is not a legal file id.
+  @see OpenTerminal
+ */
+int IsTerminal(Fid_t fd);
+
+
 /** @brief Open a stream on the null device.
 
   The null device is a virtual device representing an "infinite"
@@ -489,6 +522,288 @@ int Close(Fid_t fd);
  */
 int Dup2(Fid_t oldfd, Fid_t newfd);
 
+
+/** @brief Set the limit of open files of the current process.
+
+  After the call, the legal file ids of the process are 0 to @c limit-1.
+  The file id table of the process grows on demand, so that a high limit
+  costs nothing until the file ids are used. The limit is inherited by
+  the children created by @c Exec.
+
+  @param limit the new limit
+  @return This call returns 0 on success and -1 on failure.
+  Possible reasons for failure:
+  - @c limit is 0 or greater than @c MAX_FILEID_LIMIT.
+  - Some file id not less than @c limit is open.
+ */
+int SetFileLimit(unsigned int limit);
+
+
+/**
+  @brief A buffer segment for vectored I/O.
+
+  An array of these is passed to @c ReadV and @c WriteV, describing
+  a sequence of buffers that are filled (respectively, drained)
+  in order, as if they were one contiguous buffer.
+
+  @see ReadV
+  @see WriteV
+ */
+typedef struct iovec_s {
+  char* buf;            /**< @brief The start of the segment */
+  unsigned int size;    /**< @brief The size of the segment in bytes */
+} iovec_t;
+
+
+/** @brief Read bytes from a stream into several buffers.
+
+  This call behaves like @c Read, except that the data is scattered
+  into the @c iovcnt segments of array @c iov, filling each segment
+  before moving to the next one. The whole operation is performed
+  in a single call into the stream, therefore it blocks at most once,
+  exactly when @c Read would block.
+
+  @param fd  the file ID of the stream to read from
+  @param iov an array of @c iovcnt buffer segments
+  @param iovcnt the number of segments in @c iov
+  @return the total number of bytes copied, 0 if we have reached EOF, or -1,
+        indicating some error. Possible errors are:
+         - The file descriptor is invalid.
+         - @c iov is NULL while @c iovcnt is positive.
+         - The total size of the segments exceeds @c INT_MAX.
+         - There was a I/O runtime problem.
+  @see Read
+ */
+int ReadV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt);
+
+
+/** @brief Write bytes to a stream from several buffers.
+
+  This call behaves like @c Write, except that the data is gathered
+  from the @c iovcnt segments of array @c iov, in order. The whole
+  operation is performed in a single call into the stream, so that
+  e.g. a message header and its payload can be sent together. For
+  streams without vectored operations (e.g. message queues), this 
+  holds for up to 4096 bytes; a larger vector is written one segment
+  at a time.
+
+  @param fd  the file ID of the stream to write to
+  @param iov an array of @c iovcnt buffer segments
+  @param iovcnt the number of segments in @c iov
+  @return the total number of bytes copied from the segments, or -1 on error.
+   Possible errors are:
+   - The file id is invalid.
+   - @c iov is NULL while @c iovcnt is positive.
+   - The total size of the segments exceeds @c INT_MAX.
+   - There was a I/O runtime problem.
+  @see Write
+ */
+int WriteV(Fid_t fd, const iovec_t* iov, unsigned int iovcnt);
+
+
+/** @brief Copy data from one stream to another, inside the kernel.
+
+  This call reads from stream @c in and writes what it reads to stream
+  @c out, until @c len bytes are copied, or @c in has no more data ready
+  after some was copied, or @c in reaches the end of data.
+  It saves a program that relays data (e.g., from a socket to a pipe)
+  the loop of @c Read and @c Write calls through a buffer of its own.
+  When both streams are pipes or connected sockets, the data is copied
+  directly from one pipe buffer to the other.
+
+  The call blocks as a @c Read of @c in and a @c Write of @c out would.
+  If either stream is non-blocking and would block before any data is
+  copied, @c WOULDBLOCK is returned.
+
+  @param in the file id of the stream to read from
+  @param out the file id of the stream to write to
+  @param len the maximum number of bytes to copy
+  @return the number of bytes copied, 0 if @c in is at the end of data,
+   @c WOULDBLOCK, or -1 on error. Possible errors are:
+   - Either file id is invalid.
+   - Either stream cannot be read (written) or is closed.
+   - There was a I/O runtime problem.
+ */
+int CopyStream(Fid_t in, Fid_t out, unsigned int len);
+
+
+/*******************************************
+ *
+ * I/O multiplexing
+ *
+ *******************************************/
+
+/**
+  @brief The return value of I/O calls on a non-blocking stream that is not ready.
+
+  @see SetNonBlocking
+ */
+#define WOULDBLOCK (-2)
+
+/**
+  @brief Stream readiness events.
+
+  These bits are combined in the @c events and @c revents fields
+  of @c pollfd_t.
+
+  @see Poll
+ */
+typedef enum {
+  POLL_READ=1,      /**< A read (or @c Accept) will not block. */
+  POLL_WRITE=2,     /**< A write will not block. */
+  POLL_ERROR=4,     /**< The stream is in an error state (output only). */
+  POLL_HANGUP=8,    /**< The other end of the stream is closed (output only). */
+  POLL_INVALID=16,  /**< The file id is not open (output only). */
+  POLL_EDGE=32      /**< Edge-triggered registration (@c EventQueue_Ctl only). */
+} poll_event;
+
+/**
+  @brief A file id, together with the events to wait for.
+
+  @see Poll
+ */
+typedef struct pollfd_s {
+  Fid_t fd;         /**< @brief The file id to poll, or @c NOFILE to skip this entry */
+  int events;       /**< @brief The requested events, a combination of @c poll_event bits */
+  int revents;      /**< @brief The returned events, filled by @c Poll */
+} pollfd_t;
+
+
+/** @brief Wait for some of a set of streams to become ready.
+
+  For each of the @c nfds entries of @c fds, the @c revents field
+  is filled with the subset of the requested @c events that are ready,
+  plus @c POLL_ERROR, @c POLL_HANGUP or @c POLL_INVALID, which are
+  reported even if they were not requested. Entries whose @c fd is
+  @c NOFILE are ignored.
+
+  If no entry is ready, the call blocks until one becomes ready, or
+  the timeout expires.
+
+  Pipes, sockets (including listening sockets, which become readable
+  when an @c Accept will not block) and terminals support polling.
+  Other streams are always reported as ready.
+
+  @param fds an array of @c nfds entries
+  @param nfds the number of entries in @c fds
+  @param timeout the maximum time to wait in milliseconds. A timeout of 0
+         returns immediately, and a timeout of @c (timeout_t)-1 means
+         "infinite timeout".
+  @returns the number of entries with a non-zero @c revents, 0 if the
+        timeout expired, or -1 on error. Possible reasons for error:
+        - @c fds is NULL while @c nfds is positive.
+ */
+int Poll(pollfd_t* fds, unsigned int nfds, timeout_t timeout);
+
+
+/** @brief Set or clear the non-blocking mode of a stream.
+
+  When a stream is in non-blocking mode, the calls @c Read, @c Write,
+  @c ReadV, @c WriteV return @c WOULDBLOCK instead of blocking, and
+  @c Accept returns @c NOFILE if no connection is pending.
+
+  The mode is a property of the stream, therefore it is shared by all
+  file ids that refer to it (e.g., copies made by @c Dup2 or @c Exec).
+
+  @param fd the file id of the stream
+  @param nonblocking non-zero to set non-blocking mode, zero to clear it
+  @returns 0 on success and -1 on error. Possible reasons for error:
+     - The file id is invalid.
+ */
+int SetNonBlocking(Fid_t fd, int nonblocking);
+
+
+/**
+  @brief Operations for @c EventQueue_Ctl.
+ */
+typedef enum {
+  EVQ_ADD=1,    /**< Register a stream with the event queue. */
+  EVQ_MOD=2,    /**< Change the events and data of a registered stream. */
+  EVQ_DEL=3     /**< Remove a stream from the event queue. */
+} evq_op;
+
+/**
+  @brief An event returned by an event queue.
+
+  @see EventQueue_Wait
+ */
+typedef struct evq_event_s {
+  Fid_t fd;         /**< @brief The file id that was registered */
+  int events;       /**< @brief The ready events, a combination of @c poll_event bits */
+  uintptr_t data;   /**< @brief The user data given at registration */
+} evq_event_t;
+
+
+/** @brief Create a new event queue.
+
+  An event queue keeps a persistent set of streams of interest. The
+  streams push readiness notifications into the queue as their state
+  changes, so that @c EventQueue_Wait costs time proportional to the
+  number of ready streams, not to the number of registered streams.
+
+  The queue is accessed through the returned file id, and it is
+  destroyed when this is closed.
+
+  @returns a file id for the new event queue, or NOFILE on error. Possible
+    reasons for error:
+    - the available file ids for the process are exhausted.
+  @see EventQueue_Ctl
+  @see EventQueue_Wait
+ */
+Fid_t EventQueue_Create();
+
+
+/** @brief Change the interest set of an event queue.
+
+  With @c EVQ_ADD, stream @c fd is registered for the given @c events
+  (a combination of @c POLL_READ and @c POLL_WRITE), together with an
+  arbitrary user value @c data. If @c POLL_EDGE is also given, the
+  registration is edge-triggered: the stream is reported once each time
+  it becomes ready. Else, it is level-triggered: it is reported by every
+  @c EventQueue_Wait, as long as it is ready.
+
+  With @c EVQ_MOD, the events and data of a registered stream are
+  replaced. With @c EVQ_DEL, the stream is removed (@c events and
+  @c data are ignored).
+
+  As with @c Poll, a registration does not keep the stream open: when
+  the stream is closed, i.e., its last file id is closed, it is removed
+  from the event queue. Copies of @c fd (e.g., made by @c Dup2) keep the
+  stream, and its registration.
+
+  @param evq the file id of the event queue
+  @param op the operation
+  @param fd the file id of the stream
+  @param events the events of interest, plus optionally @c POLL_EDGE
+  @param data a value returned with each event for this stream
+  @returns 0 on success and -1 on error. Possible reasons for error:
+    - @c evq is not an event queue.
+    - @c fd is not a valid file id, or the stream does not support polling.
+    - for @c EVQ_ADD, the stream is already registered.
+    - for @c EVQ_MOD and @c EVQ_DEL, the stream is not registered.
+ */
+int EventQueue_Ctl(Fid_t evq, evq_op op, Fid_t fd, int events, uintptr_t data);
+
+
+/** @brief Wait for events on an event queue.
+
+  Up to @c maxevents ready streams are returned in array @c events.
+  If no stream is ready, the call blocks until one becomes ready, or
+  the timeout expires.
+
+  @param evq the file id of the event queue
+  @param events an array of at least @c maxevents elements
+  @param maxevents the maximum number of events to return
+  @param timeout the maximum time to wait in milliseconds. A timeout of 0
+         returns immediately, and a timeout of @c (timeout_t)-1 means
+         "infinite timeout".
+  @returns the number of events stored in @c events, 0 if the timeout
+    expired, or -1 on error. Possible reasons for error:
+    - @c evq is not an event queue.
+    - @c events is NULL or @c maxevents is 0.
+ */
+int EventQueue_Wait(Fid_t evq, evq_event_t* events, unsigned int maxevents, timeout_t timeout);
+
 /*******************************************
  *
  * Pipes
@@ -531,6 +846,447 @@ typedef struct pipe_s {
 */
 int Pipe(pipe_t* pipe);
 
+
+/**
+	@brief Stream creation flags.
+
+	These flags can be passed to @c Pipe2 and @c Socket2.
+*/
+typedef enum {
+	PACKET_MODE = 1,	/**< Preserve message boundaries. */
+	REUSE_PORT = 2,		/**< Allow several listeners on a port (sockets only). */
+	DATAGRAM = 4		/**< Create a connectionless socket (sockets only). */
+} stream_flags;
+
+/**
+	@brief The maximum size of a record in packet mode.
+*/
+#define MAX_PACKET_SIZE 4096
+
+
+/**
+	@brief Construct and return a pipe, with the given flags.
+
+	Without flags, this call is equivalent to @c Pipe.
+
+	If @c PACKET_MODE is given, the pipe preserves message boundaries:
+	each @c Write (or @c WriteV) of @c n bytes, 0 < n <= MAX_PACKET_SIZE, 
+	is stored as one record, which is delivered as a whole by a single 
+	@c Read (or @c ReadV). The writer blocks until the whole record fits 
+	in the buffer. If the buffer of the reader is smaller than the record, 
+	the excess bytes of the record are discarded. A write of 0 bytes 
+	stores no record and returns 0. A packet-mode pipe is reported 
+	writable by @c Poll when a record of @c MAX_PACKET_SIZE bytes fits.
+
+	@param pipe a pointer to a pipe_t structure for storing the file ids.
+	@param flags a combination of @c stream_flags
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the available file ids for the process are exhausted.
+		- the flags are not legal.
+	@see Pipe
+*/
+int Pipe2(pipe_t* pipe, int flags);
+
+/*******************************************
+ *
+ * Message queues
+ *
+ *******************************************/
+
+/**
+	@brief The number of message priorities.
+
+	Message priorities are integers from 0 to @c MSGQ_PRIORITIES-1. 
+	Messages of higher priority are received first.
+*/
+#define MSGQ_PRIORITIES 32
+
+/**
+	@brief The maximum number of messages in a message queue.
+*/
+#define MAX_MSGQ_MESSAGES 4096
+
+/**
+	@brief The maximum size of a message.
+*/
+#define MAX_MSG_SIZE 4096
+
+
+/**
+	@brief A message buffer, for @c MsgReceive.
+*/
+typedef struct msg_s {
+	char* buf;			/**< The buffer for the message */
+	unsigned int size;	/**< On call, the size of @c buf; on return, the size of the message */
+	unsigned int prio;	/**< On return, the priority of the message */
+} msg_t;
+
+
+/**
+	@brief Create a message queue.
+
+	A message queue holds up to @c maxmsg discrete messages of up to @c msgsize
+	bytes each, in storage allocated when the queue is created. Any number of 
+	threads and processes (which inherit the file id by @c Exec) can send 
+	messages to the queue and receive messages from it.
+
+	Messages are received in order of decreasing priority, and in FIFO order
+	among messages of the same priority. A message is always received whole
+	by a single receiver; if the receiver's buffer is smaller than the message,
+	the excess bytes are discarded.
+
+	The queue is a stream: @c Write sends one message of priority 0, and
+	@c Read receives one message, returning its size. Both block, unless the
+	stream is in non-blocking mode. Messages are never empty, so @c Read 
+	never returns 0: a @c Write of 0 bytes fails, and so does a @c Read 
+	into a buffer of size 0, which leaves the queue unchanged. @c Poll reports the queue readable when it
+	holds a message, and writable when it has room for one.
+
+	@param maxmsg the capacity of the queue, between 1 and @c MAX_MSGQ_MESSAGES
+	@param msgsize the maximum message size, between 1 and @c MAX_MSG_SIZE
+	@returns a file id for the queue, or NOFILE on error. Possible reasons for error:
+		- the arguments are not legal.
+		- the available file ids for the process are exhausted.
+	@see MsgSend
+	@see MsgReceive
+*/
+Fid_t MsgQueue(unsigned int maxmsg, unsigned int msgsize);
+
+/**
+	@brief Send a message with a priority.
+
+	The call blocks while the queue is full, unless it is in non-blocking mode.
+
+	@param mq the message queue
+	@param buf the message
+	@param size the size of the message, between 1 and the message size of the queue
+	@param prio the priority, less than @c MSGQ_PRIORITIES
+	@returns @c size on success, @c WOULDBLOCK if the queue is full in non-blocking
+		mode, or -1 on error. Possible reasons for error:
+		- @c mq is not a message queue.
+		- the size or the priority is not legal.
+*/
+int MsgSend(Fid_t mq, const char* buf, unsigned int size, unsigned int prio);
+
+/**
+	@brief Receive a batch of messages.
+
+	The call blocks while the queue is empty, unless it is in non-blocking
+	mode. Then, it receives up to @c count messages, without blocking
+	again, storing each message in the next element of @c msgs.
+
+	@param mq the message queue
+	@param msgs an array of @c count message buffers
+	@param count the number of message buffers
+	@returns the number of messages received (at least 1), @c WOULDBLOCK if the
+		queue is empty in non-blocking mode, or -1 on error. Possible reasons for error:
+		- @c mq is not a message queue.
+		- @c msgs is NULL or @c count is 0.
+*/
+int MsgReceive(Fid_t mq, msg_t* msgs, unsigned int count);
+
+
+/*******************************************
+ *
+ * Shared memory
+ *
+ *******************************************/
+
+/**
+	@brief The alignment and size granularity of shared memory regions.
+*/
+#define SHM_PAGE_SIZE 4096
+
+/**
+	@brief The maximum length of a shared memory region name, 
+	including the terminating 0.
+*/
+#define MAX_SHM_NAME 32
+
+/**
+	@brief The maximum size of a shared memory region.
+*/
+#define MAX_SHM_SIZE (16*1024*1024)
+
+
+/**
+	@brief Create a named shared memory region and attach it.
+
+	A new region of at least @c size bytes is created and attached to
+	the calling process. The region is aligned to @c SHM_PAGE_SIZE, its
+	size is rounded up to a multiple of @c SHM_PAGE_SIZE, and it is 
+	initialized to zero.
+
+	Other processes can attach the region by its name, using @c ShmAttach.
+	A region has the same address in every process that attaches it,
+	therefore processes can exchange pointers (or offsets) into the region,
+	e.g., over a pipe, instead of copying the data.
+
+	The region exists as long as it is attached by some process. Attachments
+	are not inherited by @c Exec, and they are released when a process exits.
+
+	@param name the name of the region, a non-empty string shorter than @c MAX_SHM_NAME
+	@param size the requested size of the region
+	@returns the address of the region on success, or NULL on error. Possible reasons
+		for error:
+		- the name is not legal.
+		- a region with the same name exists.
+		- the size is 0 or greater than @c MAX_SHM_SIZE.
+		- memory is exhausted.
+	@see ShmAttach
+	@see ShmRelease
+*/
+void* ShmCreate(const char* name, unsigned int size);
+
+/**
+	@brief Attach an existing shared memory region.
+
+	Each call adds an attachment of the region to the calling process,
+	which must be released by @c ShmRelease (or at process exit).
+
+	@param name the name of the region
+	@param size if not NULL, the size of the region is stored here
+	@returns the address of the region on success, or NULL on error. Possible reasons
+		for error:
+		- the name is not legal.
+		- there is no region with this name.
+	@see ShmCreate
+*/
+void* ShmAttach(const char* name, unsigned int* size);
+
+/**
+	@brief Release an attachment of a shared memory region.
+
+	When the last attachment of a region (in any process) is released, the 
+	region is destroyed and its name can be reused.
+
+	@param addr the address of the region, as returned by @c ShmCreate or @c ShmAttach
+	@returns 0 on success, -1 on error. Possible reasons for error:
+		- the calling process has no attachment of a region at @c addr.
+	@see ShmCreate
+*/
+int ShmRelease(void* addr);
+
+
+/*******************************************
+ *
+ * File system
+ *
+ *******************************************/
+
+/**
+	@brief The maximum length of a file name, including the terminating 0.
+*/
+#define MAX_FILE_NAME 64
+
+/**
+	@brief The maximum length of a path, including the terminating 0.
+*/
+#define MAX_PATH_LENGTH 256
+
+/**
+	@brief The maximum size of a file.
+*/
+#define MAX_FILE_SIZE (64ul*1024*1024)
+
+
+/**
+	@brief Flags for @c Open.
+
+	One or both of @c OPEN_READ and @c OPEN_WRITE must be given.
+*/
+typedef enum {
+	OPEN_READ=1,		/**< Open for reading. */
+	OPEN_WRITE=2,		/**< Open for writing. */
+	OPEN_RDWR=3,		/**< Open for reading and writing. */
+	OPEN_CREATE=4,		/**< Create a regular file, if it does not exist. */
+	OPEN_EXCL=8,		/**< With @c OPEN_CREATE, fail if the file exists. */
+	OPEN_TRUNCATE=16,	/**< With @c OPEN_WRITE, empty a regular file. */
+	OPEN_APPEND=32		/**< Write at the end of the file. */
+} open_flags;
+
+/**
+	@brief The origin of a @c Seek.
+*/
+typedef enum {
+	SEEK_FROM_START=0,		/**< From the start of the file. */
+	SEEK_FROM_CURRENT=1,	/**< From the current position. */
+	SEEK_FROM_END=2			/**< From the end of the file. */
+} seek_origin;
+
+/**
+	@brief The type of a file.
+*/
+typedef enum {
+	FILE_REGULAR=1,		/**< A regular file. */
+	FILE_DIRECTORY=2	/**< A directory. */
+} file_type;
+
+/**
+	@brief The attributes of a file, returned by @c Stat.
+*/
+typedef struct stat_s {
+	file_type type;		/**< The type of the file */
+	unsigned long ino;	/**< A number that is unique among the existing files */
+	unsigned long size;	/**< The size in bytes, or the number of entries of a directory */
+} stat_t;
+
+/**
+	@brief A directory entry, as read from a directory.
+*/
+typedef struct dirent_s {
+	char name[MAX_FILE_NAME];	/**< The name of the entry */
+	file_type type;				/**< The type of the file */
+} dirent_t;
+
+
+/**
+	@brief Open a file of the file system.
+
+	The file system is kept in memory, and is shared by all processes. It
+	exists from @c boot until TinyOS halts. It starts with an empty root
+	directory, @c "/". A path is a sequence of names, each preceded by one
+	or more @c '/'. Names must not contain @c '/', and must not be @c "."
+	or @c "..".
+
+	A regular file is a stream that is read and written at its current
+	position, which is advanced by each @c Read and @c Write, and moved by
+	@c Seek. Reading stops at the end of the file. Writing beyond the end
+	extends the file, and the gap reads as zeros. Reads and writes never
+	block.
+
+	A directory can only be opened for reading. Each @c Read returns as
+	many whole @c dirent_t records as fit in the buffer, and 0 after the
+	last entry.
+
+	The file exists while it is in a directory, or is open.
+
+	@param path the path of the file
+	@param flags a combination of @c open_flags
+	@returns a file id for the file, or NOFILE on error. Possible reasons for error:
+		- the path or the flags are not legal.
+		- the file does not exist, and is not created.
+		- the file exists, and @c OPEN_CREATE and @c OPEN_EXCL are given.
+		- a directory is opened for writing.
+		- the available file ids for the process are exhausted.
+	@see Seek
+	@see MapFile
+*/
+Fid_t Open(const char* path, int flags);
+
+/**
+	@brief Move the position of an open file.
+
+	The new position is @c offset bytes (entries, for a directory) from
+	the origin. It may be beyond the end of the file.
+
+	@param fd the file id of an open file
+	@param offset the offset from the origin
+	@param whence the origin
+	@returns the new position, or -1 on error. Possible reasons for error:
+		- @c fd is not an open file.
+		- the new position is negative, or larger than @c MAX_FILE_SIZE.
+*/
+long Seek(Fid_t fd, long offset, seek_origin whence);
+
+/**
+	@brief Return the attributes of a file.
+
+	@param path the path of the file
+	@param st the location for storing the attributes
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the path is not legal, or the file does not exist.
+		- @c st is NULL.
+*/
+int Stat(const char* path, stat_t* st);
+
+/**
+	@brief Create a directory.
+
+	@param path the path of the new directory
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the path is not legal, or its parent is not a directory.
+		- a file with this path exists.
+*/
+int MkDir(const char* path);
+
+/**
+	@brief Remove an empty directory.
+
+	@param path the path of the directory
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the path is not legal, or it is not a directory.
+		- the directory is the root, or it is not empty.
+*/
+int RmDir(const char* path);
+
+/**
+	@brief Remove a regular file from its directory.
+
+	The file is destroyed when it is no longer open.
+
+	@param path the path of the file
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the path is not legal, or it is not a regular file.
+*/
+int Unlink(const char* path);
+
+/**
+	@brief Map the contents of an open file.
+
+	The contents of a regular file are stored in extents, which are runs
+	of whole pages. The extents of a file never move, so a process can
+	access the bytes of a file in place, instead of copying them with
+	@c Read and @c Write. Since all processes share one address space,
+	the address can also be passed to other processes.
+
+	This call returns the address of the byte of the file at @c offset,
+	and stores in @c size the number of bytes that follow it in the same
+	extent, up to the end of the file. These bytes can be read and
+	written. The mapping is valid until @c fd (and all its copies) are
+	closed, even if the file is emptied by @c OPEN_TRUNCATE or removed.
+	The address of a page-aligned offset is aligned to @c SHM_PAGE_SIZE.
+
+	@param fd the file id of an open regular file
+	@param offset an offset less than the size of the file
+	@param size the location for storing the number of mapped bytes
+	@returns the address of the byte at @c offset, or NULL on error.
+		Possible reasons for error:
+		- @c fd is not an open regular file.
+		- @c offset is not less than the size of the file.
+		- @c size is NULL.
+*/
+void* MapFile(Fid_t fd, unsigned long offset, unsigned int* size);
+
+/**
+	@brief Open a file of the host directory.
+
+	The host directory is a directory of the host, given to @ref boot_hostdir.
+	Its regular files can be opened as streams, either for reading or for 
+	writing. The path is relative to the host directory, and must not contain
+	a @c ".." component.
+
+	Host files are read and written sequentially, through buffers that the
+	host fills and writes out in the background: a @c Read returns the data
+	read ahead, and blocks only if there is none yet, and a @c Write returns 
+	once its data is buffered. @c Close waits until the buffered data has
+	been written to the host file.
+
+	@param path the path of the file, relative to the host directory
+	@param flags a combination of @c open_flags, with exactly one of
+		@c OPEN_READ and @c OPEN_WRITE. @c OPEN_TRUNCATE and @c OPEN_APPEND
+		require @c OPEN_WRITE.
+	@returns a file id for the file, or NOFILE on error. Possible reasons for error:
+		- there is no host directory.
+		- the path or the flags are not legal.
+		- the file cannot be opened by the host, or it is not a regular file.
+		- too many host files are open.
+		- the available file ids for the process are exhausted.
+	@see boot_hostdir
+*/
+Fid_t OpenHostFile(const char* path, int flags);
+
+
 /*******************************************
  *
  * Sockets (local)
@@ -547,7 +1303,15 @@ typedef int16_t port_t;
 /**
 	@brief the maximum legal port 
 */
-#define MAX_PORT 1023
+#define MAX_PORT 32767
+
+/**
+	@brief the first of the ephemeral ports
+
+	A socket that is not bound to a port is bound by @c Connect to an 
+	unused port between @c MIN_EPHEMERAL_PORT and @c MAX_PORT.
+*/
+#define MIN_EPHEMERAL_PORT 16384
 
 /**
 	@brief a null value for a port
@@ -571,6 +1335,39 @@ typedef int16_t port_t;
 */
 Fid_t Socket(port_t port);
 
+/**
+	@brief Return a new socket bound on a port, with the given flags.
+
+	Without flags, this call is equivalent to @c Socket.
+
+	If @c PACKET_MODE is given, the connections of the socket preserve
+	message boundaries in both directions, as pipes created by @c Pipe2
+	do. A packet-mode socket can only connect to a packet-mode listener,
+	and a byte-stream socket only to a byte-stream listener.
+	The sockets returned by @c Accept have the mode of the listener.
+
+	If @c REUSE_PORT is given, the socket may become one of several
+	listeners of its port (see @c Listen).
+
+	If @c DATAGRAM is given (alone), the socket is a datagram socket,
+	which exchanges messages with other datagram sockets by @c SendTo 
+	and @c RecvFrom, without connections. A datagram socket bound to a 
+	port receives the datagrams sent to the port; each port can have at 
+	most one datagram socket, besides its listeners. A datagram socket
+	on @c NOPORT can only send.
+
+	@param port the port the new socket will be bound to
+	@param flags a combination of @c stream_flags
+	@returns a file id for the new socket, or NOFILE on error. Possible
+		reasons for error:
+		- the port is iilegal
+		- the flags are not legal
+		- the port already has a datagram socket, for a @c DATAGRAM socket
+		- the available file ids for the process are exhausted
+	@see Socket
+*/
+Fid_t Socket2(port_t port, int flags);
+
 /**
 	@brief Initialize a socket as a listening socket.
 
@@ -581,19 +1378,60 @@ Fid_t Socket(port_t port);
 
 	The socket must be bound to a port, as a result of calling @c Socket.
 	On each port there must be a unique listening socket (although any number
-	of non-listening sockets are allowed).
+	of non-listening sockets are allowed), unless all the listeners of the
+	port were created with the @c REUSE_PORT flag of @c Socket2, and agree
+	on @c PACKET_MODE.
+
+	When a port has several listeners, each @c Connect is queued to the
+	listener with the fewest pending requests, with ties broken round-robin.
+	When a listener is closed, its pending requests move to the remaining
+	listeners of the port.
+
+	A listener queues at most @c LISTEN_BACKLOG pending requests; once
+	its queue is full, @c Connect fails at once. Use @c Listen2 for a
+	different limit.
 
 	@param sock the socket to initialize as a listening socket
 	@returns 0 on success, -1 on error. Possible reasons for error:
 		- the file id is not legal
 		- the socket is not bound to a port
-		- the port bound to the socket is occupied by another listener
+		- the port bound to the socket is occupied by another listener,
+		  and the two do not both have @c REUSE_PORT
 		- the socket has already been initialized
 	@see Socket
  */
 int Listen(Fid_t sock);
 
 
+/**
+	@brief The backlog of listeners initialized by @c Listen.
+*/
+#define LISTEN_BACKLOG 128
+
+/**
+	@brief The maximum backlog of a listener.
+*/
+#define MAX_LISTEN_BACKLOG 4096
+
+/**
+	@brief Initialize a socket as a listening socket, with the given backlog.
+
+	This call is equivalent to @c Listen, except that the listener queues
+	at most @c backlog pending @c Connect requests, instead of
+	@c LISTEN_BACKLOG. When a port has several listeners, a request
+	is refused only when the queues of all of them are full.
+
+	@param sock the socket to initialize as a listening socket
+	@param backlog the maximum number of pending requests, 
+		0 < backlog <= MAX_LISTEN_BACKLOG
+	@returns 0 on success, -1 on error. Possible reasons for error:
+		- any of the reasons of @c Listen
+		- the backlog is not legal
+	@see Listen
+ */
+int Listen2(Fid_t sock, unsigned int backlog);
+
+
 /**
 	@brief Wait for a connection.
 
@@ -620,6 +1458,32 @@ int Listen(Fid_t sock);
 Fid_t Accept(Fid_t lsock);
 
 
+/**
+	@brief Accept many connections at once.
+
+	This call blocks as @c Accept does, until at least one @c Connect
+	request is pending on the listening socket. Then, it accepts up to
+	@c n of the pending requests, storing the file ids of the new sockets 
+	in @c fids, in the order the requests were queued.
+	If the listener is non-blocking and no request is pending, the
+	call returns 0.
+
+	@param lsock the listening socket
+	@param fids an array of at least @c n file ids
+	@param n the maximum number of connections to accept
+	@returns the number of accepted connections, or -1 on error. Possible 
+		reasons for error:
+		- the file id is not legal
+		- the file id is not initialized by @c Listen()
+		- @c fids is NULL or @c n is 0
+		- the available file ids for the process are exhausted, before any
+		  connection was accepted
+		- while waiting, the listening socket @c lsock was closed
+	@see Accept
+ */
+int AcceptMany(Fid_t lsock, Fid_t* fids, unsigned int n);
+
+
 
 /**
 	@brief Create a connection to a listener at a specific port.
@@ -631,6 +1495,10 @@ Fid_t Accept(Fid_t lsock);
 	The two connected sockets communicate by virtue of two pipes of opposite directions, 
 	but with one file descriptor servicing both pipes at each end.
 
+	If @c sock is not bound to a port, it is bound to an unused ephemeral port.
+	A socket bound to a port cannot be connected twice to the same port at the 
+	same time, so that the pair of ports of each connection is unique.
+
 	The connect call will block for approximately the specified amount of time.
 	The resolution of this timeout is implementation specific, but should be
 	in the order of 100's of msec. Therefore, a timeout of at least 500 msec is
@@ -644,11 +1512,61 @@ Fid_t Accept(Fid_t lsock);
 	   - the file id @c sock is not legal (i.e., an unconnected, non-listening socket)
 	   - the given port is illegal.
 	   - the port does not have a listening socket bound to it by @c Listen.
+	   - the socket and the listener differ in @c PACKET_MODE.
+	   - the backlog of every listener of the port is full.
+	   - the listener was closed before accepting the connection.
 	   - the timeout has expired without a successful connection.
+	   - @c sock is bound to a port already connected to @c port.
+	   - all the ephemeral ports are in use.
 */
 int Connect(Fid_t sock, port_t port, timeout_t timeout);
 
 
+/**
+	@brief Return the port a socket is bound to.
+
+	For a socket returned by @c Accept, this is the port of the listener.
+
+	@param sock the socket
+	@param port location to store the port, which is @c NOPORT for an unbound socket
+	@returns 0 on success and -1 on error. Possible reasons for error:
+		- @c sock is not a socket
+		- @c port is NULL
+	@see GetPeerName
+*/
+int GetSockName(Fid_t sock, port_t* port);
+
+
+/**
+	@brief Return the port of the other end of a connected socket.
+
+	@param sock the connected socket
+	@param port location to store the port
+	@returns 0 on success and -1 on error. Possible reasons for error:
+		- @c sock is not a connected socket
+		- @c port is NULL
+	@see GetSockName
+*/
+int GetPeerName(Fid_t sock, port_t* port);
+
+
+/**
+	@brief Create a pair of connected sockets.
+
+	This call returns two new sockets, which are connected to each other
+	as if by @c Connect and @c Accept, but without a port or a listener.
+	The two sockets are byte streams, and behave as any connected socket,
+	e.g., they can be shut down with @c ShutDown.
+
+	@param fids an array of 2 file ids, for storing the two sockets
+	@returns 0 on success and -1 on error. Possible reasons for error:
+		- @c fids is NULL
+		- the available file ids for the process are exhausted
+	@see Connect
+*/
+int SocketPair(Fid_t fids[2]);
+
+
 /**
    @brief Socket shutdown modes.
 
@@ -694,6 +1612,258 @@ typedef enum {
 int ShutDown(Fid_t sock, shutdown_mode how);
 
 
+/**
+	@brief Socket options.
+
+	These are the options of connected sockets, read by @c GetSockOpt
+	and changed by @c SetSockOpt. Each direction of a connection is 
+	tuned independently.
+*/
+typedef enum {
+	SO_SNDBUF,		/**< The size of the buffer of outgoing data. */
+	SO_RCVBUF,		/**< The size of the buffer of incoming data. */
+	SO_RCVLOWAT,	/**< The number of bytes a @c Read waits for. */
+	SO_NODELAY		/**< If 0, small writes may be delivered late, in larger batches. */
+} socket_option;
+
+/** @brief The minimum size of a socket buffer. */
+#define MIN_SOCKET_BUFFER 1024
+
+/** @brief The maximum size of a socket buffer. */
+#define MAX_SOCKET_BUFFER (1<<20)
+
+/**
+	@brief Set an option of a connected socket.
+
+	The options are:
+	- @c SO_SNDBUF and @c SO_RCVBUF: the buffer size, between 
+	  @c MIN_SOCKET_BUFFER and @c MAX_SOCKET_BUFFER, is rounded up 
+	  to a power of 2. The buffer of outgoing data is the buffer of 
+	  incoming data of the peer. In @c PACKET_MODE, the buffer must hold 
+	  a record of @c MAX_PACKET_SIZE bytes. A buffer cannot shrink 
+	  below the data it holds, or below the low-watermark of its reader.
+	- @c SO_RCVLOWAT: a @c Read blocks until at least this many bytes are
+	  available, or the peer stops writing; then, it returns as many bytes 
+	  as are available, as usual. @c Poll reports the socket readable 
+	  under the same condition, and @c CopyStream reads from it alike. The default is 1. The low-watermark 
+	  cannot exceed the buffer size, and cannot be set in @c PACKET_MODE.
+	- @c SO_NODELAY: if 1 (the default), each @c Write wakes up the 
+	  reader of the peer at once. If 0, the reader is woken up only when 
+	  enough data has been coalesced, or after a short delay, trading
+	  latency for fewer context switches.
+
+	@param sock the connected socket
+	@param opt the option
+	@param value the new value of the option
+	@returns 0 on success and -1 on error. Possible reasons for error:
+		- the file id @c sock is not legal (a connected socket stream).
+		- the direction of the option has been shut down.
+		- the value is not legal for the option.
+	@see GetSockOpt
+*/
+int SetSockOpt(Fid_t sock, socket_option opt, unsigned int value);
+
+/**
+	@brief Get an option of a connected socket.
+
+	@param sock the connected socket
+	@param opt the option
+	@param value the location for storing the value of the option
+	@returns 0 on success and -1 on error. Possible reasons for error:
+		- the file id @c sock is not legal (a connected socket stream).
+		- the direction of the option has been shut down.
+		- @c opt is not legal, or @c value is NULL.
+	@see SetSockOpt
+*/
+int GetSockOpt(Fid_t sock, socket_option opt, unsigned int* value);
+
+
+/** @brief The maximum size of a datagram. */
+#define MAX_DATAGRAM_SIZE 4096
+
+/** @brief The maximum number of datagrams queued at a socket. */
+#define MAX_DATAGRAM_QUEUE 64
+
+/**
+	@brief Send a datagram to a port.
+
+	The datagram is queued at the datagram socket bound to @c port,
+	tagged with the port of @c sock. This call never blocks: if the 
+	queue of the receiver holds @c MAX_DATAGRAM_QUEUE datagrams, the 
+	datagram is dropped and the call fails.
+
+	@param sock a datagram socket
+	@param port the port of the receiver
+	@param buf the bytes of the datagram
+	@param size the size of the datagram, at most @c MAX_DATAGRAM_SIZE
+	@returns @c size on success and -1 on error. Possible reasons for error:
+		- the file id @c sock is not legal (a datagram socket).
+		- the port is illegal, or it has no datagram socket.
+		- the size is larger than @c MAX_DATAGRAM_SIZE.
+		- the queue of the receiver is full.
+	@see RecvFrom
+*/
+int SendTo(Fid_t sock, port_t port, const char* buf, unsigned int size);
+
+/**
+	@brief Receive a datagram.
+
+	This call blocks until a datagram is queued at @c sock, and then
+	removes it from the queue. If the datagram is larger than @c size,
+	the excess bytes are discarded. If the socket is non-blocking and
+	no datagram is queued, the call returns @c WOULDBLOCK.
+
+	@param sock a datagram socket bound to a port
+	@param buf the buffer for the bytes of the datagram
+	@param size the size of @c buf
+	@param port if not NULL, the location for storing the port of
+		the sender (@c NOPORT if the sender is not bound)
+	@returns the number of bytes stored in @c buf, or -1 on error. Possible 
+		reasons for error:
+		- the file id @c sock is not legal (a datagram socket bound to a port).
+	@see SendTo
+*/
+int RecvFrom(Fid_t sock, char* buf, unsigned int size, port_t* port);
+
+
+
+/*******************************************
+ *
+ * I/O rings
+ *
+ *******************************************/
+
+/**
+	@brief The maximum number of submission entries of an I/O ring.
+*/
+#define MAX_IORING_ENTRIES 4096
+
+/**
+	@brief The operations of an I/O ring submission.
+*/
+typedef enum {
+	IO_NOP=0,		/**< Complete at once, with result 0. */
+	IO_READ=1,		/**< @c Read(fd, buf, size) */
+	IO_WRITE=2,		/**< @c Write(fd, buf, size) */
+	IO_ACCEPT=3,	/**< @c Accept(fd) */
+	IO_CONNECT=4	/**< @c Connect(fd, port, timeout) */
+} io_opcode;
+
+/**
+	@brief A submission queue entry of an I/O ring.
+*/
+typedef struct io_sqe_s {
+	io_opcode opcode;	/**< The operation */
+	Fid_t fd;			/**< The file id of the operation */
+	char* buf;			/**< The buffer of @c IO_READ and @c IO_WRITE */
+	unsigned int size;	/**< The size of @c buf */
+	port_t port;		/**< The port of @c IO_CONNECT */
+	timeout_t timeout;	/**< The timeout of @c IO_CONNECT */
+	uintptr_t data;		/**< A user value, returned in the completion */
+} io_sqe_t;
+
+/**
+	@brief A completion queue entry of an I/O ring.
+*/
+typedef struct io_cqe_s {
+	int result;			/**< The return value of the operation */
+	uintptr_t data;		/**< The user value of the submission */
+} io_cqe_t;
+
+/**
+	@brief The queues of an I/O ring, shared by the process and the kernel.
+
+	Both queues are rings whose sizes are powers of 2. The head and the
+	tail count all the entries ever removed and added, and the entry at
+	position @c p is at index <tt>p & (entries-1)</tt>.
+
+	The process adds submissions at @c sq_tail and the kernel removes
+	them from @c sq_head. The kernel adds completions at @c cq_tail
+	and the process removes them from @c cq_head. Each side must store
+	its own counter after the entries it has written (read), e.g., with
+	@c __atomic_store_n(...,__ATOMIC_RELEASE).
+*/
+typedef struct io_ring_s {
+	unsigned int sq_head;		/**< Advanced by the kernel */
+	unsigned int sq_tail;		/**< Advanced by the process */
+	unsigned int sq_entries;	/**< The size of @c sq */
+	io_sqe_t* sq;				/**< The submission queue */
+
+	unsigned int cq_head;		/**< Advanced by the process */
+	unsigned int cq_tail;		/**< Advanced by the kernel */
+	unsigned int cq_entries;	/**< The size of @c cq, twice @c sq_entries */
+	io_cqe_t* cq;				/**< The completion queue */
+} io_ring_t;
+
+
+/**
+	@brief Create an I/O ring.
+
+	An I/O ring lets a thread keep many @c Read, @c Write, @c Accept and
+	@c Connect operations in flight, and submit and reap them in batches,
+	with one call of @c IoRing_Enter for many operations.
+
+	The operations are described in the submission queue of the ring.
+	Each is performed as by the corresponding system call, in the calling
+	process. The result of each is posted to the completion queue, with
+	the user value of its submission. Operations that would block are
+	performed by worker threads of the kernel, which are created in the
+	process as needed, and exit after they have been idle for a while.
+	Operations complete in any order.
+
+	The buffers of an operation must remain valid until it completes.
+	When the ring is closed, or the threads of its process have all
+	exited, the operations still in flight are cancelled: they complete
+	with -1, and the workers exit. An I/O ring that is cancelled cannot
+	be entered again. An operation on a stream that other threads read
+	(write) as well may miss the cancellation: if they take its data
+	(space) first, it waits inside the stream until the stream is ready
+	again, or closed.
+
+	The queues are allocated by the kernel, and are released when the
+	file id is closed.
+
+	@param entries the size of the submission queue, between 1 and
+		@c MAX_IORING_ENTRIES. It is rounded up to a power of 2.
+	@param ring the location for storing the address of the queues
+	@returns a file id for the ring, or NOFILE on error. Possible reasons for error:
+		- the arguments are not legal.
+		- the available file ids for the process are exhausted.
+	@see IoRing_Enter
+*/
+Fid_t IoRing_Create(unsigned int entries, io_ring_t** ring);
+
+/**
+	@brief Submit operations to an I/O ring and wait for completions.
+
+	Up to @c to_submit entries are taken from the submission queue and
+	started. An operation that will not block (e.g., a read of a stream
+	that polls readable) is performed at once; the others are passed
+	to the worker threads. Submission stops early if the completions of
+	the operations in flight might not fit in the completion queue.
+
+	Then, the call blocks until at least @c min_complete completions are
+	in the completion queue, or the timeout expires, or fewer operations
+	are in flight than would be needed.
+
+	The ring is polled readable while completions are queued, therefore
+	it can also be waited on by @c Poll and event queues.
+
+	@param ring the file id of the ring
+	@param to_submit the maximum number of submissions to take
+	@param min_complete the number of completions to wait for
+	@param timeout the maximum time to wait in milliseconds. A timeout of 0
+		returns immediately, and a timeout of @c (timeout_t)-1 means
+		"infinite timeout".
+	@returns the number of submissions taken, or -1 on error. Possible reasons
+		for error:
+		- @c ring is not an I/O ring of the calling process.
+		- @c min_complete is larger than the completion queue.
+	@see IoRing_Create
+*/
+int IoRing_Enter(Fid_t ring, unsigned int to_submit, unsigned int min_complete, timeout_t timeout);
+
+
 
 /*******************************************
  *
@@ -781,6 +1951,42 @@ Fid_t OpenInfo();
 void boot(unsigned int ncores, unsigned int terminals, Task boot_task, int argl, void* args);
 
 
+/** @brief Add a host gateway to the next boot.
+
+   Called before @ref boot, this makes every connection of a host program
+   to the Unix-domain socket at @c path a connection to @c port, as if it
+   was made by @ref Connect. The socket is created by @c boot, replacing 
+   any file at @c path, and is removed when TinyOS halts.
+
+   Host connections are served as stream sockets, so they are not 
+   accepted by @c PACKET_MODE listeners. 
+
+   The gateways apply to one call of @c boot. The string @c path must
+   remain valid until then.
+
+   @param port the port of the listeners to connect to
+   @param path the file name of the host socket
+   @returns 0 on success, or -1 if the port is illegal or too many gateways
+       have been added.
+   */
+int boot_gateway(port_t port, const char* path);
+
+
+/** @brief Set the host directory of the next boot.
+
+   Called before @ref boot, this makes the regular files under the host
+   directory @c path available to @ref OpenHostFile. The directory is
+   opened by @c boot.
+
+   The host directory applies to one call of @c boot. The string @c path
+   must remain valid until then.
+
+   @param path the host directory
+   @returns 0 on success, or -1 if @c path is NULL.
+   */
+int boot_hostdir(const char* path);
+
+
 /** @} */
 
 #endif
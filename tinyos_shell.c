@@ -720,17 +720,33 @@ finish:
    the client program
 ************************/
 
-/* helper for RemoteClient */
-static void send_message(Fid_t sock, void* buf, size_t len)
+/* helper for RemoteClient: send a header and a payload, gathered
+   in as few system calls as possible */
+static void send_message(Fid_t sock, void* hdr, size_t hlen, void* buf, size_t len)
 {
+	iovec_t iov[2] = {
+		{ .buf = hdr, .size = hlen },
+		{ .buf = buf, .size = len }
+	};
 	size_t count = 0;
-	while(count<len) {
-		int rc = Write(sock, buf+count, len-count);
+	unsigned int seg = 0;
+	while(seg<2) {
+		int rc = WriteV(sock, iov+seg, 2-seg);
 		if(rc<1) break;  /* Error or End of stream */
 		count += rc;
+
+		/* Skip over what was written */
+		while(seg<2 && rc>=iov[seg].size) {
+			rc -= iov[seg].size;
+			seg++;
+		}
+		if(seg<2) {
+			iov[seg].buf += rc;
+			iov[seg].size -= rc;
+		}
 	}
-	if(count!=len) {
-		printf("In client: I/O error writing %zu bytes (%zu written)\n", len, count);
+	if(count!=hlen+len) {
+		printf("In client: I/O error writing %zu bytes (%zu written)\n", hlen+len, count);
 		Exit(1);
 	}
 }
@@ -755,19 +771,12 @@ int RemoteClient(size_t argc, const char** argv)
 	argvpack(args, argc-1, argv+1);
 
 	/* Send message */
-	send_message(sock, &argl, sizeof(argl));
-	send_message(sock, args, argl);
+	send_message(sock, &argl, sizeof(argl), args, argl);
 	ShutDown(sock, SHUTDOWN_WRITE);
 
-	/* Read the server data and display */
-	char c;
-	FILE* fin = fidopen(sock, "r");
-	FILE* fout = fidopen(1, "w");
-	while((c=fgetc(fin))!=EOF) {
-		fputc(c, fout);
-	}
-	fclose(fin);
-	fclose(fout);
+	/* Relay the server data to the display, inside the kernel */
+	while(CopyStream(sock, 1, 1<<20) > 0);
+	Close(sock);
 	return 0;
 }
 
@@ -995,10 +1004,11 @@ int boot_shell(int argl, void* args)
 
 void usage(const char* pname)
 {
-  printf("usage:\n  %s <ncores> <nterm> <philosophers> <bites>\n\n  \
+  printf("usage:\n  %s <ncores> <nterm> [<port>:<path> ...]\n\n  \
     where:\n\
     <ncores> is the number of cpu cores to use,\n\
-    <nterm> is the number of terminals to use,\n",
+    <nterm> is the number of terminals to use,\n\
+    <port>:<path> connects the host Unix socket <path> to <port>,\n",
 	 pname);
   exit(1);
 }
@@ -1008,10 +1018,16 @@ int main(int argc, const char** argv)
 {
   unsigned int ncores, nterm;
 
-  if(argc!=3) usage(argv[0]); 
+  if(argc<3) usage(argv[0]); 
   ncores = atoi(argv[1]);
   nterm = atoi(argv[2]);
 
+  /* host gateways, e.g. 20:/tmp/rserver.sock for rserver */
+  for(int i=3; i<argc; i++) {
+    char* sep = strchr(argv[i], ':');
+    if(sep==NULL || boot_gateway(atoi(argv[i]), sep+1)==-1) usage(argv[0]);
+  }
+
   /* boot TinyOS */
   printf("*** Booting TinyOS with %d cores and %d terminals\n", ncores, nterm);
   boot(ncores, nterm, boot_shell, 0, NULL);
@@ -11,20 +11,85 @@
 
 
 
+/*
+	Streams opened by fidopen.
+
+	The streams are buffered, so that a program writing a character at a
+	time does not make a Write call per character. To keep interactive
+	programs working, a read that must refill a stream's buffer first
+	flushes the output streams of the reading process (so that a prompt
+	is shown before waiting for the answer), and the streams of a process
+	are flushed and closed by its exit hook, however the process ends.
+
+	All processes share the address space, so the streams of all
+	processes are kept in one list, each tagged with the pid of its owner.
+
+	The standard streams set by tinyos_replace_stdio are shared by all
+	processes too. The standard output does not buffer; it passes what
+	is written to it to a buffered stream of the writing process on its
+	own fid 1, which is created on the first write, and is kept in the
+	list with the other streams of the process.
+ */
+typedef struct fid_stream {
+	Fid_t fid;
+	Pid_t pid;			/* the process that opened the stream */
+	FILE* file;
+	int writer;			/* set if the stream is open for writing */
+	int std;			/* set for the standard output buffer of the process */
+	rlnode node;		/* node in fid_streams */
+} fid_stream;
+
+static rlnode fid_streams = { .obj = NULL, .prev = &fid_streams, .next = &fid_streams };
+static Mutex fid_streams_mx = MUTEX_INIT;
+
+
+/* Flush the output streams of the current process, except for self */
+static void fid_flush_writers(fid_stream* self)
+{
+	Pid_t pid = GetPid();
+
+	Mutex_Lock(&fid_streams_mx);
+	for(rlnode* p = fid_streams.next; p != &fid_streams; p = p->next) {
+		fid_stream* fs = p->obj;
+		if(fs == self || fs->pid != pid || ! fs->writer) continue;
+
+		/* A stream locked by another thread is in use, and will be flushed by it.
+		   Not waiting for it also keeps us clear of a thread closing it, which
+		   holds its lock while it waits for fid_streams_mx. */
+		if(ftrylockfile(fs->file) == 0) {
+			fflush_unlocked(fs->file);
+			funlockfile(fs->file);
+		}
+	}
+	Mutex_Unlock(&fid_streams_mx);
+}
+
+
 static ssize_t tinyos_fid_read(void *cookie, char *buf, size_t size)
 {
-	return Read(*(Fid_t*)cookie, buf, size); 
+	fid_stream* fs = cookie;
+	fid_flush_writers(fs);
+	return Read(fs->fid, buf, size); 
 }
 
 static ssize_t tinyos_fid_write(void *cookie, const char *buf, size_t size)
 {
-	int ret = Write(*(Fid_t*)cookie, buf, size); 
+	fid_stream* fs = cookie;
+	int ret = Write(fs->fid, buf, size); 
 	return (ret<0) ? 0 : ret;
 }
 
+static ssize_t tinyos_stdout_write(void *cookie, const char *buf, size_t size);
+
 static int tinyos_fid_close(void* cookie)
 {
-	free(cookie);
+	fid_stream* fs = cookie;
+
+	Mutex_Lock(&fid_streams_mx);
+	rlist_remove(&fs->node);
+	Mutex_Unlock(&fid_streams_mx);
+
+	free(fs);
 	return 0;
 }
 
@@ -36,10 +101,88 @@ static cookie_io_functions_t  tinyos_fid_functions =
 	tinyos_fid_close
 };
 
+static cookie_io_functions_t  tinyos_stdout_functions =
+{
+	NULL,
+	tinyos_stdout_write,
+	NULL,
+	tinyos_fid_close
+};
+
+
+/* Make a stream for a fid, with the given buffering; it is not listed */
+static fid_stream* fid_stream_new(Fid_t fid, const char* mode, 
+	cookie_io_functions_t funcs, int bufmode, size_t bufsize)
+{
+	fid_stream* fs = (fid_stream *) malloc(sizeof(fid_stream));
+	fs->fid = fid;
+	fs->pid = GetPid();
+	fs->writer = (strpbrk(mode, "wa+") != NULL);
+	fs->std = 0;
+	rlnode_init(&fs->node, fs);
+
+	FILE* f = fopencookie(fs, mode, funcs);
+	if(f == NULL) {
+		free(fs);
+		return NULL;
+	}
+	fs->file = f;
+
+	CHECKRC(setvbuf(f, NULL, bufmode, bufsize))
+	return fs;
+}
+
+
+/*
+	The standard output buffer of the current process, created on first
+	use. It is line-buffered on a terminal, and fully buffered otherwise.
+ */
+static FILE* fid_stdout(Fid_t fid)
+{
+	Pid_t pid = GetPid();
+	fid_stream* out = NULL;
+	int created = 0;
+
+	Mutex_Lock(&fid_streams_mx);
+	for(rlnode* p = fid_streams.next; p != &fid_streams; p = p->next) {
+		fid_stream* fs = p->obj;
+		if(fs->std && fs->pid == pid) { out = fs; break; }
+	}
+	if(out == NULL) {
+		int bufmode = (IsTerminal(fid) == 1) ? _IOLBF : _IOFBF;
+		out = fid_stream_new(fid, "w", tinyos_fid_functions, bufmode, FIDOPEN_BUFSIZE);
+		if(out != NULL) {
+			out->std = 1;
+			rlist_push_back(&fid_streams, &out->node);
+			created = 1;
+		}
+	}
+	Mutex_Unlock(&fid_streams_mx);
+
+	if(created)
+		SetExitHook(fidclose_all);
+	return (out != NULL) ? out->file : NULL;
+}
+
+
+static ssize_t tinyos_stdout_write(void *cookie, const char *buf, size_t size)
+{
+	fid_stream* fs = cookie;
+	FILE* out = fid_stdout(fs->fid);
+	if(out == NULL)
+		return tinyos_fid_write(cookie, buf, size);
+	return fwrite(buf, 1, size, out);
+}
+
+
 static FILE* get_std_stream(int fid, const char* mode)
 {
-	FILE* term = fidopen(fid, mode);
-	assert(term);
+	/* The standard streams are shared by all processes, each using
+	   its own fid, so they must not buffer */
+	fid_stream* fs = fid_stream_new(fid, mode, 
+		(fid == 1) ? tinyos_stdout_functions : tinyos_fid_functions, _IONBF, 0);
+	assert(fs);
+	FILE* term = fs->file;
 	/* This is glibc-specific and tunrs off fstream locking */
 	__fsetlocking(term, FSETLOCKING_BYCALLER);	
 	return term;
@@ -48,13 +191,43 @@ static FILE* get_std_stream(int fid, const char* mode)
 
 FILE* fidopen(Fid_t fid, const char* mode)
 {
+	return fidopen2(fid, mode, FIDOPEN_BUFSIZE);
+}
 
-	Fid_t* fidloc = (Fid_t *) malloc(sizeof(Fid_t));
-	* fidloc = fid;
-	FILE* f = fopencookie(fidloc, mode, tinyos_fid_functions);
 
-	CHECKRC(setvbuf(f, NULL, _IONBF, 0));
-	return f;
+FILE* fidopen2(Fid_t fid, const char* mode, size_t bufsize)
+{
+	fid_stream* fs = fid_stream_new(fid, mode, tinyos_fid_functions, 
+		(bufsize == 0) ? _IONBF : _IOFBF, bufsize);
+	if(fs == NULL)
+		return NULL;
+
+	Mutex_Lock(&fid_streams_mx);
+	rlist_push_back(&fid_streams, &fs->node);
+	Mutex_Unlock(&fid_streams_mx);
+
+	/* Flush and close the streams of the process when it ends */
+	SetExitHook(fidclose_all);
+	return fs->file;
+}
+
+
+void fidclose_all()
+{
+	Pid_t pid = GetPid();
+
+	for(;;) {
+		FILE* f = NULL;
+		Mutex_Lock(&fid_streams_mx);
+		for(rlnode* p = fid_streams.next; p != &fid_streams; p = p->next) {
+			fid_stream* fs = p->obj;
+			if(fs->pid == pid) { f = fs->file; break; }
+		}
+		Mutex_Unlock(&fid_streams_mx);
+
+		if(f == NULL) break;
+		fclose(f);
+	}
 }
 
 FILE *saved_in = NULL, *saved_out = NULL;
@@ -108,7 +281,7 @@ static int exec_wrapper(int argl, void* args)
 	const char* argv[argc];
 	argvunpack(argc, argv, argl, args);
 
-	/* Make the call */
+	/* Make the call; the exit hook flushes the streams of the program */
 	return prog(argc, argv);
 }
 
@@ -13,14 +13,51 @@
   */
 
 
+/** @brief The buffer size of streams opened by @ref fidopen. */
+#define FIDOPEN_BUFSIZE 4096
+
 /**
     @brief Open a C stream on a tinyos file descriptor.
 
+	The stream is fully buffered, with a buffer of @c FIDOPEN_BUFSIZE bytes.
+	Output is written when the buffer fills, when the stream is flushed
+	or closed, when the process reads from some stream of its own that
+	must refill its buffer (so that prompts are shown before input is
+	awaited), and when the process ends, by returning from its main
+	function or by @c Exit. To this end, the exit hook of the process is
+	set to @ref fidclose_all.
+
 	This call returns a new FILE pointer on success and NULL
 	on failure.
 */
 FILE* fidopen(Fid_t fid, const char* mode);
 
+/**
+    @brief Open a C stream on a tinyos file descriptor, with a given buffer size.
+
+	This is like @ref fidopen, but the buffer has @c bufsize bytes.
+	If @c bufsize is 0, the stream is unbuffered.
+*/
+FILE* fidopen2(Fid_t fid, const char* mode, size_t bufsize);
+
+/**
+	@brief Flush and close all the streams opened by the current process
+	with @ref fidopen.
+
+	This is the exit hook of a process that opened a stream with
+	@ref fidopen, or wrote to the standard output.
+	@see SetExitHook
+*/
+void fidclose_all();
+
+/**
+	@brief Replace the standard streams with streams on fids 0 and 1.
+
+	The new streams are shared by all processes, each reading its own
+	fid 0 and writing its own fid 1. The standard output of each process
+	is buffered separately, like a stream of @ref fidopen; it is
+	line-buffered if fid 1 is a terminal, and fully buffered otherwise.
+*/
 void tinyos_replace_stdio();
 void tinyos_restore_stdio();
 void tinyos_pseudo_console();
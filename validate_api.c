@@ -4,6 +4,15 @@
 #include <time.h>
 #include <math.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+/* The host socket options would hide the TinyOS ones */
+#undef SO_SNDBUF
+#undef SO_RCVBUF
+#undef SO_RCVLOWAT
 
 #include "util.h"
 #include "symposium.h"
@@ -619,6 +628,7 @@ BOOT_TEST(test_read_kbd,
 	assert(GetTerminalDevices()>0);
 	Fid_t fterm = OpenTerminal(0);
 	ASSERT(fterm!=NOFILE);
+	ASSERT(IsTerminal(fterm)==1);
 
 	sendme(0, "Hello");
 	checked_read(fterm, "Hello");
@@ -756,6 +766,113 @@ BOOT_TEST(test_child_inherits_files,
 }
 
 
+static int full_table_child(int argl, void* args)
+{
+	unsigned int limit = *(unsigned int*)args;
+
+	/* The inherited files are open, and the table is full */
+	ASSERT(Write(limit-1, "x", 1)==1);
+	ASSERT(OpenNull()==NOFILE);
+	ASSERT(SetFileLimit(MAX_FILEID)==-1);
+	ASSERT(Close(limit)==-1);
+	return 42;
+}
+
+BOOT_TEST(test_file_limit,
+	"Test that SetFileLimit raises the number of open files of a process,\n"
+	"that the lowest free fid is reused and that children inherit the limit."
+	)
+{
+	unsigned int limit = 4096;
+
+	ASSERT(SetFileLimit(0)==-1);
+	ASSERT(SetFileLimit(MAX_FILEID_LIMIT+1)==-1);
+
+	/* The default limit */
+	for(Fid_t fid=0; fid<MAX_FILEID; fid++)
+		ASSERT(OpenNull()==fid);
+	ASSERT(OpenNull()==NOFILE);
+
+	ASSERT(SetFileLimit(limit)==0);
+	for(Fid_t fid=MAX_FILEID; fid<limit; fid++)
+		ASSERT(OpenNull()==fid);
+	ASSERT(OpenNull()==NOFILE);
+	ASSERT(Dup2(0, limit)==-1);
+	ASSERT(Dup2(0, limit-1)==0);
+
+	/* The open fids must remain legal */
+	ASSERT(SetFileLimit(limit-1)==-1);
+
+	/* The lowest free fid is returned */
+	ASSERT(Close(3000)==0);
+	ASSERT(Close(1000)==0);
+	ASSERT(OpenNull()==1000);
+	ASSERT(OpenNull()==3000);
+
+	int status;
+	Pid_t cpid = Exec(full_table_child, sizeof(limit), &limit);
+	ASSERT(cpid!=NOPROC);
+	ASSERT(WaitChild(cpid, &status)==cpid);
+	ASSERT(status==42);
+
+	/* Lower the limit back */
+	for(Fid_t fid=MAX_FILEID; fid<limit; fid++)
+		ASSERT(Close(fid)==0);
+	ASSERT(SetFileLimit(MAX_FILEID)==0);
+	ASSERT(Close(MAX_FILEID)==-1);
+	ASSERT(OpenNull()==NOFILE);
+	return 0;
+}
+
+
+
+
+#define FCB_CLOSERS 8
+
+static int closed_files;
+
+static int close_one_thread(int argl, void* args)
+{
+	ASSERT(Close(argl)==0);
+	__atomic_add_fetch(&closed_files, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+BOOT_TEST(test_file_table_refill_after_close,
+	"Test that a full file table can be filled again from one core, after\n"
+	"some files were closed by threads running on other cores."
+	)
+{
+	ASSERT(SetFileLimit(MAX_FILEID_LIMIT)==0);
+
+	int count = 0;
+	while(OpenNull()!=NOFILE)
+		count++;
+	ASSERT(count > FCB_CLOSERS);
+
+	/*
+		The freed files stay with the cores of the closing threads, which
+		run elsewhere while this thread keeps its core busy.
+	 */
+	closed_files = 0;
+	Tid_t tid[FCB_CLOSERS];
+	for(int i=0; i<FCB_CLOSERS; i++){
+		tid[i] = CreateThread(close_one_thread, i, NULL);
+		ASSERT(tid[i]!=NOTHREAD);
+	}
+	while(__atomic_load_n(&closed_files, __ATOMIC_ACQUIRE) < FCB_CLOSERS);
+	for(int i=0; i<FCB_CLOSERS; i++)
+		ASSERT(ThreadJoin(tid[i], NULL)==0);
+
+	for(Fid_t fid=0; fid<FCB_CLOSERS; fid++)
+		ASSERT(OpenNull()==fid);
+	ASSERT(OpenNull()==NOFILE);
+
+	for(Fid_t fid=0; fid<count; fid++)
+		ASSERT(Close(fid)==0);
+	ASSERT(SetFileLimit(MAX_FILEID)==0);
+	return 0;
+}
 
 
 BOOT_TEST(test_null_device,
@@ -782,6 +899,40 @@ BOOT_TEST(test_null_device,
 }
 
 
+BOOT_TEST(test_readv_writev_fallback,
+	"Test ReadV and WriteV on a device without vectored operations."
+	)
+{
+	Fid_t fn = OpenNull();
+	ASSERT(fn!=NOFILE);
+
+	char a[] = "zavara", b[] = "katranemia";
+	iovec_t iov[2] = { { a, 3 }, { b, 5 } };
+
+	ASSERT(ReadV(fn, iov, 2)==8);
+	ASSERT(memcmp(a, "\0\0\0ara", 7)==0);
+	ASSERT(memcmp(b, "\0\0\0\0\0nemia", 11)==0);
+	ASSERT(WriteV(fn, iov, 2)==8);
+
+	ASSERT(ReadV(fn, NULL, 2)==-1);
+	ASSERT(WriteV(MAX_FILEID, iov, 2)==-1);
+
+	/* Larger vectors are transferred by segment */
+	static char big[3][3000];
+	iovec_t biov[3] = { { big[0], 3000 }, { big[1], 3000 }, { big[2], 3000 } };
+	ASSERT(ReadV(fn, biov, 3)==9000);
+	ASSERT(WriteV(fn, biov, 3)==9000);
+
+	/* The total size must fit the result */
+	iovec_t huge[2] = { { big[0], 0x80000000u }, { big[1], 0x80000000u } };
+	ASSERT(ReadV(fn, huge, 2)==-1);
+	ASSERT(WriteV(fn, huge, 2)==-1);
+
+	ASSERT(Close(fn)==0);
+	return 0;
+}
+
+
 
 /***********************************************************************************8
 *************************************************/
@@ -914,6 +1065,7 @@ TEST_SUITE(basic_tests,
 	&test_cond_timedwait_signal,
 	&test_cond_timedwait_broadcast,
 	&test_null_device,
+	&test_readv_writev_fallback,
 	&test_get_terminals,
 	&test_open_terminals,
 	&test_dup2_error_on_nonfile,
@@ -931,6 +1083,8 @@ TEST_SUITE(basic_tests,
 	&test_write_error_on_bad_fid,
 	&test_write_to_many_terminals,
 	&test_child_inherits_files,
+	&test_file_limit,
+	&test_file_table_refill_after_close,
 	NULL
 };
 
@@ -1507,6 +1661,137 @@ BOOT_TEST(test_pipe_close_writer,
 }
 
 
+BOOT_TEST(test_pipe_readv_writev,
+	"Test that WriteV gathers and ReadV scatters data through a pipe"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);	
+
+	char hdr[] = "Hello", body[] = " world";
+	iovec_t out[2] = { { hdr, 5 }, { body, 7 } };
+	ASSERT(WriteV(pipe.write, out, 2)==12);
+
+	char b1[4], b2[8];
+	iovec_t in[2] = { { b1, 4 }, { b2, 8 } };
+	ASSERT(ReadV(pipe.read, in, 2)==12);
+	ASSERT(memcmp(b1, "Hell", 4)==0);
+	ASSERT(strcmp(b2, "o world")==0);
+
+	Close(pipe.write);
+	ASSERT(ReadV(pipe.read, in, 2)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_packet_mode,
+	"Test that a packet-mode pipe delivers each write as one record"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe2(&pipe, ~PACKET_MODE)==-1);
+	ASSERT(Pipe2(&pipe, PACKET_MODE)==0);
+
+	char buffer[MAX_PACKET_SIZE+1];
+	ASSERT(Write(pipe.write, "Hello", 5)==5);
+	ASSERT(Write(pipe.write, " world", 7)==7);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==5);
+	ASSERT(memcmp(buffer, "Hello", 5)==0);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==7);
+	ASSERT(strcmp(buffer, " world")==0);
+
+	/* Segments are gathered into one record, and scattered out of it */
+	char hdr[] = "Hello", body[] = " world";
+	iovec_t out[2] = { { hdr, 5 }, { body, 7 } };
+	ASSERT(WriteV(pipe.write, out, 2)==12);
+	char b1[4], b2[8];
+	iovec_t in[2] = { { b1, 4 }, { b2, 8 } };
+	ASSERT(ReadV(pipe.read, in, 2)==12);
+	ASSERT(strcmp(b2, "o world")==0);
+
+	/* The excess of a record is discarded */
+	ASSERT(Write(pipe.write, "Hello world", 12)==12);
+	ASSERT(Write(pipe.write, "Bye", 4)==4);
+	ASSERT(Read(pipe.read, buffer, 5)==5);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==4);
+	ASSERT(strcmp(buffer, "Bye")==0);
+
+	ASSERT(Write(pipe.write, buffer, MAX_PACKET_SIZE+1)==-1);
+	ASSERT(Write(pipe.write, buffer, 0)==0);
+
+	pollfd_t pfd = { .fd = pipe.read, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 0)==0);
+
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+
+static int packet_writer(int argl, void* args)
+{
+	char buffer[3000];
+	for(int n=1; n<=3000; n+=7) {
+		memset(buffer, n & 0xff, n);
+		ASSERT(Write(argl, buffer, n)==n);
+	}
+	Close(argl);
+	return 0;
+}
+
+BOOT_TEST(test_pipe_packet_blocking,
+	"Test that records are not split when the writer of a packet-mode pipe blocks"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe2(&pipe, PACKET_MODE)==0);
+
+	Tid_t t = CreateThread(packet_writer, pipe.write, NULL);
+
+	char buffer[MAX_PACKET_SIZE];
+	for(int n=1; n<=3000; n+=7) {
+		ASSERT(Read(pipe.read, buffer, sizeof(buffer))==n);
+		for(int i=0; i<n; i++)
+			ASSERT(buffer[i]==(char)(n & 0xff));
+	}
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+
+static int pipe_echo(int argl, void* args)
+{
+	pipe_t* pipes = args;
+	char c;
+	while(Read(pipes[0].read, &c, 1)==1)
+		ASSERT(Write(pipes[1].write, &c, 1)==1);
+	return 0;
+}
+
+BOOT_TEST(test_pipe_ping_pong,
+	"Test a ping-pong of single bytes, where each end waits for the other"
+	)
+{
+	pipe_t pipes[2];
+	ASSERT(Pipe(&pipes[0])==0);
+	ASSERT(Pipe(&pipes[1])==0);
+
+	Tid_t t = CreateThread(pipe_echo, 0, pipes);
+
+	for(int i=0; i<2000; i++) {
+		char c = i & 0xff, d;
+		ASSERT(Write(pipes[0].write, &c, 1)==1);
+		ASSERT(Read(pipes[1].read, &d, 1)==1);
+		ASSERT(c==d);
+	}
+
+	ASSERT(Close(pipes[0].write)==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	return 0;
+}
+
+
 /* Takes one integer argument, writes that many bytes to stdout.
  */
 int data_producer(int argl, void* args)
@@ -1625,6 +1910,295 @@ BOOT_TEST(test_pipe_multi_producer,
 	return 0;
 }
 
+static int pipe_counting_reader(int argl, void* args)
+{
+	char buffer[1000];
+	int count = 0, rc;
+	while((rc = Read(argl, buffer, sizeof(buffer))) > 0)
+		count += rc;
+	ASSERT(rc==0);
+	return count;
+}
+
+static int pipe_counting_writer(int argl, void* args)
+{
+	char buffer[777];
+	memset(buffer, 'x', sizeof(buffer));
+	int count = 0;
+	while(count < 100000) {
+		int n = 100000-count < sizeof(buffer) ? 100000-count : sizeof(buffer);
+		int rc = Write(argl, buffer, n);
+		ASSERT(rc>0);
+		count += rc;
+	}
+	return 0;
+}
+
+BOOT_TEST(test_pipe_multi_consumer,
+	"Test that no wakeup is lost when many readers and writers block on one pipe."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	Tid_t readers[4], writers[4];
+	for(int i=0;i<4;i++) {
+		readers[i] = CreateThread(pipe_counting_reader, pipe.read, NULL);
+		writers[i] = CreateThread(pipe_counting_writer, pipe.write, NULL);
+	}
+
+	for(int i=0;i<4;i++)
+		ASSERT(ThreadJoin(writers[i], NULL)==0);
+	Close(pipe.write);
+
+	int total = 0;
+	for(int i=0;i<4;i++) {
+		int count;
+		ASSERT(ThreadJoin(readers[i], &count)==0);
+		total += count;
+	}
+	ASSERT(total == 4*100000);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_threads_while_fidt_grows,
+	"Test that threads of one process move data over different pipes\n"
+	"while another thread grows and shrinks the file id table."
+	)
+{
+	pipe_t pipe[2];
+	Tid_t readers[2], writers[2];
+	for(int i=0;i<2;i++) {
+		ASSERT(Pipe(&pipe[i])==0);
+		readers[i] = CreateThread(pipe_counting_reader, pipe[i].read, NULL);
+		writers[i] = CreateThread(pipe_counting_writer, pipe[i].write, NULL);
+	}
+
+	/* Open and close many fids, so that the table grows under the readers */
+	ASSERT(SetFileLimit(2048)==0);
+	for(int round=0; round<4; round++) {
+		Fid_t fids[1024];
+		for(int i=0;i<1024;i++)
+			ASSERT((fids[i] = OpenNull())!=NOFILE);
+		for(int i=0;i<1024;i++)
+			ASSERT(Close(fids[i])==0);
+	}
+
+	for(int i=0;i<2;i++) {
+		int count;
+		ASSERT(ThreadJoin(writers[i], NULL)==0);
+		Close(pipe[i].write);
+		ASSERT(ThreadJoin(readers[i], &count)==0);
+		ASSERT(count == 100000);
+	}
+	return 0;
+}
+
+
+
+/* Write 100000 bytes of a known pattern, then close the pipe */
+static int pattern_writer(int argl, void* args)
+{
+	char buf[1000];
+	for(int i=0; i<100000; i+=1000) {
+		for(int j=0; j<1000; j++) buf[j] = (char)((i+j) % 251);
+		for(int n=0, rc; n<1000; n+=rc)
+			ASSERT((rc = Write(argl, buf+n, 1000-n)) > 0);
+	}
+	Close(argl);
+	return 0;
+}
+
+/* Copy from one pipe to another, then close the second */
+static int pipe_copier(int argl, void* args)
+{
+	pipe_t* pipe = args;
+	int rc, total = 0;
+	while((rc = CopyStream(argl, pipe->write, 1<<20)) > 0)
+		total += rc;
+	ASSERT(rc==0);
+	Close(pipe->write);
+	return total;
+}
+
+BOOT_TEST(test_copy_stream,
+	"Test that CopyStream moves data between pipes, and between a pipe\n"
+	"and a stream that is not a pipe, up to the end of data."
+	)
+{
+	pipe_t p1, p2;
+	ASSERT(Pipe(&p1)==0);
+	ASSERT(Pipe(&p2)==0);
+	char buf[1000];
+
+	/* Bad fids */
+	ASSERT(CopyStream(NOFILE, p2.write, 10)==-1);
+	ASSERT(CopyStream(p1.read, MAX_FILEID, 10)==-1);
+
+	/* No more than len bytes are moved */
+	ASSERT(Write(p1.write, "Hello world", 12)==12);
+	ASSERT(CopyStream(p1.read, p2.write, 6)==6);
+	ASSERT(CopyStream(p1.read, p2.write, 100)==6);
+	ASSERT(Read(p2.read, buf, sizeof(buf))==12);
+	ASSERT(strcmp(buf, "Hello world")==0);
+
+	/* An empty non-blocking input */
+	ASSERT(SetNonBlocking(p1.read, 1)==0);
+	ASSERT(CopyStream(p1.read, p2.write, 100)==WOULDBLOCK);
+	ASSERT(SetNonBlocking(p1.read, 0)==0);
+
+	/* Through a stream that is not a pipe */
+	Fid_t null = OpenNull();
+	ASSERT(CopyStream(null, p2.write, 5000)==5000);
+	ASSERT(CopyStream(p2.read, null, 5000)==5000);
+
+	/* Many times the pipe buffer, until the end of data */
+	Tid_t w = CreateThread(pattern_writer, p1.write, NULL);
+	Tid_t c = CreateThread(pipe_copier, p1.read, &p2);
+	int n = 0, rc;
+	while((rc = Read(p2.read, buf, sizeof(buf))) > 0) {
+		for(int j=0; j<rc; j++)
+			ASSERT(buf[j] == (char)((n+j) % 251));
+		n += rc;
+	}
+	ASSERT(rc==0 && n==100000);
+
+	int total;
+	ASSERT(ThreadJoin(w, NULL)==0);
+	ASSERT(ThreadJoin(c, &total)==0);
+	ASSERT(total==100000);
+	return 0;
+}
+
+
+
+static int prompting_program(size_t argc, const char** argv)
+{
+	FILE* fin = fidopen(0, "r");
+	FILE* fout = fidopen(1, "w");
+
+	/* The prompt is flushed by the read */
+	fputs("name? ", fout);
+	ASSERT(fgetc(fin)=='x');
+
+	/* This is flushed when the program returns */
+	fputs("done", fout);
+	return 0;
+}
+
+BOOT_TEST(test_fidopen_buffering,
+	"Test that fidopen streams buffer their output, and flush it when\n"
+	"the process reads, and when a program started by Execute returns."
+	)
+{
+	/* Keep fids 0 and 1 for the child's streams */
+	ASSERT(OpenNull()==0);
+	ASSERT(OpenNull()==1);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetNonBlocking(pipe.read, 1)==0);
+	char buf[16];
+
+	/* An unbuffered stream writes at once */
+	FILE* f = fidopen2(pipe.write, "w", 0);
+	fputc('u', f);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==1);
+	fclose(f);
+
+	/* A buffered stream writes when flushed */
+	f = fidopen(pipe.write, "w");
+	fputc('b', f);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==WOULDBLOCK);
+	fflush(f);
+	ASSERT(Read(pipe.read, buf, sizeof(buf))==1);
+	fclose(f);
+
+	/* The child reads 0 and writes 1 */
+	pipe_t input;
+	ASSERT(Pipe(&input)==0);
+	ASSERT(Dup2(input.read, 0)==0);
+	ASSERT(Dup2(pipe.write, 1)==0);
+	const char* argv[] = { "prompting_program" };
+	Pid_t pid = Execute(prompting_program, 1, argv);
+	ASSERT(pid!=NOPROC);
+	Close(0); Close(1);
+	Close(input.read); Close(pipe.write);
+
+	ASSERT(SetNonBlocking(pipe.read, 0)==0);
+	ASSERT(Read(pipe.read, buf, 6)==6);
+	ASSERT(memcmp(buf, "name? ", 6)==0);
+	ASSERT(Write(input.write, "x", 1)==1);
+
+	int n = 0, rc;
+	while((rc = Read(pipe.read, buf+n, sizeof(buf)-n)) > 0)
+		n += rc;
+	ASSERT(n==4 && memcmp(buf, "done", 4)==0);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	return 0;
+}
+
+
+static int stdout_program(size_t argc, const char** argv)
+{
+	/* The shared stdout passes this to the buffer of the process,
+	   which a read of stdin flushes */
+	printf("one ");
+	printf("two");
+	ASSERT(fgetc(stdin)=='x');
+
+	/* The program does not return, but its exit hook flushes this */
+	printf("!");
+	Exit(5);
+	return 0;
+}
+
+BOOT_TEST(test_stdout_buffering,
+	"Test that the shared standard output is buffered per process, and\n"
+	"flushed when the process reads, and when it calls Exit."
+	)
+{
+	/* Keep fids 0 and 1 for the child's streams */
+	ASSERT(OpenNull()==0);
+	ASSERT(OpenNull()==1);
+	ASSERT(IsTerminal(0)==0);
+	ASSERT(IsTerminal(NOFILE)==-1);
+
+	pipe_t input, output;
+	ASSERT(Pipe(&input)==0);
+	ASSERT(Pipe(&output)==0);
+	ASSERT(IsTerminal(output.write)==0);
+	ASSERT(Dup2(input.read, 0)==0);
+	ASSERT(Dup2(output.write, 1)==0);
+
+	tinyos_replace_stdio();
+	const char* argv[] = { "stdout_program" };
+	Pid_t pid = Execute(stdout_program, 1, argv);
+	ASSERT(pid!=NOPROC);
+	Close(0); Close(1);
+	Close(input.read); Close(output.write);
+
+	char buf[16];
+	int n = 0, rc;
+	while(n < 7 && (rc = Read(output.read, buf+n, sizeof(buf)-n)) > 0)
+		n += rc;
+	ASSERT(n==7 && memcmp(buf, "one two", 7)==0);
+	ASSERT(Write(input.write, "x", 1)==1);
+
+	n = 0;
+	while((rc = Read(output.read, buf+n, sizeof(buf)-n)) > 0)
+		n += rc;
+	ASSERT(n==1 && buf[0]=='!');
+
+	int status;
+	ASSERT(WaitChild(pid, &status)==pid);
+	ASSERT(status==5);
+	tinyos_restore_stdio();
+	return 0;
+}
+
+
 
 TEST_SUITE(pipe_tests,
 	"A suite of tests for pipes. We are focusing on correctness, not performance."
@@ -1634,8 +2208,17 @@ TEST_SUITE(pipe_tests,
 	&test_pipe_fails_on_exhausted_fid,
 	&test_pipe_close_reader,
 	&test_pipe_close_writer,
+	&test_pipe_readv_writev,
+	&test_pipe_packet_mode,
+	&test_pipe_packet_blocking,
+	&test_pipe_ping_pong,
 	&test_pipe_single_producer,
 	&test_pipe_multi_producer,
+	&test_pipe_multi_consumer,
+	&test_pipe_threads_while_fidt_grows,
+	&test_fidopen_buffering,
+	&test_stdout_buffering,
+	&test_copy_stream,
 	NULL
 };
 
@@ -2183,42 +2766,1898 @@ BOOT_TEST(test_shudown_write,
 
 
 
+BOOT_TEST(test_socket_packet_mode,
+	"Test that packet-mode sockets preserve message boundaries in both directions"
+	)
+{
+	ASSERT(Socket2(100, ~PACKET_MODE)==NOFILE);
 
-TEST_SUITE(socket_tests,
-	"A suite of tests for sockets."
+	Fid_t lsock = Socket2(100, PACKET_MODE);
+	ASSERT(lsock!=NOFILE);
+	ASSERT(Listen(lsock)==0);
+
+	/* A byte-stream socket cannot connect to a packet-mode listener */
+	Fid_t cli = Socket(NOPORT);
+	ASSERT(Connect(cli, 100, 200)==-1);
+	Close(cli);
+
+	Fid_t srv;
+	cli = Socket2(NOPORT, PACKET_MODE);
+	connect_sockets(cli, lsock, &srv, 100);
+
+	char buffer[64];
+	ASSERT(Write(cli, "Hello", 5)==5);
+	ASSERT(Write(cli, " world", 7)==7);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==5);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==7);
+	ASSERT(strcmp(buffer, " world")==0);
+
+	ASSERT(Write(srv, "Bye", 4)==4);
+	ASSERT(Read(cli, buffer, sizeof(buffer))==4);
+	ASSERT(strcmp(buffer, "Bye")==0);
+
+	ShutDown(cli, SHUTDOWN_WRITE);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+
+static int reuse_port_acceptor(int argl, void* args)
+{
+	Fid_t lsock = argl;
+	for(int i=0; i<3; i++) {
+		Fid_t srv = Accept(lsock);
+		ASSERT(srv!=NOFILE);
+		ASSERT(Close(srv)==0);
+	}
+	return 0;
+}
+
+BOOT_TEST(test_socket_reuse_port,
+	"Test that listeners with REUSE_PORT share a port, and that connections alternate between them"
 	)
 {
-	&test_socket_constructor_many_per_port,
-	&test_socket_constructor_out_of_fids,
-	&test_socket_constructor_illegal_port,
-	
-	&test_listen_success,
-	&test_listen_fails_on_bad_fid,
-	&test_listen_fails_on_NOPORT,
-	&test_listen_fails_on_occupied_port,
-	&test_listen_fails_on_initialized_socket,
+	/* Without REUSE_PORT on both, the port stays exclusive */
+	Fid_t l0 = Socket(100);
+	Fid_t l1 = Socket2(100, REUSE_PORT);
+	ASSERT(Listen(l0)==0);
+	ASSERT(Listen(l1)==-1);
+	ASSERT(Close(l0)==0);
+	ASSERT(Close(l1)==0);
+
+	l0 = Socket2(100, REUSE_PORT);
+	l1 = Socket(100);
+	ASSERT(Listen(l0)==0);
+	ASSERT(Listen(l1)==-1);
+	ASSERT(Close(l1)==0);
+
+	/* All the listeners must agree on packet mode */
+	l1 = Socket2(100, REUSE_PORT|PACKET_MODE);
+	ASSERT(Listen(l1)==-1);
+	ASSERT(Close(l1)==0);
+
+	l1 = Socket2(100, REUSE_PORT);
+	ASSERT(Listen(l1)==0);
+
+	/* Each acceptor takes exactly 3 connections, else the test hangs */
+	Tid_t t0 = CreateThread(reuse_port_acceptor, l0, NULL);
+	Tid_t t1 = CreateThread(reuse_port_acceptor, l1, NULL);
+
+	for(int i=0; i<6; i++) {
+		Fid_t cli = Socket(NOPORT);
+		ASSERT(Connect(cli, 100, 1000)==0);
+		ASSERT(Close(cli)==0);
+	}
 
-	&test_accept_succeds,
-	&test_accept_fails_on_bad_fid,
-	&test_accept_fails_on_unbound_socket,
-	&test_accept_fails_on_connected_socket,
-	&test_accept_reusable,
-	&test_accept_fails_on_exhausted_fid,
-	&test_accept_unblocks_on_close,
+	ASSERT(ThreadJoin(t0, NULL)==0);
+	ASSERT(ThreadJoin(t1, NULL)==0);
+	return 0;
+}
 
-	&test_connect_fails_on_bad_fid,
-	&test_connect_fails_on_bad_socket,
-	&test_connect_fails_on_illegal_port,
-	&test_connect_fails_on_non_listened_port,
-	&test_connect_fails_on_timeout,
 
-	&test_socket_small_transfer,
-	&test_socket_single_producer,
-	&test_socket_multi_producer,
+static int reuse_port_connector(int argl, void* args)
+{
+	Fid_t cli = Socket(NOPORT);
+	int rc = Connect(cli, 100, 5000);
+	Close(cli);
+	return rc;
+}
 
-	&test_shudown_read,
-	&test_shudown_write,
+BOOT_TEST(test_socket_reuse_port_close,
+	"Test that the requests of a closed listener move to the other listeners of its port"
+	)
+{
+	Fid_t lsock[2] = { Socket2(100, REUSE_PORT), Socket2(100, REUSE_PORT) };
+	ASSERT(Listen(lsock[0])==0);
+	ASSERT(Listen(lsock[1])==0);
+
+	Tid_t t = CreateThread(reuse_port_connector, 0, NULL);
+
+	/* Close the listener holding the request, accept it on the other */
+	pollfd_t pfd[2] = { { .fd = lsock[0], .events = POLL_READ }, { .fd = lsock[1], .events = POLL_READ } };
+	ASSERT(Poll(pfd, 2, 1000)==1);
+	int busy = (pfd[0].revents & POLL_READ) ? 0 : 1;
+	ASSERT(Close(lsock[busy])==0);
+
+	Fid_t srv = Accept(lsock[1-busy]);
+	ASSERT(srv!=NOFILE);
+	int rc;
+	ASSERT(ThreadJoin(t, &rc)==0 && rc==0);
+	ASSERT(Close(srv)==0);
+
+	/* With the last listener closed, a pending Connect fails at once */
+	t = CreateThread(reuse_port_connector, 0, NULL);
+	pfd[0].fd = lsock[1-busy];
+	ASSERT(Poll(pfd, 1, 1000)==1);
+	ASSERT(Close(lsock[1-busy])==0);
+
+	TimerDuration start = bios_clock();
+	ASSERT(ThreadJoin(t, &rc)==0 && rc==-1);
+	ASSERT(bios_clock() - start < 2000000);
+	return 0;
+}
+
+
+static int backlog_connector(int argl, void* args)
+{
+	int* refused = args;
+	Fid_t cli = Socket(NOPORT);
+	int rc = Connect(cli, 100, 5000);
+	if(rc==-1)
+		__atomic_add_fetch(refused, 1, __ATOMIC_SEQ_CST);
+	else
+		ASSERT(Close(cli)==0);
+	return rc;
+}
+
+BOOT_TEST(test_socket_accept_many,
+	"Test that AcceptMany drains the queue of a listener, and that Connect fails on a full backlog"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen2(lsock, 0)==-1);
+	ASSERT(Listen2(lsock, MAX_LISTEN_BACKLOG+1)==-1);
+	ASSERT(Listen2(lsock, 3)==0);
+
+	Fid_t fids[8];
+	ASSERT(AcceptMany(lsock, NULL, 8)==-1);
+	ASSERT(AcceptMany(lsock, fids, 0)==-1);
+	ASSERT(AcceptMany(NOFILE, fids, 8)==-1);
+
+	/* Of 4 connections, the one that finds the backlog full fails at once */
+	int refused = 0;
+	Tid_t t[4];
+	for(int i=0; i<4; i++)
+		t[i] = CreateThread(backlog_connector, 0, &refused);
+	while(__atomic_load_n(&refused, __ATOMIC_SEQ_CST)==0)
+		fibo(15);
+
+	ASSERT(AcceptMany(lsock, fids, 8)==3);
+	for(int i=0; i<3; i++)
+		ASSERT(Close(fids[i])==0);
+
+	int failed = 0;
+	for(int i=0; i<4; i++) {
+		int rc;
+		ASSERT(ThreadJoin(t[i], &rc)==0);
+		if(rc==-1) failed++;
+	}
+	ASSERT(failed==1);
+
+	/* A non-blocking listener accepts nothing */
+	ASSERT(SetNonBlocking(lsock, 1)==0);
+	ASSERT(AcceptMany(lsock, fids, 8)==0);
+	return 0;
+}
 
+
+BOOT_TEST(test_socket_pair,
+	"Test that SocketPair returns two connected sockets"
+	)
+{
+	ASSERT(SocketPair(NULL)==-1);
+
+	Fid_t sock[2];
+	ASSERT(SocketPair(sock)==0);
+	ASSERT(sock[0]!=sock[1]);
+
+	check_transfer(sock[0], sock[1]);
+	check_transfer(sock[1], sock[0]);
+
+	/* They are peers, not listeners or unbound sockets */
+	ASSERT(Listen(sock[0])==-1);
+	ASSERT(Accept(sock[0])==NOFILE);
+	ASSERT(Connect(sock[1], 100, 200)==-1);
+
+	ASSERT(ShutDown(sock[0], SHUTDOWN_WRITE)==0);
+	char c;
+	ASSERT(Read(sock[1], &c, 1)==0);
+	check_transfer(sock[1], sock[0]);
+
+	ASSERT(Close(sock[1])==0);
+	ASSERT(Write(sock[0], "x", 1)==-1);
+	ASSERT(Close(sock[0])==0);
+
+	/* The fids may run out */
+	for(int i=0; i<MAX_FILEID-1; i++)
+		ASSERT(Socket(NOPORT)!=NOFILE);
+	ASSERT(SocketPair(sock)==-1);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_recycled_connections,
+	"Test that connections are sound when their objects are recycled"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	for(int i=0; i<200; i++) {
+		Fid_t cli = Socket(NOPORT), srv;
+		connect_sockets(cli, lsock, &srv, 100);
+
+		/* A recycled connection starts empty */
+		ASSERT(SetNonBlocking(srv, 1)==0);
+		char c;
+		ASSERT(Read(srv, &c, 1)==WOULDBLOCK);
+
+		/* Leave data behind, half of the time */
+		check_transfer(cli, srv);
+		if(i & 1)
+			ASSERT(Write(srv, "left over", 10)==10);
+
+		/* Close the two ends in either order */
+		ASSERT(Close((i & 2) ? srv : cli)==0);
+		ASSERT(Close((i & 2) ? cli : srv)==0);
+
+		Fid_t pair[2];
+		ASSERT(SocketPair(pair)==0);
+		ASSERT(SetNonBlocking(pair[1], 1)==0);
+		ASSERT(Read(pair[1], &c, 1)==WOULDBLOCK);
+		check_transfer(pair[0], pair[1]);
+		ASSERT(Close(pair[0])==0);
+		ASSERT(Close(pair[1])==0);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_copy_stream,
+	"Test that CopyStream relays data between two socket connections"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	Fid_t cli[2], srv[2];
+	for(int i=0; i<2; i++) {
+		cli[i] = Socket(NOPORT);
+		connect_sockets(cli[i], lsock, srv+i, 100);
+	}
+
+	/* Relay from the first connection to the second, as a read waiting for the low-watermark */
+	ASSERT(SetSockOpt(srv[0], SO_RCVLOWAT, 100)==0);
+	ASSERT(SetNonBlocking(srv[0], 1)==0);
+	ASSERT(Write(cli[0], "Hello world", 12)==12);
+	ASSERT(CopyStream(srv[0], srv[1], 1000)==WOULDBLOCK);
+	ASSERT(ShutDown(cli[0], SHUTDOWN_WRITE)==0);
+	ASSERT(CopyStream(srv[0], srv[1], 1000)==12);
+	ASSERT(CopyStream(srv[0], srv[1], 1000)==0);
+
+	char buf[12];
+	ASSERT(Read(cli[1], buf, 12)==12);
+	ASSERT(strcmp(buf, "Hello world")==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_options,
+	"Test the buffer size, low-watermark and no-delay options of sockets"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli = Socket(NOPORT), srv;
+
+	unsigned int val;
+	ASSERT(GetSockOpt(cli, SO_SNDBUF, &val)==-1);
+	ASSERT(SetSockOpt(lsock, SO_SNDBUF, 4096)==-1);
+
+	connect_sockets(cli, lsock, &srv, 100);
+
+	ASSERT(GetSockOpt(cli, SO_SNDBUF, NULL)==-1);
+	ASSERT(GetSockOpt(cli, SO_SNDBUF, &val)==0 && val==8192);
+	ASSERT(GetSockOpt(srv, SO_RCVLOWAT, &val)==0 && val==1);
+	ASSERT(GetSockOpt(cli, SO_NODELAY, &val)==0 && val==1);
+
+	ASSERT(SetSockOpt(srv, SO_RCVBUF, MIN_SOCKET_BUFFER-1)==-1);
+	ASSERT(SetSockOpt(srv, SO_RCVBUF, MAX_SOCKET_BUFFER+1)==-1);
+	ASSERT(SetSockOpt(srv, SO_RCVLOWAT, 0)==-1);
+	ASSERT(SetSockOpt(srv, SO_RCVLOWAT, 8193)==-1);
+	ASSERT(SetSockOpt(cli, SO_NODELAY, 2)==-1);
+
+	/* The receive buffer of one end is the send buffer of the other */
+	ASSERT(SetSockOpt(srv, SO_RCVBUF, 3000)==0);
+	ASSERT(GetSockOpt(cli, SO_SNDBUF, &val)==0 && val==4096);
+
+	static char out[65536], in[65536];
+	for(int i=0; i<65536; i++) out[i] = i % 251;
+
+	ASSERT(SetNonBlocking(cli, 1)==0);
+	ASSERT(Write(cli, out, 65536)==4096);
+	ASSERT(Write(cli, out, 1)==WOULDBLOCK);
+
+	/* A buffer holding data can grow, but not shrink below the data */
+	ASSERT(SetSockOpt(cli, SO_SNDBUF, 2048)==-1);
+	ASSERT(SetSockOpt(cli, SO_SNDBUF, 65536)==0);
+	ASSERT(Write(cli, out+4096, 65536)==65536-4096);
+	ASSERT(Read(srv, in, 65536)==65536);
+	ASSERT(memcmp(in, out, 65536)==0);
+	ASSERT(SetNonBlocking(cli, 0)==0);
+
+	/* A read waits for the low-watermark, except at the end of the data */
+	ASSERT(SetSockOpt(srv, SO_RCVLOWAT, 100)==0);
+	ASSERT(Write(cli, out, 50)==50);
+	pollfd_t pfd = { .fd = srv, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 0)==0);
+	ASSERT(SetNonBlocking(srv, 1)==0);
+	ASSERT(Read(srv, in, 1000)==WOULDBLOCK);
+	ASSERT(Write(cli, out+50, 60)==60);
+	ASSERT(Poll(&pfd, 1, 0)==1);
+	ASSERT(Read(srv, in, 1000)==110);
+	ASSERT(memcmp(in, out, 110)==0);
+	ASSERT(SetNonBlocking(srv, 0)==0);
+
+	/* A buffer cannot shrink below the low-watermark */
+	ASSERT(SetSockOpt(srv, SO_RCVLOWAT, 2000)==0);
+	ASSERT(SetSockOpt(srv, SO_RCVBUF, 1024)==-1);
+
+	ASSERT(Write(cli, out, 30)==30);
+	ASSERT(ShutDown(cli, SHUTDOWN_WRITE)==0);
+	ASSERT(Read(srv, in, 1000)==30);
+	ASSERT(Read(srv, in, 1000)==0);
+	ASSERT(SetSockOpt(cli, SO_SNDBUF, 4096)==-1);
+
+	/* Coalesced small writes are delivered, if late */
+	ASSERT(SetSockOpt(srv, SO_NODELAY, 0)==0);
+	ASSERT(GetSockOpt(srv, SO_NODELAY, &val)==0 && val==0);
+	for(int i=0; i<5; i++) {
+		char c;
+		ASSERT(Write(srv, "x", 1)==1);
+		ASSERT(Read(cli, &c, 1)==1 && c=='x');
+	}
+
+	/* Packet-mode sockets need room for a maximal record */
+	Fid_t pair[2];
+	lsock = Socket2(101, PACKET_MODE);
+	ASSERT(Listen(lsock)==0);
+	pair[0] = Socket2(NOPORT, PACKET_MODE);
+	connect_sockets(pair[0], lsock, &pair[1], 101);
+	ASSERT(SetSockOpt(pair[0], SO_SNDBUF, 4096)==-1);
+	ASSERT(SetSockOpt(pair[0], SO_SNDBUF, 8192)==0);
+	ASSERT(SetSockOpt(pair[1], SO_RCVLOWAT, 10)==-1);
+	return 0;
+}
+
+
+static int datagram_echo_server(int argl, void* args)
+{
+	Fid_t sock = argl;
+	for(int i=0; i<100; i++) {
+		char buffer[16];
+		port_t from;
+		int n = RecvFrom(sock, buffer, sizeof(buffer), &from);
+		ASSERT(n > 0);
+		ASSERT(from == 101);
+		ASSERT(SendTo(sock, from, buffer, n)==n);
+	}
+	return 0;
+}
+
+BOOT_TEST(test_socket_datagram,
+	"Test that datagram sockets exchange messages by port, without connections"
+	)
+{
+	ASSERT(Socket2(100, DATAGRAM|PACKET_MODE)==NOFILE);
+	ASSERT(Socket2(100, DATAGRAM|REUSE_PORT)==NOFILE);
+
+	Fid_t srv = Socket2(100, DATAGRAM);
+	ASSERT(srv!=NOFILE);
+	ASSERT(Socket2(100, DATAGRAM)==NOFILE);
+	ASSERT(Listen(srv)==-1);
+
+	/* A port has a datagram socket and listeners independently */
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(Close(lsock)==0);
+	ASSERT(Connect(Socket(NOPORT), 100, 100)==-1);
+
+	Fid_t cli = Socket2(101, DATAGRAM);
+	ASSERT(SendTo(cli, 102, "x", 1)==-1);
+	ASSERT(SendTo(cli, 100, "x", MAX_DATAGRAM_SIZE+1)==-1);
+	ASSERT(Write(cli, "x", 1)==-1);
+
+	/* Request-response with an echo server */
+	Tid_t t = CreateThread(datagram_echo_server, srv, NULL);
+	for(int i=0; i<100; i++) {
+		char msg[16], reply[16];
+		int n = sprintf(msg, "ping %d", i) + 1;
+		port_t from;
+		ASSERT(SendTo(cli, 100, msg, n)==n);
+		ASSERT(RecvFrom(cli, reply, sizeof(reply), &from)==n);
+		ASSERT(from==100);
+		ASSERT(strcmp(msg, reply)==0);
+	}
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* An unbound socket can send, but not receive */
+	Fid_t anon = Socket2(NOPORT, DATAGRAM);
+	char buffer[16];
+	port_t from;
+	ASSERT(RecvFrom(anon, buffer, sizeof(buffer), &from)==-1);
+	ASSERT(SendTo(anon, 101, "hello", 6)==6);
+	ASSERT(RecvFrom(cli, buffer, 3, &from)==3);
+	ASSERT(from==NOPORT && memcmp(buffer, "hel", 3)==0);
+
+	/* The queue is bounded */
+	ASSERT(SetNonBlocking(cli, 1)==0);
+	ASSERT(RecvFrom(cli, buffer, sizeof(buffer), NULL)==WOULDBLOCK);
+	pollfd_t pfd = { .fd = cli, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 0)==0);
+	for(int i=0; i<MAX_DATAGRAM_QUEUE; i++)
+		ASSERT(SendTo(anon, 101, (char*)&i, sizeof(i))==sizeof(i));
+	ASSERT(SendTo(anon, 101, "x", 1)==-1);
+	ASSERT(Poll(&pfd, 1, 0)==1);
+	for(int i=0; i<MAX_DATAGRAM_QUEUE; i++) {
+		int j;
+		ASSERT(RecvFrom(cli, (char*)&j, sizeof(j), NULL)==sizeof(j));
+		ASSERT(i==j);
+	}
+
+	/* Closing frees the port, dropping the queue */
+	ASSERT(SendTo(anon, 101, "x", 1)==1);
+	ASSERT(Close(cli)==0);
+	ASSERT(SendTo(anon, 101, "x", 1)==-1);
+	ASSERT(Socket2(101, DATAGRAM)!=NOFILE);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_ephemeral_ports,
+	"Test that Connect binds unbound sockets to unique ephemeral ports, and that\n"
+	"each connection has a unique pair of ports."
+	)
+{
+	Fid_t lsock = Socket(MAX_PORT);
+	ASSERT(Listen(lsock)==0);
+
+	/* Each client gets its own port */
+	Fid_t cli[3], srv[3];
+	port_t port[3], peer;
+	for(int i=0; i<3; i++) {
+		cli[i] = Socket(NOPORT);
+		ASSERT(GetSockName(cli[i], &port[i])==0 && port[i]==NOPORT);
+		connect_sockets(cli[i], lsock, &srv[i], MAX_PORT);
+
+		ASSERT(GetSockName(cli[i], &port[i])==0);
+		ASSERT(port[i] >= MIN_EPHEMERAL_PORT && port[i] <= MAX_PORT);
+		for(int j=0; j<i; j++)
+			ASSERT(port[i]!=port[j]);
+
+		ASSERT(GetPeerName(cli[i], &peer)==0 && peer==MAX_PORT);
+		ASSERT(GetSockName(srv[i], &peer)==0 && peer==MAX_PORT);
+		ASSERT(GetPeerName(srv[i], &peer)==0 && peer==port[i]);
+	}
+	check_transfer(cli[1], srv[1]);
+
+	ASSERT(GetSockName(lsock, &peer)==0 && peer==MAX_PORT);
+	ASSERT(GetPeerName(lsock, &peer)==-1);
+	ASSERT(GetSockName(cli[0], NULL)==-1);
+	ASSERT(GetSockName(NOFILE, &peer)==-1);
+
+	/* A bound socket connects once to a port */
+	Fid_t a = Socket(5), b = Socket(5), c;
+	connect_sockets(a, lsock, &c, MAX_PORT);
+	ASSERT(GetPeerName(c, &peer)==0 && peer==5);
+	ASSERT(Connect(b, MAX_PORT, 100)==-1);
+	ASSERT(Close(a)==0);
+	connect_sockets(b, lsock, &c, MAX_PORT);
+
+	/* Without a listener, Connect fails before binding */
+	Fid_t d = Socket(NOPORT);
+	ASSERT(Close(lsock)==0);
+	ASSERT(Connect(d, MAX_PORT, 100)==-1);
+	ASSERT(GetSockName(d, &peer)==0 && peer==NOPORT);
+	return 0;
+}
+
+
+#define GATEWAY_CLIENTS 3
+
+/* a host thread: send a message to the gateway and expect it back */
+static void* gateway_host_client(void* arg)
+{
+	const char* path = ((const char**)arg)[0];
+	const char* msg = ((const char**)arg)[1];
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strcpy(addr.sun_path, path);
+
+	/* the socket appears when TinyOS boots */
+	int fd;
+	while(1) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(connect(fd, (struct sockaddr*)&addr, sizeof(addr))==0) break;
+		close(fd);
+		usleep(1000);
+	}
+
+	size_t len = strlen(msg);
+	if(write(fd, msg, len) != (ssize_t)len) return NULL;
+	shutdown(fd, SHUT_WR);
+
+	char reply[64];
+	size_t count = 0;
+	ssize_t n;
+	while((n = read(fd, reply+count, sizeof(reply)-count)) > 0)
+		count += n;
+	close(fd);
+
+	return (count==len && memcmp(reply, msg, len)==0) ? (void*)msg : NULL;
+}
+
+static int gateway_echo_server(int argl, void* args)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	for(int i=0; i<GATEWAY_CLIENTS; i++) {
+		Fid_t sock = Accept(lsock);
+		ASSERT(sock!=NOFILE);
+
+		/* The connection is a stream socket, up to the end of data */
+		char buffer[64];
+		int count = 0, n;
+		while((n = Read(sock, buffer+count, sizeof(buffer)-count)) > 0)
+			count += n;
+		ASSERT(n==0);
+		ASSERT(SetSockOpt(sock, SO_RCVBUF, 4096)==-1);
+
+		pollfd_t pfd = { .fd = sock, .events = POLL_WRITE };
+		ASSERT(Poll(&pfd, 1, 0)==1);
+		ASSERT(Write(sock, buffer, count)==count);
+		ASSERT(ShutDown(sock, SHUTDOWN_BOTH)==0);
+		ASSERT(Read(sock, buffer, 1)==-1);
+		ASSERT(Close(sock)==0);
+	}
+
+	ASSERT(Close(lsock)==0);
+	return 0;
+}
+
+BARE_TEST(test_socket_gateway,
+	"Test that connections to a host gateway socket are accepted by the listeners\n"
+	"of its port, and exchange data with the host."
+	)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/tinyos_gateway_%d.sock", getpid());
+
+	ASSERT(boot_gateway(NOPORT, path)==-1);
+	ASSERT(boot_gateway(100, path)==0);
+
+	const char* msgs[GATEWAY_CLIENTS] = { "hello", "gateway", "world" };
+	const char* args[GATEWAY_CLIENTS][2];
+	pthread_t client[GATEWAY_CLIENTS];
+	for(int i=0; i<GATEWAY_CLIENTS; i++) {
+		args[i][0] = path;
+		args[i][1] = msgs[i];
+		ASSERT(pthread_create(&client[i], NULL, gateway_host_client, args[i])==0);
+	}
+
+	boot(2, 0, gateway_echo_server, 0, NULL);
+
+	for(int i=0; i<GATEWAY_CLIENTS; i++) {
+		void* result;
+		ASSERT(pthread_join(client[i], &result)==0);
+		ASSERT(result==msgs[i]);
+	}
+
+	/* The socket file is removed at shutdown */
+	ASSERT(access(path, F_OK)==-1);
+}
+
+
+TEST_SUITE(socket_tests,
+	"A suite of tests for sockets."
+	)
+{
+	&test_socket_constructor_many_per_port,
+	&test_socket_constructor_out_of_fids,
+	&test_socket_constructor_illegal_port,
+	
+	&test_listen_success,
+	&test_listen_fails_on_bad_fid,
+	&test_listen_fails_on_NOPORT,
+	&test_listen_fails_on_occupied_port,
+	&test_listen_fails_on_initialized_socket,
+
+	&test_accept_succeds,
+	&test_accept_fails_on_bad_fid,
+	&test_accept_fails_on_unbound_socket,
+	&test_accept_fails_on_connected_socket,
+	&test_accept_reusable,
+	&test_accept_fails_on_exhausted_fid,
+	&test_accept_unblocks_on_close,
+
+	&test_connect_fails_on_bad_fid,
+	&test_connect_fails_on_bad_socket,
+	&test_connect_fails_on_illegal_port,
+	&test_connect_fails_on_non_listened_port,
+	&test_connect_fails_on_timeout,
+
+	&test_socket_small_transfer,
+	&test_socket_single_producer,
+	&test_socket_multi_producer,
+
+	&test_shudown_read,
+	&test_shudown_write,
+
+	&test_socket_packet_mode,
+	&test_socket_reuse_port,
+	&test_socket_reuse_port_close,
+	&test_socket_accept_many,
+	&test_socket_pair,
+	&test_socket_recycled_connections,
+	&test_socket_copy_stream,
+	&test_socket_options,
+	&test_socket_datagram,
+	&test_socket_gateway,
+	&test_socket_ephemeral_ports,
+
+	NULL
+};
+
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  Poll tests
+ *
+ *
+ *
+ *********************************************/
+
+
+BOOT_TEST(test_poll_pipe,
+	"Test that Poll reports the readiness of the two ends of a pipe"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	pollfd_t pfd[2] = {
+		{ .fd = pipe.read, .events = POLL_READ },
+		{ .fd = pipe.write, .events = POLL_WRITE }
+	};
+
+	ASSERT(Poll(pfd, 2, 0)==1);
+	ASSERT(pfd[0].revents==0);
+	ASSERT(pfd[1].revents==POLL_WRITE);
+
+	ASSERT(Write(pipe.write, "Hello world", 12)==12);
+	ASSERT(Poll(pfd, 2, 0)==2);
+	ASSERT(pfd[0].revents==POLL_READ);
+
+	Close(pipe.write);
+	ASSERT(Poll(pfd, 1, 0)==1);
+	ASSERT(pfd[0].revents==(POLL_READ|POLL_HANGUP));
+
+	pfd[1].fd = NOFILE;
+	ASSERT(Poll(pfd+1, 1, 0)==0);
+	pfd[1].fd = MAX_FILEID-1;
+	ASSERT(Poll(pfd+1, 1, 0)==1);
+	ASSERT(pfd[1].revents==POLL_INVALID);
+	return 0;
+}
+
+
+BOOT_TEST(test_poll_timeout,
+	"Test that Poll returns 0 when the timeout expires"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	pollfd_t pfd = { .fd = pipe.read, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 200)==0);
+	ASSERT(pfd.revents==0);
+	return 0;
+}
+
+
+static int poll_delayed_writer(int argl, void* args)
+{
+	fibo(30);
+	ASSERT(Write(argl, "Hello world", 12)==12);
+	return 0;
+}
+
+BOOT_TEST(test_poll_blocks_until_ready,
+	"Test that Poll blocks on many pipes until one of them receives data"
+	)
+{
+	pipe_t pipe[3];
+	pollfd_t pfd[3];
+	for(int i=0;i<3;i++) {
+		ASSERT(Pipe(&pipe[i])==0);
+		pfd[i] = (pollfd_t){ .fd = pipe[i].read, .events = POLL_READ };
+	}
+
+	Tid_t t = CreateThread(poll_delayed_writer, pipe[1].write, NULL);
+	ASSERT(Poll(pfd, 3, (timeout_t)-1)==1);
+	ASSERT(pfd[0].revents==0 && pfd[1].revents==POLL_READ && pfd[2].revents==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_nonblocking_pipe,
+	"Test that a non-blocking pipe returns WOULDBLOCK instead of blocking"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetNonBlocking(pipe.read, 1)==0);
+	ASSERT(SetNonBlocking(pipe.write, 1)==0);
+	ASSERT(SetNonBlocking(MAX_FILEID, 1)==-1);
+
+	char buffer[4096];
+	ASSERT(Read(pipe.read, buffer, 12)==WOULDBLOCK);
+
+	/* Fill up the pipe */
+	int count = 0, rc;
+	while((rc = Write(pipe.write, buffer, sizeof(buffer))) > 0)
+		count += rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(count>0);
+
+	while((rc = Read(pipe.read, buffer, sizeof(buffer))) > 0)
+		count -= rc;
+	ASSERT(rc==WOULDBLOCK);
+	ASSERT(count==0);
+
+	ASSERT(SetNonBlocking(pipe.read, 0)==0);
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buffer, 12)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_poll_listener,
+	"Test that a listening socket is readable when a connection is pending"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	ASSERT(SetNonBlocking(lsock, 1)==0);
+	ASSERT(Accept(lsock)==NOFILE);
+
+	pollfd_t pfd = { .fd = lsock, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 0)==0);
+
+	Fid_t cli = Socket(NOPORT), srv;
+	struct connect_sockets A = { .sock1=cli, .lsock=lsock, .sock2=&srv, .port=100 };
+	Pid_t pid = Exec(connect_sockets_connect_process, sizeof(A), &A);
+	ASSERT(pid != NOPROC);
+
+	ASSERT(Poll(&pfd, 1, (timeout_t)-1)==1);
+	ASSERT(pfd.revents==POLL_READ);
+	srv = Accept(lsock);
+	ASSERT(srv != NOFILE);
+	ASSERT(WaitChild(pid, NULL)==pid);
+
+	pollfd_t ppfd[2] = {
+		{ .fd = cli, .events = POLL_READ|POLL_WRITE },
+		{ .fd = srv, .events = POLL_READ }
+	};
+	ASSERT(Poll(ppfd, 2, 0)==1);
+	ASSERT(ppfd[0].revents==POLL_WRITE && ppfd[1].revents==0);
+	check_transfer(cli, srv);
+
+	ShutDown(cli, SHUTDOWN_WRITE);
+	ASSERT(Poll(ppfd+1, 1, 0)==1);
+	ASSERT(ppfd[1].revents==(POLL_READ|POLL_HANGUP));
+	return 0;
+}
+
+
+BOOT_TEST(test_poll_terminal,
+	"Test that Poll reports a terminal readable when keyboard data arrives",
+	.minimum_terminals = 1
+	)
+{
+	Fid_t fterm = OpenTerminal(0);
+	ASSERT(fterm!=NOFILE);
+	ASSERT(SetNonBlocking(fterm, 1)==0);
+
+	char buffer[12];
+	ASSERT(Read(fterm, buffer, 12)==WOULDBLOCK);
+
+	pollfd_t pfd = { .fd = fterm, .events = POLL_READ|POLL_WRITE };
+	ASSERT(Poll(&pfd, 1, 0)==1);
+	ASSERT(pfd.revents==POLL_WRITE);
+
+	sendme(0, "Hello world");
+	pfd.events = POLL_READ;
+	ASSERT(Poll(&pfd, 1, (timeout_t)-1)==1);
+	ASSERT(pfd.revents==POLL_READ);
+
+	int count = 0;
+	while(count < 11) {
+		int rc = Read(fterm, buffer+count, 12-count);
+		if(rc==WOULDBLOCK) continue;
+		ASSERT(rc>0);
+		count += rc;
+	}
+	ASSERT(memcmp(buffer, "Hello world", 11)==0);
+	return 0;
+}
+
+
+TEST_SUITE(poll_tests,
+	"A suite of tests for Poll and non-blocking streams."
+	)
+{
+	&test_poll_pipe,
+	&test_poll_timeout,
+	&test_poll_blocks_until_ready,
+	&test_nonblocking_pipe,
+	&test_poll_listener,
+	&test_poll_terminal,
+	NULL
+};
+
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  Event queue tests
+ *
+ *
+ *
+ *********************************************/
+
+
+BOOT_TEST(test_evq_ctl_errors,
+	"Test that EventQueue_Ctl and EventQueue_Wait reject bad arguments"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Fid_t evq = EventQueue_Create();
+	ASSERT(evq!=NOFILE);
+
+	evq_event_t ev;
+	ASSERT(EventQueue_Ctl(pipe.read, EVQ_ADD, pipe.write, POLL_WRITE, 0)==-1);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, MAX_FILEID, POLL_READ, 0)==-1);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, evq, POLL_READ, 0)==-1);
+	ASSERT(EventQueue_Ctl(evq, EVQ_MOD, pipe.read, POLL_READ, 0)==-1);
+	ASSERT(EventQueue_Ctl(evq, EVQ_DEL, pipe.read, POLL_READ, 0)==-1);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.read, POLL_READ, 0)==0);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.read, POLL_READ, 0)==-1);
+
+	ASSERT(EventQueue_Wait(evq, NULL, 1, 0)==-1);
+	ASSERT(EventQueue_Wait(evq, &ev, 0, 0)==-1);
+	ASSERT(EventQueue_Wait(pipe.read, &ev, 1, 0)==-1);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 200)==0);
+
+	ASSERT(Close(evq)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_evq_level_triggered,
+	"Test that a level-triggered stream is reported for as long as it is ready"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Fid_t evq = EventQueue_Create();
+	ASSERT(evq!=NOFILE);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.read, POLL_READ, 42)==0);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.write, POLL_WRITE, 43)==0);
+
+	evq_event_t ev[2];
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+	ASSERT(ev[0].fd==pipe.write && ev[0].events==POLL_WRITE && ev[0].data==43);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_DEL, pipe.write, 0, 0)==0);
+	ASSERT(Write(pipe.write, "Hello world", 12)==12);
+
+	for(int i=0; i<3; i++) {
+		ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+		ASSERT(ev[0].fd==pipe.read && ev[0].events==POLL_READ && ev[0].data==42);
+	}
+
+	char buffer[12];
+	ASSERT(Read(pipe.read, buffer, 12)==12);
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==0);
+
+	/* The reader is still registered, and sees the hangup */
+	Close(pipe.write);
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+	ASSERT(ev[0].events==(POLL_READ|POLL_HANGUP));
+
+	Close(pipe.read);
+	ASSERT(Close(evq)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_evq_edge_triggered,
+	"Test that an edge-triggered stream is reported once per notification"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Fid_t evq = EventQueue_Create();
+	ASSERT(evq!=NOFILE);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.read, POLL_READ|POLL_EDGE, 7)==0);
+
+	evq_event_t ev;
+	ASSERT(Write(pipe.write, "Hello", 5)==5);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==1);
+	ASSERT(ev.fd==pipe.read && ev.events==POLL_READ && ev.data==7);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==0);
+
+	/* New data is a new edge */
+	ASSERT(Write(pipe.write, "Hello", 5)==5);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==1);
+
+	/* Switching to level-triggered re-arms the stream */
+	ASSERT(EventQueue_Ctl(evq, EVQ_MOD, pipe.read, POLL_READ, 8)==0);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==1);
+	ASSERT(ev.data==8);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==1);
+	return 0;
+}
+
+
+BOOT_TEST(test_evq_blocks_until_ready,
+	"Test that EventQueue_Wait blocks until a registered stream becomes ready"
+	)
+{
+	pipe_t pipe[3];
+	Fid_t evq = EventQueue_Create();
+	ASSERT(evq!=NOFILE);
+	for(int i=0;i<3;i++) {
+		ASSERT(Pipe(&pipe[i])==0);
+		ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe[i].read, POLL_READ, i)==0);
+	}
+
+	evq_event_t ev[3];
+	Tid_t t = CreateThread(poll_delayed_writer, pipe[2].write, NULL);
+	ASSERT(EventQueue_Wait(evq, ev, 3, (timeout_t)-1)==1);
+	ASSERT(ev[0].fd==pipe[2].read && ev[0].data==2);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_evq_listener,
+	"Test that an event queue reports pending connections on a listener"
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t evq = EventQueue_Create();
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, lsock, POLL_READ, 0)==0);
+
+	evq_event_t ev;
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==0);
+
+	Fid_t cli = Socket(NOPORT), srv;
+	struct connect_sockets A = { .sock1=cli, .lsock=lsock, .sock2=&srv, .port=100 };
+	Pid_t pid = Exec(connect_sockets_connect_process, sizeof(A), &A);
+	ASSERT(pid != NOPROC);
+
+	ASSERT(EventQueue_Wait(evq, &ev, 1, (timeout_t)-1)==1);
+	ASSERT(ev.fd==lsock && ev.events==POLL_READ);
+	srv = Accept(lsock);
+	ASSERT(srv != NOFILE);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==0);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, srv, POLL_READ, 1)==0);
+	check_transfer(cli, srv);
+	ShutDown(cli, SHUTDOWN_WRITE);
+	ASSERT(EventQueue_Wait(evq, &ev, 1, 0)==1);
+	ASSERT(ev.fd==srv && ev.events==(POLL_READ|POLL_HANGUP));
+	return 0;
+}
+
+
+BOOT_TEST(test_evq_close_unregisters,
+	"Test that a registration does not keep a stream open, and is removed\n"
+	"when the stream is closed"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Fid_t evq = EventQueue_Create();
+	ASSERT(evq!=NOFILE);
+
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.read, POLL_READ, 1)==0);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.write, POLL_WRITE, 2)==0);
+
+	/* A copy of the fid keeps the stream, and its registration */
+	Fid_t copy = 5;
+	ASSERT(Dup2(pipe.write, copy)==0);
+	ASSERT(Close(pipe.write)==0);
+	evq_event_t ev[2];
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+	ASSERT(ev[0].data==2);
+	ASSERT(EventQueue_Ctl(evq, EVQ_DEL, copy, 0, 0)==0);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, copy, POLL_WRITE, 2)==0);
+
+	/* Closing the reader closes the pipe, so the writer sees it */
+	ASSERT(Close(pipe.read)==0);
+	ASSERT(Write(copy, "x", 1)==-1);
+
+	/* Only the writer is left in the queue */
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+	ASSERT(ev[0].data==2);
+	ASSERT(Close(copy)==0);
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==0);
+
+	/* The fids may be reused and registered again */
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(EventQueue_Ctl(evq, EVQ_ADD, pipe.write, POLL_WRITE, 3)==0);
+	ASSERT(EventQueue_Wait(evq, ev, 2, 0)==1);
+	ASSERT(ev[0].data==3);
+
+	ASSERT(Close(evq)==0);
+	return 0;
+}
+
+
+TEST_SUITE(evq_tests,
+	"A suite of tests for event queues."
+	)
+{
+	&test_evq_ctl_errors,
+	&test_evq_level_triggered,
+	&test_evq_edge_triggered,
+	&test_evq_blocks_until_ready,
+	&test_evq_listener,
+	&test_evq_close_unregisters,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  Shared memory tests
+ *
+ *
+ *
+ *********************************************/
+
+
+BOOT_TEST(test_shm_create_attach_release,
+	"Test the basic use and the errors of ShmCreate, ShmAttach and ShmRelease"
+	)
+{
+	char longname[MAX_SHM_NAME+1];
+	memset(longname, 'a', MAX_SHM_NAME);
+	longname[MAX_SHM_NAME] = 0;
+
+	ASSERT(ShmCreate(NULL, 100)==NULL);
+	ASSERT(ShmCreate("", 100)==NULL);
+	ASSERT(ShmCreate(longname, 100)==NULL);
+	ASSERT(ShmCreate("region", 0)==NULL);
+	ASSERT(ShmCreate("region", MAX_SHM_SIZE+1)==NULL);
+	ASSERT(ShmAttach("region", NULL)==NULL);
+
+	char* p = ShmCreate("region", 100);
+	ASSERT(p != NULL);
+	ASSERT(((uintptr_t)p % SHM_PAGE_SIZE) == 0);
+	for(int i=0; i<SHM_PAGE_SIZE; i++) ASSERT(p[i]==0);
+	ASSERT(ShmCreate("region", 100)==NULL);
+
+	unsigned int size = 0;
+	char* q = ShmAttach("region", &size);
+	ASSERT(q == p);
+	ASSERT(size == SHM_PAGE_SIZE);
+
+	/* The region lives until the last attachment is released */
+	ASSERT(ShmRelease(p)==0);
+	ASSERT(ShmAttach("region", NULL)==p);
+	ASSERT(ShmRelease(p)==0);
+	ASSERT(ShmRelease(p)==0);
+	ASSERT(ShmRelease(p)==-1);
+	ASSERT(ShmAttach("region", NULL)==NULL);
+	ASSERT(ShmRelease(NULL)==-1);
+	return 0;
+}
+
+
+static int shm_producer(int argl, void* args)
+{
+	char* buf = ShmAttach("exchange", NULL);
+	ASSERT(buf != NULL);
+
+	/* Fill the region and send the offsets of the payloads */
+	for(unsigned int off = 0; off < 16*SHM_PAGE_SIZE; off += SHM_PAGE_SIZE) {
+		memset(buf+off, off/SHM_PAGE_SIZE + 1, SHM_PAGE_SIZE);
+		ASSERT(Write(argl, (char*)&off, sizeof(off))==sizeof(off));
+	}
+	return 0;	/* the attachment is released at exit */
+}
+
+BOOT_TEST(test_shm_exchange,
+	"Test that processes exchange data in a shared region by passing offsets over a pipe"
+	)
+{
+	char* buf = ShmCreate("exchange", 16*SHM_PAGE_SIZE);
+	ASSERT(buf != NULL);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Pid_t pid = Exec(shm_producer, pipe.write, NULL);
+	ASSERT(pid != NOPROC);
+	Close(pipe.write);
+
+	unsigned int off;
+	int count = 0;
+	while(Read(pipe.read, (char*)&off, sizeof(off))==sizeof(off)) {
+		for(int i=0; i<SHM_PAGE_SIZE; i++)
+			ASSERT(buf[off+i] == (char)(off/SHM_PAGE_SIZE + 1));
+		count++;
+	}
+	ASSERT(count == 16);
+	ASSERT(WaitChild(pid, NULL)==pid);
+
+	ASSERT(ShmRelease(buf)==0);
+	ASSERT(ShmAttach("exchange", NULL)==NULL);
+	return 0;
+}
+
+
+static int shm_creator(int argl, void* args)
+{
+	ASSERT(ShmCreate("orphan", 1000) != NULL);
+	return 0;
+}
+
+BOOT_TEST(test_shm_released_on_exit,
+	"Test that the attachments of a process are released when it exits"
+	)
+{
+	Pid_t pid = Exec(shm_creator, 0, NULL);
+	ASSERT(WaitChild(pid, NULL)==pid);
+	ASSERT(ShmAttach("orphan", NULL)==NULL);
+	ASSERT(ShmCreate("orphan", 1000) != NULL);
+	return 0;
+}
+
+
+TEST_SUITE(shm_tests,
+	"A suite of tests for shared memory."
+	)
+{
+	&test_shm_create_attach_release,
+	&test_shm_exchange,
+	&test_shm_released_on_exit,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  Message queue tests
+ *
+ *
+ *
+ *********************************************/
+
+
+BOOT_TEST(test_msgq_priorities,
+	"Test that messages are received whole, by decreasing priority and in FIFO order"
+	)
+{
+	ASSERT(MsgQueue(0, 100)==NOFILE);
+	ASSERT(MsgQueue(10, 0)==NOFILE);
+	ASSERT(MsgQueue(10, MAX_MSG_SIZE+1)==NOFILE);
+
+	Fid_t mq = MsgQueue(8, 16);
+	ASSERT(mq != NOFILE);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(MsgSend(pipe.write, "x", 1, 0)==-1);
+	ASSERT(MsgSend(mq, "x", 0, 0)==-1);
+	ASSERT(MsgSend(mq, "0123456789abcdefg", 17, 0)==-1);
+	ASSERT(MsgSend(mq, "x", 1, MSGQ_PRIORITIES)==-1);
+
+	ASSERT(Write(mq, "low", 4)==4);
+	ASSERT(MsgSend(mq, "high", 5, 31)==5);
+	ASSERT(MsgSend(mq, "mid1", 5, 7)==5);
+	ASSERT(MsgSend(mq, "mid2", 5, 7)==5);
+
+	/* Messages are never empty, so Read never returns 0 */
+	char buffer[16];
+	ASSERT(Write(mq, buffer, 0)==-1);
+	ASSERT(Read(mq, buffer, 0)==-1);
+	ASSERT(Read(mq, buffer, sizeof(buffer))==5);
+	ASSERT(strcmp(buffer, "high")==0);
+
+	char b[3][16];
+	msg_t msgs[3] = { { b[0], 16 }, { b[1], 16 }, { b[2], 2 } };
+	ASSERT(MsgReceive(mq, NULL, 3)==-1);
+	ASSERT(MsgReceive(mq, msgs, 0)==-1);
+	ASSERT(MsgReceive(mq, msgs, 3)==3);
+	ASSERT(strcmp(b[0], "mid1")==0 && msgs[0].prio==7 && msgs[0].size==5);
+	ASSERT(strcmp(b[1], "mid2")==0 && msgs[1].prio==7);
+	ASSERT(memcmp(b[2], "lo", 2)==0 && msgs[2].prio==0 && msgs[2].size==2);
+
+	/* A full queue would block */
+	pollfd_t pfd = { .fd = mq, .events = POLL_READ|POLL_WRITE };
+	ASSERT(Poll(&pfd, 1, 0)==1 && pfd.revents==POLL_WRITE);
+	ASSERT(SetNonBlocking(mq, 1)==0);
+	ASSERT(Read(mq, buffer, sizeof(buffer))==WOULDBLOCK);
+	ASSERT(MsgReceive(mq, msgs, 3)==WOULDBLOCK);
+	for(int i=0; i<8; i++)
+		ASSERT(MsgSend(mq, "x", 1, i)==1);
+	ASSERT(MsgSend(mq, "x", 1, 0)==WOULDBLOCK);
+	ASSERT(Write(mq, "x", 1)==WOULDBLOCK);
+	ASSERT(Poll(&pfd, 1, 0)==1 && pfd.revents==POLL_READ);
+
+	ASSERT(Close(mq)==0);
+	return 0;
+}
+
+
+static int msgq_producer(int argl, void* args)
+{
+	ASSERT(argl == 2*sizeof(int));
+	int mq = ((int*)args)[0];
+	int id = ((int*)args)[1];
+	for(int i=0; i<100; i++) {
+		int msg[2] = { id, i };
+		ASSERT(MsgSend(mq, (char*)msg, sizeof(msg), 0)==sizeof(msg));
+	}
+	return 0;
+}
+
+BOOT_TEST(test_msgq_fan_in,
+	"Test that many producer processes can feed one consumer, through a small queue"
+	)
+{
+	Fid_t mq = MsgQueue(4, 2*sizeof(int));
+	ASSERT(mq != NOFILE);
+
+	for(int p=0; p<4; p++) {
+		int args[2] = { mq, p };
+		ASSERT(Exec(msgq_producer, sizeof(args), args)!=NOPROC);
+	}
+
+	int next[4] = {0, 0, 0, 0};
+	int total = 0;
+	while(total < 400) {
+		int m[8][2];
+		msg_t msgs[8];
+		for(int i=0; i<8; i++)
+			msgs[i] = (msg_t){ .buf = (char*)m[i], .size = sizeof(m[i]) };
+
+		int n = MsgReceive(mq, msgs, 8);
+		ASSERT(n >= 1 && n <= 4);
+		for(int i=0; i<n; i++) {
+			ASSERT(msgs[i].size == sizeof(m[i]));
+			/* each producer's messages arrive in order */
+			ASSERT(m[i][1] == next[m[i][0]]);
+			next[m[i][0]]++;
+		}
+		total += n;
+	}
+
+	for(int p=0; p<4; p++)
+		ASSERT(WaitChild(NOPROC, NULL)!=NOPROC);
+	return 0;
+}
+
+
+TEST_SUITE(msgq_tests,
+	"A suite of tests for message queues."
+	)
+{
+	&test_msgq_priorities,
+	&test_msgq_fan_in,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  I/O ring tests
+ *
+ *
+ *
+ *********************************************/
+
+
+/* Add a submission to a ring */
+static void ioring_submit(io_ring_t* ring, io_sqe_t sqe)
+{
+	unsigned int tail = ring->sq_tail;
+	ring->sq[tail & (ring->sq_entries-1)] = sqe;
+	__atomic_store_n(&ring->sq_tail, tail+1, __ATOMIC_RELEASE);
+}
+
+/* Take the next completion of a ring */
+static io_cqe_t ioring_reap(io_ring_t* ring)
+{
+	unsigned int head = ring->cq_head;
+	ASSERT(__atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE) != head);
+	io_cqe_t cqe = ring->cq[head & (ring->cq_entries-1)];
+	__atomic_store_n(&ring->cq_head, head+1, __ATOMIC_RELEASE);
+	return cqe;
+}
+
+
+BOOT_TEST(test_ioring_read_write,
+	"Test that an I/O ring performs reads and writes, at once when they\n"
+	"are ready and in a worker when they block, and waits for completions"
+	)
+{
+	io_ring_t* ring;
+	ASSERT(IoRing_Create(0, &ring)==NOFILE);
+	ASSERT(IoRing_Create(MAX_IORING_ENTRIES+1, &ring)==NOFILE);
+	ASSERT(IoRing_Create(4, NULL)==NOFILE);
+
+	Fid_t ior = IoRing_Create(5, &ring);
+	ASSERT(ior!=NOFILE);
+	ASSERT(ring->sq_entries==8 && ring->cq_entries==16);
+
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(IoRing_Enter(pipe.read, 0, 0, 0)==-1);
+	ASSERT(IoRing_Enter(ior, 0, 17, 0)==-1);
+
+	/* Ready operations complete in the call */
+	char buf[16] = {0};
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_WRITE, .fd=pipe.write, .buf="hello", .size=6, .data=1 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipe.read, .buf=buf, .size=16, .data=2 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=NOFILE, .buf=buf, .size=16, .data=3 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_NOP, .data=4 });
+	ASSERT(IoRing_Enter(ior, 8, 0, 0)==4);
+
+	io_cqe_t cqe;
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==1 && cqe.result==6);
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==2 && cqe.result==6);
+	ASSERT(strcmp(buf, "hello")==0);
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==3 && cqe.result==-1);
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==4 && cqe.result==0);
+
+	/* Nothing is in flight, so this does not wait */
+	ASSERT(IoRing_Enter(ior, 0, 1, (timeout_t)-1)==0);
+
+	/* A blocking read completes later */
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipe.read, .buf=buf, .size=16, .data=5 });
+	ASSERT(IoRing_Enter(ior, 1, 1, 50)==1);
+	pollfd_t pfd = { .fd = ior, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 0)==0);
+
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(IoRing_Enter(ior, 0, 1, (timeout_t)-1)==0);
+	ASSERT(Poll(&pfd, 1, 0)==1 && pfd.revents==POLL_READ);
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==5 && cqe.result==1 && buf[0]=='x');
+
+	/* The end of data */
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipe.read, .buf=buf, .size=16, .data=6 });
+	ASSERT(IoRing_Enter(ior, 1, 0, 0)==1);
+	ASSERT(Close(pipe.write)==0);
+	ASSERT(IoRing_Enter(ior, 0, 1, (timeout_t)-1)==0);
+	cqe = ioring_reap(ring);  ASSERT(cqe.data==6 && cqe.result==0);
+
+	ASSERT(Close(ior)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_ioring_many_in_flight,
+	"Test that one thread can keep hundreds of blocking reads in flight on an I/O ring"
+	)
+{
+	const int N = 200;
+	ASSERT(SetFileLimit(2*N+16)==0);
+
+	io_ring_t* ring;
+	Fid_t ior = IoRing_Create(N, &ring);
+	ASSERT(ior!=NOFILE);
+
+	pipe_t pipes[N];
+	char bufs[N];
+	for(int i=0; i<N; i++) {
+		ASSERT(Pipe(&pipes[i])==0);
+		ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipes[i].read, .buf=&bufs[i], .size=1, .data=i });
+	}
+	ASSERT(IoRing_Enter(ior, N, 0, 0)==N);
+
+	/* Feed the pipes in reverse order */
+	for(int i=N-1; i>=0; i--) {
+		char c = (char) i;
+		ASSERT(Write(pipes[i].write, &c, 1)==1);
+	}
+
+	int seen[N];
+	memset(seen, 0, sizeof(seen));
+	for(int done = 0; done < N; ) {
+		ASSERT(IoRing_Enter(ior, 0, 1, (timeout_t)-1)==0);
+		while(ring->cq_head != __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			io_cqe_t cqe = ioring_reap(ring);
+			ASSERT(cqe.result==1 && bufs[cqe.data]==(char)cqe.data);
+			ASSERT(seen[cqe.data]++ == 0);
+			done++;
+		}
+	}
+	return 0;
+}
+
+
+BOOT_TEST(test_ioring_accept_connect,
+	"Test that an I/O ring connects two sockets by an accept and a connect in flight together"
+	)
+{
+	io_ring_t* ring;
+	Fid_t ior = IoRing_Create(4, &ring);
+	ASSERT(ior!=NOFILE);
+
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t cli = Socket(NOPORT);
+
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_ACCEPT, .fd=lsock, .data=1 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_CONNECT, .fd=cli, .port=100, .timeout=1000, .data=2 });
+	ASSERT(IoRing_Enter(ior, 2, 2, (timeout_t)-1)==2);
+
+	Fid_t srv = NOFILE;
+	for(int i=0; i<2; i++) {
+		io_cqe_t cqe = ioring_reap(ring);
+		if(cqe.data==1) srv = cqe.result;
+		else ASSERT(cqe.data==2 && cqe.result==0);
+	}
+	ASSERT(srv!=NOFILE);
+	check_transfer(cli, srv);
+	check_transfer(srv, cli);
+	return 0;
+}
+
+
+static int ioring_pending_child(int argl, void* args)
+{
+	pipe_t* pipe = args;
+	ASSERT(Close(pipe->write)==0);
+
+	io_ring_t* ring;
+	Fid_t ior = IoRing_Create(4, &ring);
+	ASSERT(ior!=NOFILE);
+
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+	Fid_t lsock2 = Socket(101);
+	ASSERT(Listen(lsock2)==0);
+	Fid_t cli = Socket(NOPORT);
+
+	/* An accept, a connect that is never admitted, and a read that the parent never feeds */
+	static char buf[16];
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_ACCEPT, .fd=lsock, .data=1 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_CONNECT, .fd=cli, .port=101, .timeout=100000, .data=2 });
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipe->read, .buf=buf, .size=16, .data=3 });
+	ASSERT(IoRing_Enter(ior, 3, 0, 0)==3);
+
+	/* Let the workers block */
+	ASSERT(IoRing_Enter(ior, 0, 1, 100)==0);
+	ASSERT(ring->cq_head == ring->cq_tail);
+	Exit(7);
+	return 0;
+}
+
+BOOT_TEST(test_ioring_exit_cancels,
+	"Test that a process exits, although operations of its I/O ring are blocked,\n"
+	"and that closing a ring cancels its operations"
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	int status;
+	Pid_t cpid = Exec(ioring_pending_child, sizeof(pipe), &pipe);
+	ASSERT(cpid!=NOPROC);
+	ASSERT(WaitChild(cpid, &status)==cpid);
+	ASSERT(status==7);
+
+	/* A blocked read is cancelled by Close */
+	io_ring_t* ring;
+	Fid_t ior = IoRing_Create(4, &ring);
+	ASSERT(ior!=NOFILE);
+	char buf[16];
+	ioring_submit(ring, (io_sqe_t){ .opcode=IO_READ, .fd=pipe.read, .buf=buf, .size=16, .data=1 });
+	ASSERT(IoRing_Enter(ior, 1, 1, 50)==1);
+	ASSERT(Close(ior)==0);
+
+	/* The worker no longer reads the pipe */
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(Read(pipe.read, buf, 16)==1 && buf[0]=='x');
+	return 0;
+}
+
+
+TEST_SUITE(ioring_tests,
+	"A suite of tests for I/O rings."
+	)
+{
+	&test_ioring_read_write,
+	&test_ioring_many_in_flight,
+	&test_ioring_accept_connect,
+	&test_ioring_exit_cancels,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *
+ *
+ *  File system tests
+ *
+ *
+ *
+ *********************************************/
+
+
+BOOT_TEST(test_fs_read_write_seek,
+	"Test that files are created, read, written, extended and emptied,\n"
+	"through their position"
+	)
+{
+	ASSERT(Open("/f", 0)==NOFILE);
+	ASSERT(Open("/f", OPEN_READ|64)==NOFILE);
+	ASSERT(Open("f", OPEN_RDWR|OPEN_CREATE)==NOFILE);
+	ASSERT(Open("/f", OPEN_RDWR)==NOFILE);
+	ASSERT(Open("/no/f", OPEN_RDWR|OPEN_CREATE)==NOFILE);
+	ASSERT(Open("/..", OPEN_RDWR|OPEN_CREATE)==NOFILE);
+
+	Fid_t fd = Open("/f", OPEN_RDWR|OPEN_CREATE);
+	ASSERT(fd!=NOFILE);
+	ASSERT(Open("/f", OPEN_RDWR|OPEN_CREATE|OPEN_EXCL)==NOFILE);
+
+	char buf[32];
+	ASSERT(Write(fd, "hello world", 11)==11);
+	ASSERT(Read(fd, buf, sizeof(buf))==0);
+	ASSERT(Seek(fd, 6, SEEK_FROM_START)==6);
+	ASSERT(Read(fd, buf, sizeof(buf))==5 && memcmp(buf, "world", 5)==0);
+	ASSERT(Seek(fd, -5, SEEK_FROM_CURRENT)==6);
+	ASSERT(Write(fd, "there", 5)==5);
+	ASSERT(Seek(fd, -1, SEEK_FROM_START)==-1);
+	ASSERT(Seek(fd, 0, SEEK_FROM_END)==11);
+
+	/* A gap reads as zeros */
+	ASSERT(Seek(fd, 5000, SEEK_FROM_END)==5011);
+	ASSERT(Write(fd, "!", 1)==1);
+	stat_t st;
+	ASSERT(Stat("/f", &st)==0 && st.type==FILE_REGULAR && st.size==5012);
+	ASSERT(Seek(fd, 0, SEEK_FROM_START)==0);
+	char big[5012];
+	ASSERT(Read(fd, big, sizeof(big))==5012);
+	ASSERT(memcmp(big, "hello there", 11)==0 && big[11]==0 && big[5010]==0 && big[5011]=='!');
+
+	/* Another open file has its own position */
+	Fid_t fd2 = Open("/f", OPEN_READ);
+	ASSERT(Read(fd2, buf, 5)==5 && memcmp(buf, "hello", 5)==0);
+	ASSERT(Write(fd2, "x", 1)==-1);
+
+	/* Appends go to the end, and truncation empties the file */
+	Fid_t fd3 = Open("/f", OPEN_WRITE|OPEN_APPEND);
+	ASSERT(Write(fd3, "?", 1)==1);
+	ASSERT(Stat("/f", &st)==0 && st.size==5013);
+	ASSERT(Close(fd3)==0);
+	fd3 = Open("/f", OPEN_WRITE|OPEN_TRUNCATE);
+	ASSERT(Stat("/f", &st)==0 && st.size==0);
+	ASSERT(Read(fd2, buf, 5)==0);
+
+	/* Seek is for files only */
+	ASSERT(Seek(fd3, 0, 3)==-1);
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(Seek(pipe.read, 0, SEEK_FROM_START)==-1);
+	return 0;
+}
+
+
+BOOT_TEST(test_fs_directories,
+	"Test that directories are made, listed and removed"
+	)
+{
+	stat_t st;
+	ASSERT(Stat("/", &st)==0 && st.type==FILE_DIRECTORY && st.size==0);
+	ASSERT(Stat("/a", &st)==-1);
+	ASSERT(Stat("/", NULL)==-1);
+
+	ASSERT(MkDir("/a")==0);
+	ASSERT(MkDir("/a")==-1);
+	ASSERT(MkDir("/a/b")==0);
+	ASSERT(MkDir("/x/y")==-1);
+	Fid_t fd = Open("//a///f", OPEN_WRITE|OPEN_CREATE);
+	ASSERT(fd!=NOFILE);
+	ASSERT(MkDir("/a/f/c")==-1);
+	ASSERT(Stat("/a", &st)==0 && st.size==2);
+
+	/* A directory is read for entries, not written */
+	ASSERT(Open("/a", OPEN_WRITE)==NOFILE);
+	Fid_t dir = Open("/a/", OPEN_READ);
+	ASSERT(dir!=NOFILE);
+	dirent_t ents[4];
+	ASSERT(Read(dir, (char*)ents, sizeof(dirent_t)-1)==-1);
+	ASSERT(Read(dir, (char*)ents, sizeof(dirent_t))==sizeof(dirent_t));
+	ASSERT(strcmp(ents[0].name, "b")==0 && ents[0].type==FILE_DIRECTORY);
+	ASSERT(Read(dir, (char*)ents, sizeof(ents))==sizeof(dirent_t));
+	ASSERT(strcmp(ents[0].name, "f")==0 && ents[0].type==FILE_REGULAR);
+	ASSERT(Read(dir, (char*)ents, sizeof(ents))==0);
+	ASSERT(Seek(dir, 0, SEEK_FROM_START)==0);
+	ASSERT(Read(dir, (char*)ents, sizeof(ents))==2*sizeof(dirent_t));
+
+	/* Removal */
+	ASSERT(RmDir("/a")==-1);
+	ASSERT(RmDir("/")==-1);
+	ASSERT(RmDir("/a/f")==-1);
+	ASSERT(Unlink("/a/b")==-1);
+	ASSERT(RmDir("/a/b")==0);
+	ASSERT(Unlink("/a/f")==0);
+	ASSERT(Unlink("/a/f")==-1);
+	ASSERT(RmDir("/a")==0);
+	ASSERT(Read(dir, (char*)ents, sizeof(ents))==0);
+
+	/* An unlinked file lives while it is open */
+	ASSERT(Write(fd, "data", 4)==4);
+	ASSERT(Open("/a/f", OPEN_READ)==NOFILE);
+	return 0;
+}
+
+
+/* Write a number of pages to a file, page i filled with i */
+struct fs_writer_args { int pages; char path[16]; };
+
+static int fs_writer(int argl, void* args)
+{
+	struct fs_writer_args* A = args;
+	Fid_t fd = Open(A->path, OPEN_WRITE|OPEN_CREATE|OPEN_TRUNCATE);
+	ASSERT(fd!=NOFILE);
+	for(int i=0; i<A->pages; i++) {
+		char block[4096];
+		memset(block, (char) i, sizeof(block));
+		ASSERT(Write(fd, block, sizeof(block))==sizeof(block));
+	}
+	return 0;
+}
+
+BOOT_TEST(test_fs_map_file,
+	"Test that the contents of a file, written by another process,\n"
+	"are mapped in page-aligned extents, and stay mapped while the file is open"
+	)
+{
+	/* 3 MB in 768 pages */
+	const int pages = 768;
+	struct fs_writer_args A = { pages, "/data" };
+	Pid_t pid = Exec(fs_writer, sizeof(A), &A);
+	ASSERT(pid!=NOPROC);
+	ASSERT(WaitChild(pid, NULL)==pid);
+
+	Fid_t fd = Open("/data", OPEN_RDWR);
+	ASSERT(fd!=NOFILE);
+	unsigned int size;
+	ASSERT(MapFile(fd, pages*4096ul, &size)==NULL);
+	ASSERT(MapFile(fd, 0, NULL)==NULL);
+
+	/* The extents cover the file */
+	unsigned long offset = 0;
+	int extents = 0;
+	while(offset < pages*4096ul) {
+		char* p = MapFile(fd, offset, &size);
+		ASSERT(p!=NULL && ((uintptr_t)p % SHM_PAGE_SIZE)==0 && size % 4096==0);
+		for(unsigned int i=0; i<size; i+=4096)
+			ASSERT(p[i]==(char)((offset+i)/4096));
+		offset += size;
+		extents++;
+	}
+	ASSERT(offset==pages*4096ul && extents < 16);
+
+	/* Writes through the mapping are seen by reads, and back */
+	char* p = MapFile(fd, 4096+10, &size);
+	ASSERT(p!=NULL);
+	memcpy(p, "mapped", 6);
+	char buf[8];
+	ASSERT(Seek(fd, 4096+10, SEEK_FROM_START)==4096+10);
+	ASSERT(Read(fd, buf, 6)==6 && memcmp(buf, "mapped", 6)==0);
+	ASSERT(Seek(fd, 4096+10, SEEK_FROM_START)==4096+10);
+	ASSERT(Write(fd, "MAPPED", 6)==6);
+	ASSERT(memcmp(p, "MAPPED", 6)==0);
+
+	/* The mapping survives truncation and removal, until closed */
+	A.pages = 1;
+	ASSERT(Exec(fs_writer, sizeof(A), &A)!=NOPROC);
+	ASSERT(WaitChild(NOPROC, NULL)!=NOPROC);
+	ASSERT(Unlink("/data")==0);
+	memcpy(p, "still", 5);
+	ASSERT(Close(fd)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_host_file_needs_hostdir,
+	"Test that host files cannot be opened without a host directory."
+	)
+{
+	ASSERT(OpenHostFile("file", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("file", OPEN_WRITE|OPEN_CREATE)==NOFILE);
+	return 0;
+}
+
+
+#define HOSTFILE_SIZE 300000
+
+static char hostfile_byte(unsigned int i) { return (char)(i % 251); }
+
+/* read a host file to the end, checking its contents */
+static int hostfile_check(Fid_t fid, unsigned int size)
+{
+	char buffer[5000];
+	unsigned int count = 0;
+	int n;
+	while((n = Read(fid, buffer, sizeof(buffer))) > 0) {
+		for(int i=0; i<n; i++)
+			if(buffer[i] != hostfile_byte(count+i)) return 0;
+		count += n;
+	}
+	return n==0 && count==size;
+}
+
+static int hostfile_tester(int argl, void* args)
+{
+	/* Paths must stay under the host directory */
+	ASSERT(OpenHostFile("../input", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("/etc/passwd", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("missing", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("input", OPEN_RDWR)==NOFILE);
+	ASSERT(OpenHostFile("input", OPEN_READ|OPEN_TRUNCATE)==NOFILE);
+
+	/* Symbolic links are refused anywhere in the path, and directories are walked */
+	ASSERT(OpenHostFile("link/input", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("link", OPEN_READ)==NOFILE);
+	ASSERT(OpenHostFile("sub", OPEN_READ)==NOFILE);
+	Fid_t sub = OpenHostFile("sub//./data", OPEN_WRITE|OPEN_CREATE);
+	ASSERT(sub!=NOFILE);
+	ASSERT(Close(sub)==0);
+
+	/* Read a file written by the host */
+	Fid_t in = OpenHostFile("input", OPEN_READ);
+	ASSERT(in!=NOFILE);
+	ASSERT(Write(in, "x", 1)==-1);
+	pollfd_t pfd = { .fd = in, .events = POLL_READ };
+	ASSERT(Poll(&pfd, 1, 1000)==1 && pfd.revents==POLL_READ);
+	ASSERT(hostfile_check(in, HOSTFILE_SIZE));
+	char c;
+	ASSERT(Read(in, &c, 1)==0);
+	ASSERT(Close(in)==0);
+
+	/* Write a file, to be read back by the host */
+	ASSERT(OpenHostFile("input", OPEN_WRITE|OPEN_CREATE|OPEN_EXCL)==NOFILE);
+	Fid_t out = OpenHostFile("output", OPEN_WRITE|OPEN_CREATE|OPEN_TRUNCATE);
+	ASSERT(out!=NOFILE);
+	char buffer[3000];
+	unsigned int count = 0;
+	while(count < HOSTFILE_SIZE) {
+		unsigned int size = HOSTFILE_SIZE - count;
+		if(size > sizeof(buffer)) size = sizeof(buffer);
+		for(unsigned int i=0; i<size; i++)
+			buffer[i] = hostfile_byte(count+i);
+		int n = Write(out, buffer, size);
+		ASSERT(n > 0);
+		count += n;
+	}
+	/* The data has reached the host when Close returns */
+	ASSERT(Close(out)==0);
+
+	in = OpenHostFile("output", OPEN_READ);
+	ASSERT(in!=NOFILE);
+	ASSERT(hostfile_check(in, HOSTFILE_SIZE));
+	ASSERT(Close(in)==0);
+	return 0;
+}
+
+BARE_TEST(test_host_files,
+	"Test that files of the host directory are read and written through\n"
+	"the read-ahead and write-behind buffers."
+	)
+{
+	char dir[64], path[96];
+	snprintf(dir, sizeof(dir), "/tmp/tinyos_hostdir_%d", getpid());
+	ASSERT(mkdir(dir, 0700)==0);
+
+	snprintf(path, sizeof(path), "%s/input", dir);
+	FILE* f = fopen(path, "w");
+	ASSERT(f!=NULL);
+	for(unsigned int i=0; i<HOSTFILE_SIZE; i++)
+		fputc(hostfile_byte(i), f);
+	ASSERT(fclose(f)==0);
+
+	/* A link back to the directory, which must not be followed */
+	snprintf(path, sizeof(path), "%s/link", dir);
+	ASSERT(symlink(dir, path)==0);
+	snprintf(path, sizeof(path), "%s/sub", dir);
+	ASSERT(mkdir(path, 0700)==0);
+
+	ASSERT(boot_hostdir(NULL)==-1);
+	ASSERT(boot_hostdir(dir)==0);
+	boot(2, 0, hostfile_tester, 0, NULL);
+
+	/* Check the file written by TinyOS */
+	snprintf(path, sizeof(path), "%s/output", dir);
+	f = fopen(path, "r");
+	ASSERT(f!=NULL);
+	unsigned int count = 0;
+	int c;
+	while((c = fgetc(f)) != EOF) {
+		ASSERT((char)c == hostfile_byte(count));
+		count++;
+	}
+	ASSERT(count==HOSTFILE_SIZE);
+	fclose(f);
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/input", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/link", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/sub/data", dir);
+	ASSERT(unlink(path)==0);
+	snprintf(path, sizeof(path), "%s/sub", dir);
+	ASSERT(rmdir(path)==0);
+	ASSERT(rmdir(dir)==0);
+}
+
+
+TEST_SUITE(fs_tests,
+	"A suite of tests for the file system."
+	)
+{
+	&test_fs_read_write_seek,
+	&test_fs_directories,
+	&test_fs_map_file,
+	&test_host_file_needs_hostdir,
+	&test_host_files,
 	NULL
 };
 
@@ -2566,6 +5005,12 @@ TEST_SUITE(all_tests,
 	&thread_tests,
 	&pipe_tests,
 	&socket_tests,
+	&poll_tests,
+	&evq_tests,
+	&shm_tests,
+	&msgq_tests,
+	&ioring_tests,
+	&fs_tests,
 	NULL
 };
 